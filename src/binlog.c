@@ -0,0 +1,155 @@
+#include <string.h>
+
+#include "binlog.h"
+#include "util.h"
+
+/* Zero padded, not zero terminated when it fills the field */
+static void put_name(uint8_t* p, const char* name)
+{
+    size_t n = strlen(name);
+    if (n > BINLOG_NAME_SIZE) {
+        n = BINLOG_NAME_SIZE;
+    }
+    memcpy(p, name, n);
+}
+
+void binlog_write_header(FILE* f, const char* rate, const char* mon_version)
+{
+    uint8_t header[BINLOG_HEADER_SIZE];
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+    put_u32(&(header[8]), BINLOG_VERSION);
+    put_name(&(header[16]), rate);
+    put_name(&(header[24]), mon_version);
+    fwrite(header, sizeof(header), 1, f);
+}
+
+/* The payload in up to two parts, straight from the ring */
+void binlog_write_view(FILE* f, uint8_t type, uint64_t time, const Frame_View* view)
+{
+    uint8_t header[BINLOG_RECORD_HEADER_SIZE];
+
+    header[0] = type;
+    header[1] = 0;
+    put_u16(&(header[2]), (uint16_t)(view->length1 + view->length2));
+    put_u32(&(header[4]), (uint32_t)time);
+    put_u32(&(header[8]), (uint32_t)(time >> 32));
+    fwrite(header, sizeof(header), 1, f);
+    if (view->length1 > 0) {
+        fwrite(view->part1, view->length1, 1, f);
+    }
+    if (view->length2 > 0) {
+        fwrite(view->part2, view->length2, 1, f);
+    }
+}
+
+void binlog_write_record(
+        FILE* f, uint8_t type, uint64_t time, const void* payload, uint16_t length)
+{
+    Frame_View view;
+
+    view.part1 = payload;
+    view.length1 = length;
+    view.part2 = NULL;
+    view.length2 = 0;
+    binlog_write_view(f, type, time, &view);
+}
+
+static void encode_fix(const GNSS_Fix* fix, uint8_t* payload)
+{
+    put_u64(&(payload[0]), fix->receive_time);
+    put_u32(&(payload[8]), fix->time_of_day);
+    put_u16(&(payload[12]), fix->year);
+    payload[14] = fix->month;
+    payload[15] = fix->day;
+    put_u32(&(payload[16]), (uint32_t)fix->lat);
+    put_u32(&(payload[20]), (uint32_t)fix->lon);
+    put_u32(&(payload[24]), (uint32_t)fix->altitude);
+    put_u32(&(payload[28]), (uint32_t)fix->speed);
+    put_u32(&(payload[32]), (uint32_t)fix->course);
+    put_u32(&(payload[36]), fix->h_acc);
+    put_u32(&(payload[40]), fix->v_acc);
+    put_u16(&(payload[44]), fix->pdop);
+    put_u16(&(payload[46]), fix->hdop);
+    put_u16(&(payload[48]), fix->vdop);
+    payload[50] = fix->fix_type;
+    payload[51] = fix->num_sv;
+    payload[52] = fix->flags;
+    payload[53] = fix->source;
+    payload[54] = fix->num_sv_view;
+    payload[55] = 0;
+}
+
+void binlog_write_fix(FILE* f, const GNSS_Fix* fix)
+{
+    uint8_t payload[BINLOG_FIX_SIZE];
+
+    encode_fix(fix, payload);
+    binlog_write_record(f, LOG_FIX, fix->receive_time, payload, BINLOG_FIX_SIZE);
+}
+
+/* --------------------------------------------------------------------*/
+
+int binlog_decode_fix(const uint8_t* payload, uint16_t length, GNSS_Fix* fix)
+{
+    if (length < BINLOG_FIX_SIZE) {
+        return 0;
+    }
+    memset(fix, 0, sizeof(GNSS_Fix));
+    fix->receive_time = get_u64(&(payload[0]));
+    fix->time_of_day = get_u32(&(payload[8]));
+    fix->year = get_u16(&(payload[12]));
+    fix->month = payload[14];
+    fix->day = payload[15];
+    fix->lat = (int32_t)get_u32(&(payload[16]));
+    fix->lon = (int32_t)get_u32(&(payload[20]));
+    fix->altitude = (int32_t)get_u32(&(payload[24]));
+    fix->speed = (int32_t)get_u32(&(payload[28]));
+    fix->course = (int32_t)get_u32(&(payload[32]));
+    fix->h_acc = get_u32(&(payload[36]));
+    fix->v_acc = get_u32(&(payload[40]));
+    fix->pdop = get_u16(&(payload[44]));
+    fix->hdop = get_u16(&(payload[46]));
+    fix->vdop = get_u16(&(payload[48]));
+    fix->fix_type = payload[50];
+    fix->num_sv = payload[51];
+    fix->flags = payload[52];
+    fix->source = payload[53];
+    fix->num_sv_view = payload[54];
+    return 1;
+}
+
+/* Returns 0 when data does not start with a binary log header */
+int binlog_read_header(const uint8_t* data, size_t n, Log_Header* header)
+{
+    if (n < BINLOG_HEADER_SIZE ||
+            memcmp(data, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0) {
+        return 0;
+    }
+    header->version = get_u32(&(data[8]));
+    memcpy(header->rate, &(data[16]), BINLOG_NAME_SIZE);
+    header->rate[BINLOG_NAME_SIZE] = 0;
+    memcpy(header->mon_version, &(data[24]), BINLOG_NAME_SIZE);
+    header->mon_version[BINLOG_NAME_SIZE] = 0;
+    return 1;
+}
+
+/* Decode the record at the start of data.  Returns the size of the
+ * record, or 0 when data holds no complete record (end of a possibly
+ * truncated log). */
+size_t binlog_next_record(const uint8_t* data, size_t n, Log_Record* record)
+{
+    if (n < BINLOG_RECORD_HEADER_SIZE) {
+        return 0;
+    }
+    record->type = data[0];
+    record->length = get_u16(&(data[2]));
+    record->time = (uint64_t)get_u32(&(data[4])) |
+        ((uint64_t)get_u32(&(data[8])) << 32);
+    record->payload = &(data[BINLOG_RECORD_HEADER_SIZE]);
+    if (n - BINLOG_RECORD_HEADER_SIZE < record->length) {
+        return 0;
+    }
+    return BINLOG_RECORD_HEADER_SIZE + record->length;
+}
@@ -0,0 +1,82 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fix.h"
+#include "ring.h"
+
+/* Binary log format, the compact alternative to the text log.
+ *
+ * File layout (all numbers little endian):
+ *
+ *   header  "GNSSLOG" 0x00, uint32 version, uint32 reserved,
+ *           char rate[8], char mon_version[8]  (zero padded)
+ *   record  uint8 type, uint8 reserved, uint16 length,
+ *           uint64 receive time (CLOCK_MONOTONIC, ns),
+ *           length bytes of payload
+ *
+ * Payload per record type:
+ *
+ *   LOG_NMEA  the sentence, including the trailing "\r\n"
+ *   LOG_UBX   class, id, uint16 length, body (no sync chars, no checksum)
+ *   LOG_ERR1  the bytes of the interrupted NMEA sentence
+ *   LOG_ERR2  empty
+ *   LOG_ERR3  empty
+ *   LOG_ERR4  empty, NMEA checksum error
+ *   LOG_ERR5  empty, UBX checksum error
+ *   LOG_FIX   a GNSS_Fix (fix.h), its fields in the order of the
+ *             struct, BINLOG_FIX_SIZE bytes
+ *   LOG_STATS the accuracy statistics of the run as text, "Stats:"
+ *             lines (stats.h), the last record
+ *   LOG_PHASE the start of a phase of the schedule (schedule.h) as
+ *             text, a "Phase:" line
+ */
+
+#define BINLOG_MAGIC "GNSSLOG"
+#define BINLOG_VERSION (1U)
+#define BINLOG_HEADER_SIZE (32U)
+#define BINLOG_RECORD_HEADER_SIZE (12U)
+#define BINLOG_NAME_SIZE (8U)
+#define BINLOG_FIX_SIZE (56U)
+
+enum LogRecordType {
+    LOG_NMEA = 1,
+    LOG_UBX  = 2,
+    LOG_ERR1 = 3,
+    LOG_ERR2 = 4,
+    LOG_ERR3 = 5,
+    LOG_FIX  = 6,
+    LOG_ERR4 = 7,
+    LOG_ERR5 = 8,
+    LOG_STATS = 9,
+    LOG_PHASE = 10
+};
+
+typedef struct Log_Header {
+    uint32_t version;
+    char rate[BINLOG_NAME_SIZE + 1];
+    char mon_version[BINLOG_NAME_SIZE + 1];
+} Log_Header;
+
+typedef struct Log_Record {
+    uint8_t type;
+    uint16_t length;
+    uint64_t time;
+    const uint8_t* payload;
+} Log_Record;
+
+void binlog_write_header(FILE* f, const char* rate, const char* mon_version);
+void binlog_write_record(
+        FILE* f, uint8_t type, uint64_t time, const void* payload, uint16_t length);
+void binlog_write_view(FILE* f, uint8_t type, uint64_t time, const Frame_View* view);
+void binlog_write_fix(FILE* f, const GNSS_Fix* fix);
+
+int binlog_read_header(const uint8_t* data, size_t n, Log_Header* header);
+size_t binlog_next_record(const uint8_t* data, size_t n, Log_Record* record);
+/* The fix in a LOG_FIX record, returns 0 when the payload is too short */
+int binlog_decode_fix(const uint8_t* payload, uint16_t length, GNSS_Fix* fix);
+
+#endif /* BINLOG_H */
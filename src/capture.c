@@ -0,0 +1,178 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "capture.h"
+#include "util.h"
+
+static int read_all(int fd, uint8_t* data, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        ssize_t k = read(fd, &(data[done]), n - done);
+        if (k < 0 && errno == EINTR) {
+            continue;
+        }
+        if (k <= 0) {
+            break;
+        }
+        done += (size_t)k;
+    }
+    return (int)done;
+}
+
+static void capture_flush(Capture_Writer* w)
+{
+    if (w->n > 0) {
+        if (write_all(w->fd, w->block, w->n) != 0) {
+            perror("capture write");
+        }
+        w->n = 0;
+    }
+}
+
+/* Copy into the block, writing it out each time it is full */
+static void capture_put(Capture_Writer* w, const uint8_t* data, size_t n)
+{
+    while (n > 0) {
+        size_t room = CAPTURE_BLOCK_SIZE - w->n;
+        size_t k = (n < room) ? n : room;
+        memcpy(&(w->block[w->n]), data, k);
+        w->n += k;
+        data += k;
+        n -= k;
+        if (w->n == CAPTURE_BLOCK_SIZE) {
+            capture_flush(w);
+        }
+    }
+}
+
+Capture_Writer* capture_open(const char* name)
+{
+    Capture_Writer* w;
+    uint8_t header[CAPTURE_HEADER_SIZE];
+
+    w = malloc(sizeof(Capture_Writer));
+    if (w == NULL) {
+        perror("malloc");
+        return NULL;
+    }
+    w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        perror(name);
+        free(w);
+        return NULL;
+    }
+    w->n = 0;
+    w->records = 0;
+    w->bytes = 0;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    put_u32(&(header[8]), CAPTURE_VERSION);
+    capture_put(w, header, sizeof(header));
+
+    return w;
+}
+
+void capture_append_view(Capture_Writer* w, uint64_t time, const Frame_View* view)
+{
+    uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+    size_t n = view->length1 + view->length2;
+
+    put_u32(&(header[0]), (uint32_t)time);
+    put_u32(&(header[4]), (uint32_t)(time >> 32));
+    put_u32(&(header[8]), (uint32_t)n);
+    capture_put(w, header, sizeof(header));
+    capture_put(w, view->part1, view->length1);
+    capture_put(w, view->part2, view->length2);
+    w->records++;
+    w->bytes += n;
+}
+
+void capture_append(Capture_Writer* w, uint64_t time, const uint8_t* data, size_t n)
+{
+    Frame_View view;
+
+    view.part1 = data;
+    view.length1 = n;
+    view.part2 = NULL;
+    view.length2 = 0;
+    capture_append_view(w, time, &view);
+}
+
+int capture_close(Capture_Writer* w)
+{
+    int ok = 1;
+    capture_flush(w);
+    if (close(w->fd) != 0) {
+        perror("capture close");
+        ok = 0;
+    }
+    free(w);
+    return ok;
+}
+
+/* --------------------------------------------------------------------*/
+
+/* A file without the capture header is replayed as raw bytes */
+int capture_open_reader(Capture_Reader* r, int fd)
+{
+    uint8_t header[CAPTURE_HEADER_SIZE];
+    int n;
+
+    r->fd = fd;
+    r->remaining = 0;
+    r->time = 0;
+    r->is_raw = 1;
+
+    n = read_all(fd, header, sizeof(header));
+    if ((n == sizeof(header)) &&
+            (memcmp(header, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) == 0)) {
+        if (get_u32(&(header[8])) != CAPTURE_VERSION) {
+            fprintf(stderr, "Unsupported capture version %u\n", get_u32(&(header[8])));
+            return 0;
+        }
+        r->is_raw = 0;
+    } else {
+        lseek(fd, 0, SEEK_SET);
+    }
+    return 1;
+}
+
+/* Returns the number of bytes read, 0 at the end of the capture.
+ * Records larger than size are returned in several parts. */
+int capture_read(Capture_Reader* r, uint8_t* buffer, size_t size, uint64_t* time)
+{
+    size_t k;
+    int n;
+
+    if (r->is_raw) {
+        n = read(r->fd, buffer, size);
+        *time = 0;
+        return (n < 0) ? 0 : n;
+    }
+    while (r->remaining == 0) {
+        uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+        if (read_all(r->fd, header, sizeof(header)) != sizeof(header)) {
+            return 0;
+        }
+        r->time = (uint64_t)get_u32(&(header[0])) |
+            ((uint64_t)get_u32(&(header[4])) << 32);
+        r->remaining = get_u32(&(header[8]));
+    }
+    k = (r->remaining < size) ? r->remaining : size;
+    n = read_all(r->fd, buffer, k);
+    r->remaining -= (uint32_t)n;
+    if ((size_t)n < k) {
+        /* Truncated capture */
+        r->remaining = 0;
+    }
+    *time = r->time;
+    return n;
+}
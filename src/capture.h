@@ -0,0 +1,50 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ring.h"
+
+/* Raw capture of the byte stream from the receiver.
+ *
+ * File layout (all numbers little endian):
+ *
+ *   header  "GNSSCAP" 0x00, uint32 version, uint32 reserved
+ *   record  uint64 receive time (CLOCK_MONOTONIC, ns),
+ *           uint32 length, length bytes as returned by read()
+ *
+ * Records are packed back to back and written in CAPTURE_BLOCK_SIZE
+ * blocks, so the SD card only sees large aligned writes.
+ */
+
+#define CAPTURE_MAGIC "GNSSCAP"
+#define CAPTURE_VERSION (1U)
+#define CAPTURE_HEADER_SIZE (16U)
+#define CAPTURE_RECORD_HEADER_SIZE (12U)
+#define CAPTURE_BLOCK_SIZE (64*1024)
+
+typedef struct Capture_Writer {
+    int fd;
+    size_t n;
+    uint64_t records;
+    uint64_t bytes;
+    uint8_t block[CAPTURE_BLOCK_SIZE];
+} Capture_Writer;
+
+typedef struct Capture_Reader {
+    int fd;
+    int is_raw;         /* Not a capture, just the bytes */
+    uint32_t remaining; /* Bytes left in the current record */
+    uint64_t time;      /* Receive time of the current record */
+} Capture_Reader;
+
+Capture_Writer* capture_open(const char* name);
+void capture_append(Capture_Writer* w, uint64_t time, const uint8_t* data, size_t n);
+void capture_append_view(Capture_Writer* w, uint64_t time, const Frame_View* view);
+int capture_close(Capture_Writer* w);
+
+int capture_open_reader(Capture_Reader* r, int fd);
+int capture_read(Capture_Reader* r, uint8_t* buffer, size_t size, uint64_t* time);
+
+#endif /* CAPTURE_H */
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "columns.h"
+#include "util.h"
+
+const char* const column_names[NUMBER_OF_COLUMNS] = {
+    "time", "lat", "lon", "alt", "num_sv", "hdop", "fix_type"
+};
+
+static void put_i64(uint8_t* p, int64_t v)
+{
+    put_u64(p, (uint64_t)v);
+}
+
+static int64_t get_i64(const uint8_t* p)
+{
+    return (int64_t)get_u64(p);
+}
+
+/* Howard Hinnant's days_from_civil() */
+int64_t utc_days(int64_t year, unsigned month, unsigned day)
+{
+    int64_t era;
+    unsigned yoe;
+    unsigned doy;
+    unsigned doe;
+
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = (unsigned)(year - era * 400);
+    doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+/* And civil_from_days() */
+void utc_date(int64_t days, int64_t* year, unsigned* month, unsigned* day)
+{
+    int64_t era;
+    unsigned doe;
+    unsigned yoe;
+    unsigned doy;
+    unsigned mp;
+
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = (unsigned)(days - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = (mp < 10) ? mp + 3 : mp - 9;
+    *year = (int64_t)yoe + era * 400 + (*month <= 2);
+}
+
+static void reset_chunk(Column_Writer* w)
+{
+    int i;
+    for (i = 0; i < NUMBER_OF_COLUMNS; i++) {
+        w->columns[i].length = 0;
+        w->columns[i].previous = 0;
+        w->columns[i].min = INT64_MAX;
+        w->columns[i].max = INT64_MIN;
+    }
+    w->rows = 0;
+}
+
+static void* write_thread(void* arg)
+{
+    Column_Writer* w = arg;
+
+    pthread_mutex_lock(&(w->lock));
+    for (;;) {
+        int ok;
+
+        while (!w->busy && !w->stop) {
+            pthread_cond_wait(&(w->changed), &(w->lock));
+        }
+        if (!w->busy) {
+            break;
+        }
+        pthread_mutex_unlock(&(w->lock));
+
+        ok = write_all(w->fd, w->chunk, w->chunk_length) == 0 && fdatasync(w->fd) == 0;
+
+        pthread_mutex_lock(&(w->lock));
+        if (!ok) {
+            w->failed = 1;
+        }
+        w->busy = 0;
+        pthread_cond_broadcast(&(w->changed));
+    }
+    pthread_mutex_unlock(&(w->lock));
+    return NULL;
+}
+
+/* Hand the chunk being filled, if it has rows, to the write thread. It
+ * is copied out, so filling the next one can start right away. */
+static void write_chunk(Column_Writer* w)
+{
+    uint8_t* p;
+    int i;
+
+    if (w->rows == 0) {
+        return;
+    }
+    pthread_mutex_lock(&(w->lock));
+    if (w->busy) {
+        w->waits++;
+    }
+    while (w->busy) {
+        pthread_cond_wait(&(w->changed), &(w->lock));
+    }
+    pthread_mutex_unlock(&(w->lock));
+
+    p = w->chunk;
+    memcpy(p, COLUMNS_CHUNK_MAGIC, 4);
+    put_u32(&(p[4]), (uint32_t)w->rows);
+    p += COLUMNS_CHUNK_HEADER_SIZE;
+    for (i = 0; i < NUMBER_OF_COLUMNS; i++) {
+        put_u32(&(p[0]), (uint32_t)w->columns[i].length);
+        put_i64(&(p[4]), w->columns[i].min);
+        put_i64(&(p[12]), w->columns[i].max);
+        p += COLUMNS_DIRECTORY_SIZE;
+    }
+    for (i = 0; i < NUMBER_OF_COLUMNS; i++) {
+        memcpy(p, w->columns[i].bytes, w->columns[i].length);
+        p += w->columns[i].length;
+    }
+    w->chunk_length = (size_t)(p - w->chunk);
+    w->total_bytes += w->chunk_length;
+    reset_chunk(w);
+
+    pthread_mutex_lock(&(w->lock));
+    w->busy = 1;
+    pthread_cond_broadcast(&(w->changed));
+    pthread_mutex_unlock(&(w->lock));
+}
+
+static void add_value(Column_Buffer* c, int64_t v)
+{
+    uint64_t u = zigzag((int64_t)((uint64_t)v - (uint64_t)c->previous));
+    uint8_t* p = &(c->bytes[c->length]);
+
+    while (u >= 0x80) {
+        *p++ = (uint8_t)(u | 0x80);
+        u >>= 7;
+    }
+    *p++ = (uint8_t)u;
+    c->length = (size_t)(p - c->bytes);
+    c->previous = v;
+    if (v < c->min) {
+        c->min = v;
+    }
+    if (v > c->max) {
+        c->max = v;
+    }
+}
+
+/* Create name for the fixes. Returns NULL on failure. */
+Column_Writer* column_writer_open(const char* name)
+{
+    uint8_t header[COLUMNS_HEADER_SIZE];
+    Column_Writer* w;
+
+    w = calloc(1, sizeof(Column_Writer));
+    if (w == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    w->chunk = malloc(COLUMNS_MAX_CHUNK_SIZE);
+    w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->chunk == NULL || w->fd < 0) {
+        perror(name);
+        if (w->fd >= 0) {
+            close(w->fd);
+        }
+        free(w->chunk);
+        free(w);
+        return NULL;
+    }
+    memset(header, 0, sizeof(header));
+    memcpy(header, COLUMNS_MAGIC, sizeof(COLUMNS_MAGIC));
+    put_u32(&(header[8]), COLUMNS_VERSION);
+    put_u32(&(header[12]), COLUMNS_CHUNK_ROWS);
+    put_u32(&(header[16]), NUMBER_OF_COLUMNS);
+    if (write_all(w->fd, header, sizeof(header)) != 0) {
+        w->failed = 1;
+    }
+    w->total_bytes = sizeof(header);
+    reset_chunk(w);
+
+    pthread_mutex_init(&(w->lock), NULL);
+    pthread_cond_init(&(w->changed), NULL);
+    if (pthread_create(&(w->thread), NULL, write_thread, w) != 0) {
+        perror("pthread_create");
+        pthread_mutex_destroy(&(w->lock));
+        pthread_cond_destroy(&(w->changed));
+        close(w->fd);
+        free(w->chunk);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+void column_writer_add(Column_Writer* w, const GNSS_Fix* fix)
+{
+    int64_t time = 0;
+
+    if (fix->flags & FIX_VALID_DATE) {
+        time = utc_days(fix->year, fix->month, fix->day) * 86400000LL;
+    }
+    if (fix->flags & FIX_VALID_TIME) {
+        time += fix->time_of_day;
+    }
+    add_value(&(w->columns[COLUMN_TIME]), time);
+    add_value(&(w->columns[COLUMN_LAT]), fix->lat);
+    add_value(&(w->columns[COLUMN_LON]), fix->lon);
+    add_value(&(w->columns[COLUMN_ALT]), fix->altitude);
+    add_value(&(w->columns[COLUMN_NUM_SV]), fix->num_sv);
+    add_value(&(w->columns[COLUMN_HDOP]), fix->hdop);
+    add_value(&(w->columns[COLUMN_FIX_TYPE]), fix->fix_type);
+    w->total_rows++;
+    if (++(w->rows) == COLUMNS_CHUNK_ROWS) {
+        write_chunk(w);
+    }
+}
+
+/* Write what is left and close. Returns 0 if anything failed. */
+int column_writer_close(Column_Writer* w)
+{
+    int ok;
+
+    write_chunk(w);
+    pthread_mutex_lock(&(w->lock));
+    w->stop = 1;
+    pthread_cond_broadcast(&(w->changed));
+    pthread_mutex_unlock(&(w->lock));
+    pthread_join(w->thread, NULL);
+
+    if (close(w->fd) != 0) {
+        w->failed = 1;
+    }
+    if (w->failed) {
+        perror("columns");
+    }
+    printf("Columns: %llu fixes in %llu bytes, waited for the disk %llu times\n",
+            (unsigned long long)w->total_rows, (unsigned long long)w->total_bytes,
+            (unsigned long long)w->waits);
+    ok = !w->failed;
+    pthread_mutex_destroy(&(w->lock));
+    pthread_cond_destroy(&(w->changed));
+    free(w->chunk);
+    free(w);
+    return ok;
+}
+
+/* Check the header, returns 0 if this is not a columns file this
+ * version of the code can read */
+int columns_read_header(const uint8_t* data, size_t n)
+{
+    return n >= COLUMNS_HEADER_SIZE &&
+        memcmp(data, COLUMNS_MAGIC, sizeof(COLUMNS_MAGIC)) == 0 &&
+        get_u32(&(data[8])) == COLUMNS_VERSION &&
+        get_u32(&(data[16])) == NUMBER_OF_COLUMNS;
+}
+
+/* Parse the chunk at the start of data. Returns the bytes it takes, 0
+ * at the end or if it is damaged. */
+size_t columns_next_chunk(const uint8_t* data, size_t n, Column_Chunk* chunk)
+{
+    size_t offset = COLUMNS_CHUNK_HEADER_SIZE + NUMBER_OF_COLUMNS * COLUMNS_DIRECTORY_SIZE;
+    const uint8_t* p;
+    int i;
+
+    if (n < offset || memcmp(data, COLUMNS_CHUNK_MAGIC, 4) != 0) {
+        return 0;
+    }
+    chunk->rows = get_u32(&(data[4]));
+    p = &(data[COLUMNS_CHUNK_HEADER_SIZE]);
+    for (i = 0; i < NUMBER_OF_COLUMNS; i++) {
+        chunk->bytes[i] = get_u32(&(p[0]));
+        chunk->min[i] = get_i64(&(p[4]));
+        chunk->max[i] = get_i64(&(p[12]));
+        p += COLUMNS_DIRECTORY_SIZE;
+    }
+    for (i = 0; i < NUMBER_OF_COLUMNS; i++) {
+        if (chunk->bytes[i] > n - offset) {
+            return 0;
+        }
+        chunk->data[i] = &(data[offset]);
+        offset += chunk->bytes[i];
+    }
+    return offset;
+}
+
+/* Decode rows values from a column. Returns 0 if it is damaged. */
+int columns_decode(const uint8_t* data, uint32_t bytes, int64_t* values, uint32_t rows)
+{
+    const uint8_t* end = data + bytes;
+    int64_t previous = 0;
+    uint32_t row;
+
+    for (row = 0; row < rows; row++) {
+        uint64_t u = 0;
+        int shift = 0;
+        uint8_t b;
+        do {
+            if (data == end || shift > 63) {
+                return 0;
+            }
+            b = *data++;
+            u |= (uint64_t)(b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        previous = (int64_t)((uint64_t)previous + (uint64_t)unzigzag(u));
+        values[row] = previous;
+    }
+    return 1;
+}
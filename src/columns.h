@@ -0,0 +1,130 @@
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "fix.h"
+
+/* Columnar export of the fixes (mon -C), so analysis does not have to
+ * parse the log again and can read only the fields it needs.
+ *
+ * The fixes are stored in chunks of COLUMNS_CHUNK_ROWS rows. Within a
+ * chunk each field is a column of its own: the difference of every
+ * value to the one before it (the first to 0), zigzag coded so small
+ * negative steps stay small, as a little endian base 128 varint. A fix
+ * at 5 Hz then takes about 10 bytes. A chunk decodes on its own.
+ *
+ * File layout (all numbers little endian):
+ *
+ *   header  "GNSSCOL" 0x00, uint32 version, uint32 rows per chunk,
+ *           uint32 number of columns, uint32 reserved
+ *   chunk   "CHNK", uint32 rows,
+ *           per column: uint32 bytes, int64 min, int64 max,
+ *           then the bytes of every column, in the same order
+ *
+ * A reader skips the columns, or with min and max whole chunks, it
+ * does not need. Columns, in this order, and their units:
+ *
+ *   time      UTC, ms since 1970, or since midnight without a date
+ *   lat, lon  1e-7 deg
+ *   alt       above mean sea level, mm
+ *   num_sv    satellites used
+ *   hdop      0.01
+ *   fix_type  FIX_TYPE_...
+ *
+ * A full chunk is handed to a thread of the writer that writes and
+ * syncs it, so the disk never holds up the decoding; the last one is
+ * written when the file is closed. A crash loses the fixes of the chunk
+ * being filled: up to COLUMNS_CHUNK_ROWS fixes, about 200 s at 5 Hz or
+ * 17 minutes at 1 Hz. The text or binary log has them all.
+ */
+
+#define COLUMNS_SUFFIX ".cols"
+#define COLUMNS_MAGIC "GNSSCOL"
+#define COLUMNS_CHUNK_MAGIC "CHNK"
+#define COLUMNS_VERSION (1U)
+#define COLUMNS_HEADER_SIZE (24U)
+#define COLUMNS_CHUNK_HEADER_SIZE (8U)
+#define COLUMNS_DIRECTORY_SIZE (20U)   /* Per column */
+#define COLUMNS_CHUNK_ROWS (1024)
+#define COLUMNS_MAX_VARINT (10)
+#define COLUMNS_MAX_CHUNK_SIZE (COLUMNS_CHUNK_HEADER_SIZE + \
+        NUMBER_OF_COLUMNS * (COLUMNS_DIRECTORY_SIZE + COLUMNS_CHUNK_ROWS * COLUMNS_MAX_VARINT))
+
+enum Column {
+    COLUMN_TIME,
+    COLUMN_LAT,
+    COLUMN_LON,
+    COLUMN_ALT,
+    COLUMN_NUM_SV,
+    COLUMN_HDOP,
+    COLUMN_FIX_TYPE,
+    NUMBER_OF_COLUMNS
+};
+
+extern const char* const column_names[NUMBER_OF_COLUMNS];
+
+typedef struct Column_Buffer {
+    uint8_t bytes[COLUMNS_CHUNK_ROWS * COLUMNS_MAX_VARINT];
+    size_t length;
+    int64_t previous;
+    int64_t min;
+    int64_t max;
+} Column_Buffer;
+
+typedef struct Column_Writer {
+    int fd;
+    int rows;               /* In the chunk being filled */
+    uint64_t total_rows;
+    uint64_t total_bytes;
+    Column_Buffer columns[NUMBER_OF_COLUMNS];
+
+    /* Hand over to the write thread, one chunk at a time */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int busy;               /* A chunk is waiting or being written */
+    int stop;
+    uint8_t* chunk;         /* COLUMNS_MAX_CHUNK_SIZE bytes */
+    size_t chunk_length;
+    int failed;
+    uint64_t waits;         /* Times add waited for the disk */
+} Column_Writer;
+
+/* A chunk of a mapped file, see columns_next_chunk() */
+typedef struct Column_Chunk {
+    uint32_t rows;
+    uint32_t bytes[NUMBER_OF_COLUMNS];
+    int64_t min[NUMBER_OF_COLUMNS];
+    int64_t max[NUMBER_OF_COLUMNS];
+    const uint8_t* data[NUMBER_OF_COLUMNS];
+} Column_Chunk;
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* Days since 1970-01-01 of a date, and back */
+int64_t utc_days(int64_t year, unsigned month, unsigned day);
+void utc_date(int64_t days, int64_t* year, unsigned* month, unsigned* day);
+
+/* mon */
+Column_Writer* column_writer_open(const char* name);
+void column_writer_add(Column_Writer* w, const GNSS_Fix* fix);
+int column_writer_close(Column_Writer* w);
+
+/* Readers */
+int columns_read_header(const uint8_t* data, size_t n);
+size_t columns_next_chunk(const uint8_t* data, size_t n, Column_Chunk* chunk);
+int columns_decode(const uint8_t* data, uint32_t bytes, int64_t* values, uint32_t rows);
+
+#endif /* COLUMNS_H */
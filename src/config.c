@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include "config.h"
+#include "ubx.h"
+
+void config_init(Config_Engine* c, int window)
+{
+    memset(c, 0, sizeof(Config_Engine));
+    c->window = (window > 0) ? window : 1;
+}
+
+/* Bytes at the start of the body that tell which setting a CFG message
+ * is about: the port for CFG-PRT, the message for CFG-MSG */
+static uint16_t key_length(uint8_t class, uint8_t id)
+{
+    if (class == UBX_CFG_PRT_CLASS && id == UBX_CFG_PRT_ID) {
+        return 1;
+    } else if (class == UBX_CFG_MSG_CLASS && id == UBX_CFG_MSG_ID) {
+        return 2;
+    }
+    return 0;
+}
+
+/* Write the UBX frame into frame, length + 8 bytes. Returns the size. */
+uint16_t config_frame(uint8_t* frame, uint8_t class, uint8_t id,
+        const void* body, uint16_t length)
+{
+    frame[0] = 0xB5;
+    frame[1] = 0x62;
+    frame[2] = class;
+    frame[3] = id;
+    frame[4] = (uint8_t)length;
+    frame[5] = (uint8_t)(length >> 8);
+    if (length > 0) {
+        memcpy(&(frame[6]), body, length);
+    }
+    ubx_checksum(&(frame[2]), length + 4, &(frame[6 + length]), &(frame[7 + length]));
+    return 8 + length;
+}
+
+static void build(Config_Message* m, uint8_t class, uint8_t id,
+        const void* body, uint16_t length, const char* label)
+{
+    assert(length <= CONFIG_MAX_BODY);
+    memset(m, 0, sizeof(Config_Message));
+    m->size = config_frame(m->frame, class, id, body, length);
+    snprintf(m->label, sizeof(m->label), "%s", label);
+    m->state = CONFIG_QUEUED;
+    m->setting = -1;
+}
+
+/* Queue a CFG message. One without a body, or with just the port or
+ * message it is about, is a poll. */
+void config_add(Config_Engine* c, uint8_t class, uint8_t id,
+        const void* body, uint16_t length, const char* label)
+{
+    Config_Message* m;
+    uint16_t i;
+
+    assert(c->n < CONFIG_MAX_MESSAGES);
+    m = &(c->messages[c->n]);
+    build(m, class, id, body, length, label);
+    m->is_poll = (length == 0) || (length == key_length(class, id));
+
+    printf("%s ", label);
+    for (i = 0; i < m->size; i++) {
+        printf("%02x ", m->frame[i]);
+    }
+    printf("\n");
+
+    c->n++;
+}
+
+/* Queue a setting, or with diff a poll of it */
+void config_set(Config_Engine* c, uint8_t class, uint8_t id,
+        const void* body, uint16_t length, const char* label)
+{
+    char poll_label[sizeof(c->messages[0].label)];
+
+    if (!c->diff) {
+        config_add(c, class, id, body, length, label);
+        c->changes++;
+        return;
+    }
+    assert(c->n_settings < CONFIG_MAX_MESSAGES);
+    build(&(c->settings[c->n_settings]), class, id, body, length, label);
+    snprintf(poll_label, sizeof(poll_label), "check_%s", label);
+    config_add(c, class, id, body, key_length(class, id), poll_label);
+    c->messages[c->n - 1].setting = (int16_t)c->n_settings;
+    c->n_settings++;
+}
+
+static void finish(Config_Engine* c, Config_Message* m, uint8_t state, uint64_t now)
+{
+    if (m->state == CONFIG_SENT) {
+        m->state = state;
+        m->done_at = now;
+        c->in_flight--;
+        c->finished++;
+    }
+}
+
+/* Write the frame of m, or the rest of it if it is the one partly
+ * written. Returns 0 when it did not all fit, then nothing else may be
+ * written before the rest of it. */
+static int send_message(Config_Engine* c, Config_Message* m, int fd, uint64_t now)
+{
+    uint16_t written = (c->writing == m) ? c->written : 0;
+    ssize_t k = write(fd, &(m->frame[written]), m->size - written);
+
+    if (k > 0) {
+        written += (uint16_t)k;
+    }
+    if (written < m->size) {
+        if (written > 0) {
+            c->writing = m;
+            c->written = written;
+        }
+        c->stalled_at = now;
+        return 0;
+    }
+    c->writing = NULL;
+    c->stalled_at = 0;
+    if (m->state == CONFIG_QUEUED) {
+        /* Always the next one */
+        m->state = CONFIG_SENT;
+        c->next++;
+        c->in_flight++;
+    }
+    m->sent_at = now;
+    m->tries++;
+    return 1;
+}
+
+/* Whether the receiver answered the poll with the value of setting */
+static int has_setting(const Config_Engine* c, const Config_Message* setting,
+        const Config_Message* poll)
+{
+    const uint8_t* body = &(setting->frame[6]);
+    uint16_t length = setting->size - 8;
+
+    if (!poll->responded) {
+        return 0;
+    }
+    if (setting->frame[2] == UBX_CFG_MSG_CLASS && setting->frame[3] == UBX_CFG_MSG_ID &&
+            length == UBX_CFG_MSG_LENGTH) {
+        /* CFG-MSG sets the rate on the port it came in on, the answer
+         * has the rates on all six ports */
+        return c->port >= 0 && c->port < 6 && poll->response_length >= 8 &&
+            poll->response[2 + c->port] == body[2];
+    }
+    return poll->response_length == length && memcmp(poll->response, body, length) == 0;
+}
+
+/* All that was queued is answered, queue what comes next: the settings
+ * that differ, then the save */
+static void next_phase(Config_Engine* c)
+{
+    int n = c->n;
+    int i;
+
+    if (c->diff && !c->checked) {
+        for (i = 0; i < n; i++) {
+            const Config_Message* m = &(c->messages[i]);
+            if (m->setting >= 0) {
+                const Config_Message* setting = &(c->settings[m->setting]);
+                if (has_setting(c, setting, m)) {
+                    c->unchanged++;
+                } else {
+                    config_add(c, setting->frame[2], setting->frame[3], &(setting->frame[6]),
+                            setting->size - 8, setting->label);
+                    c->changes++;
+                }
+            }
+        }
+        c->checked = 1;
+    }
+    if (c->save && !c->saved && c->changes > 0 && c->finished == c->n) {
+        UBX_CFG_CFG save;
+        uint8_t body[UBX_CFG_CFG_LENGTH];
+        memset(&save, 0, sizeof(save));
+        save.saveMask = CONFIG_SAVE_MASK;
+        save.deviceMask = CONFIG_SAVE_DEVICES;
+        config_add(c, UBX_CFG_CFG_CLASS, UBX_CFG_CFG_ID, body, ubx_encode_CFG_CFG(&save, body),
+                "save_config");
+        c->saved = 1;
+    }
+}
+
+/* Resend what timed out and fill the window. Call again on every
+ * answer and at config_deadline(). */
+void config_send(Config_Engine* c, int fd, uint64_t now)
+{
+    int i;
+
+    if (c->started == 0) {
+        c->started = now;
+    }
+    if (c->writing != NULL && !send_message(c, c->writing, fd, now)) {
+        return;
+    }
+    if (c->finished == c->n) {
+        next_phase(c);
+    }
+    for (i = 0; i < c->next; i++) {
+        Config_Message* m = &(c->messages[i]);
+        if (m->state == CONFIG_SENT && now - m->sent_at >= CONFIG_TIMEOUT_NS) {
+            if (m->tries >= CONFIG_MAX_TRIES) {
+                /* A late ACK or NAK is not for it any more */
+                m->answered = 1;
+                finish(c, m, CONFIG_FAILED, now);
+            } else if (!send_message(c, m, fd, now)) {
+                return;
+            }
+        }
+    }
+    while (c->next < c->n && c->in_flight < c->window) {
+        if (!send_message(c, &(c->messages[c->next]), fd, now)) {
+            break;
+        }
+    }
+}
+
+/* The oldest message sent with this class and id that is still waiting
+ * for an ACK or NAK: one in flight, or a poll that already has the
+ * polled message, which comes before the ACK */
+static Config_Message* find(Config_Engine* c, uint8_t class, uint8_t id)
+{
+    int i;
+    for (i = 0; i < c->next; i++) {
+        Config_Message* m = &(c->messages[i]);
+        if (m->frame[2] == class && m->frame[3] == id && !m->answered &&
+                (m->state == CONFIG_SENT || (m->is_poll && m->responded))) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+/* The oldest poll still waiting for the message it polled, the body of
+ * which starts with the port or message polled */
+static Config_Message* find_poll(Config_Engine* c, uint8_t class, uint8_t id,
+        const uint8_t* body, uint16_t length)
+{
+    int i;
+    for (i = 0; i < c->next; i++) {
+        Config_Message* m = &(c->messages[i]);
+        uint16_t key = m->size - 8;
+        if (m->frame[2] == class && m->frame[3] == id && m->is_poll && !m->responded &&
+                key <= length && memcmp(&(m->frame[6]), body, key) == 0) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+/* Feed every ACK and CFG message received */
+void config_receive(Config_Engine* c, uint8_t class, uint8_t id,
+        const uint8_t* body, uint16_t length, uint64_t now)
+{
+    Config_Message* m;
+    UBX_ACK_ACK ack;
+
+    /* ACK-NAK has the same fields */
+    if (class == UBX_CLASS_ACK && ubx_decode_ACK_ACK(body, length, &ack)) {
+        m = find(c, ack.clsID, ack.msgID);
+        if (m != NULL) {
+            m->answered = 1;
+            finish(c, m, (id == UBX_ACK_ACK_ID) ? CONFIG_ACKED : CONFIG_NAKED, now);
+        }
+    } else if (class == UBX_CLASS_CFG) {
+        m = find_poll(c, class, id, body, length);
+        if (m != NULL) {
+            m->responded = 1;
+            m->response_length = length;
+            memcpy(m->response, body, (length < CONFIG_MAX_BODY) ? length : CONFIG_MAX_BODY);
+            finish(c, m, CONFIG_ACKED, now);
+        }
+    }
+}
+
+int config_done(const Config_Engine* c)
+{
+    return c->finished == c->n && c->writing == NULL && (!c->diff || c->checked) &&
+        (!c->save || c->saved || c->changes == 0);
+}
+
+/* When the oldest unanswered message times out, or a write that did
+ * not finish is tried again; 0 if none is waiting */
+uint64_t config_deadline(const Config_Engine* c)
+{
+    uint64_t deadline = 0;
+    int i;
+    if (c->stalled_at != 0) {
+        deadline = c->stalled_at + CONFIG_RETRY_NS;
+    }
+    for (i = 0; i < c->next; i++) {
+        const Config_Message* m = &(c->messages[i]);
+        if (m->state == CONFIG_SENT) {
+            uint64_t t = m->sent_at + CONFIG_TIMEOUT_NS;
+            if (deadline == 0 || t < deadline) {
+                deadline = t;
+            }
+        }
+    }
+    return deadline;
+}
+
+void config_report(const Config_Engine* c, FILE* out)
+{
+    static const char* state_names[] = {
+        "not sent", "no answer yet", "ack", "nak", "no answer"
+    };
+    int count[CONFIG_FAILED + 1];
+    int resent = 0;
+    uint64_t last = c->started;
+    int i;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < c->n; i++) {
+        const Config_Message* m = &(c->messages[i]);
+        count[m->state]++;
+        if (m->tries > 1) {
+            resent++;
+        }
+        if (m->done_at > last) {
+            last = m->done_at;
+        }
+        if (m->state != CONFIG_ACKED) {
+            fprintf(out, "  %s: %s\n", m->label, state_names[m->state]);
+        } else if (m->is_poll && !m->responded) {
+            fprintf(out, "  %s: ack without response\n", m->label);
+        }
+    }
+    if (c->diff) {
+        fprintf(out, "Configuration: %d of %d settings already set\n",
+                c->unchanged, c->n_settings);
+    }
+    fprintf(out, "Configuration: %d messages in %.0f ms, %d ack, %d nak, "
+            "%d no answer, %d not done, %d resent\n",
+            c->n, (double)(last - c->started) / 1.0e6,
+            count[CONFIG_ACKED], count[CONFIG_NAKED], count[CONFIG_FAILED],
+            count[CONFIG_QUEUED] + count[CONFIG_SENT], resent);
+}
@@ -0,0 +1,101 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Configuration of the receiver as a series of transactions.
+ *
+ * Messages are sent in the order they were added, with at most window
+ * of them waiting for an answer at a time. Every CFG message is
+ * answered with ACK-ACK or ACK-NAK, a poll also with the polled message.
+ * Answers are matched to the oldest message with the same class and id
+ * still waiting for one. A message without an answer in time is sent
+ * again, up to CONFIG_MAX_TRIES times.
+ *
+ * The receiver fd is non-blocking, a write may take only part of a
+ * frame. The rest is written first on the next config_send(), which
+ * config_deadline() then asks for after CONFIG_RETRY_NS, so the
+ * receiver never sees a frame cut short and then sent again whole.
+ *
+ * Settings added with config_set() are sent as they are, or, with diff
+ * set, first polled. Only the settings the receiver does not have yet
+ * are then sent. With save set the result is stored in the battery
+ * backed RAM and flash of the receiver (CFG-CFG) when anything changed.
+ */
+
+#define CONFIG_MAX_MESSAGES (100)
+#define CONFIG_MAX_BODY (64)
+#define CONFIG_WINDOW (4)
+#define CONFIG_TIMEOUT_NS (500000000ULL)
+#define CONFIG_MAX_TRIES (3)
+#define CONFIG_RETRY_NS (10000000ULL)
+/* CFG-CFG sections: port, message and navigation settings */
+#define CONFIG_SAVE_MASK (0x0000000BU)
+/* CFG-CFG devices: BBR, flash, EEPROM, SPI flash */
+#define CONFIG_SAVE_DEVICES (0x17U)
+
+enum Config_State {
+    CONFIG_QUEUED,
+    CONFIG_SENT,
+    CONFIG_ACKED,
+    CONFIG_NAKED,
+    CONFIG_FAILED       /* No answer after CONFIG_MAX_TRIES */
+};
+
+typedef struct Config_Message {
+    uint8_t frame[8 + CONFIG_MAX_BODY];
+    uint16_t size;
+    char label[32];
+    uint8_t state;
+    uint8_t is_poll;    /* Expects the polled message back */
+    uint8_t answered;   /* ACK or NAK seen */
+    uint8_t responded;  /* Polled message seen */
+    uint8_t tries;
+    uint64_t sent_at;   /* Last time it was sent */
+    uint64_t done_at;
+    uint8_t response[CONFIG_MAX_BODY];  /* Polled message, cut short */
+    uint16_t response_length;
+    int16_t setting;    /* diff: the setting this polls, otherwise -1 */
+} Config_Message;
+
+typedef struct Config_Engine {
+    Config_Message messages[CONFIG_MAX_MESSAGES];
+    int n;
+    int next;           /* First message not sent yet */
+    int window;
+    int in_flight;
+    int finished;
+    uint64_t started;
+    Config_Message* writing;    /* Frame partly written, or NULL */
+    uint16_t written;           /* Bytes of it written */
+    uint64_t stalled_at;        /* Last write that did not finish, or 0 */
+
+    /* Set these after config_init() */
+    int diff;           /* Send only the settings that differ */
+    int save;           /* Store the settings with CFG-CFG */
+    int port;           /* Receiver port we are on, for CFG-MSG rates */
+
+    Config_Message settings[CONFIG_MAX_MESSAGES];
+    int n_settings;
+    int checked;        /* diff: the settings that differ are queued */
+    int unchanged;      /* diff: settings the receiver already had */
+    int changes;        /* Settings queued to be sent */
+    int saved;          /* CFG-CFG is queued */
+} Config_Engine;
+
+uint16_t config_frame(uint8_t* frame, uint8_t class, uint8_t id,
+        const void* body, uint16_t length);
+void config_init(Config_Engine* c, int window);
+void config_add(Config_Engine* c, uint8_t class, uint8_t id,
+        const void* body, uint16_t length, const char* label);
+void config_set(Config_Engine* c, uint8_t class, uint8_t id,
+        const void* body, uint16_t length, const char* label);
+void config_send(Config_Engine* c, int fd, uint64_t now);
+void config_receive(Config_Engine* c, uint8_t class, uint8_t id,
+        const uint8_t* body, uint16_t length, uint64_t now);
+int config_done(const Config_Engine* c);
+uint64_t config_deadline(const Config_Engine* c);
+void config_report(const Config_Engine* c, FILE* out);
+
+#endif /* CONFIG_H */
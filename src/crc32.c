@@ -0,0 +1,32 @@
+#include <pthread.h>
+
+#include "crc32.h"
+
+static uint32_t crc_table[256];
+/* The sync threads of several logs can get here at once */
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void make_table(void)
+{
+    uint32_t i;
+    for (i = 0; i < 256; i++) {
+        uint32_t c = i;
+        int k;
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? (0xEDB88320U ^ (c >> 1)) : (c >> 1);
+        }
+        crc_table[i] = c;
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t n)
+{
+    size_t i;
+
+    pthread_once(&crc_table_once, make_table);
+    crc = ~crc;
+    for (i = 0; i < n; i++) {
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
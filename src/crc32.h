@@ -0,0 +1,11 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* CRC-32 as used by zlib and Ethernet. Pass 0 to start, or the CRC of
+ * the preceding bytes to continue. */
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t n);
+
+#endif /* CRC32_H */
@@ -0,0 +1,49 @@
+#ifndef FIX_H
+#define FIX_H
+
+#include <stdint.h>
+
+/* One position fix, decoded from UBX-NAV-PVT or from the NMEA sentences
+ * of an epoch. Fixed layout, integers only, so it can be written to a
+ * log as is. Fields the source does not provide are 0. */
+
+#define FIX_SOURCE_NMEA (1)
+#define FIX_SOURCE_UBX  (2)
+
+#define FIX_TYPE_NONE   (0)
+#define FIX_TYPE_DR     (1) /* Dead reckoning only */
+#define FIX_TYPE_2D     (2)
+#define FIX_TYPE_3D     (3)
+#define FIX_TYPE_GNSS_DR (4)
+#define FIX_TYPE_TIME   (5) /* Time only */
+
+#define FIX_VALID_DATE  (0x01)
+#define FIX_VALID_TIME  (0x02)
+#define FIX_OK          (0x04) /* Within the configured accuracy limits */
+#define FIX_DIFF        (0x08) /* Differential corrections applied */
+
+typedef struct GNSS_Fix {
+    uint64_t receive_time;  /* Host CLOCK_MONOTONIC, ns */
+    uint32_t time_of_day;   /* UTC, ms since midnight */
+    uint16_t year;
+    uint8_t  month;
+    uint8_t  day;
+    int32_t  lat;           /* 1e-7 deg */
+    int32_t  lon;           /* 1e-7 deg */
+    int32_t  altitude;      /* Above mean sea level, mm */
+    int32_t  speed;         /* Ground speed, mm/s */
+    int32_t  course;        /* Course over ground, 1e-5 deg */
+    uint32_t h_acc;         /* Horizontal accuracy estimate, mm */
+    uint32_t v_acc;         /* Vertical accuracy estimate, mm */
+    uint16_t pdop;          /* 0.01 */
+    uint16_t hdop;          /* 0.01 */
+    uint16_t vdop;          /* 0.01 */
+    uint8_t  fix_type;      /* FIX_TYPE_... */
+    uint8_t  num_sv;        /* Satellites used */
+    uint8_t  flags;         /* FIX_VALID_..., FIX_OK, FIX_DIFF */
+    uint8_t  source;        /* FIX_SOURCE_... */
+    uint8_t  num_sv_view;   /* Satellites in view (NMEA GSV only) */
+    uint8_t  reserved;
+} GNSS_Fix;
+
+#endif /* FIX_H */
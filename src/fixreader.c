@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "shmfix.h"
+#include "util.h"
+
+/* Reads the latest fixes mon -P publishes in shared memory */
+
+#define WATCH_INTERVAL_NS (200000)
+
+static void usage(void)
+{
+    printf("fixreader:  print the fixes mon -P publishes\n");
+    printf("Usage:\n");
+    printf("./fixreader [-w] [-n NUM] [-r RECEIVER] [NAME]\n");
+    printf("\n");
+    printf("-w      -- print every new fix until mon stops.\n");
+    printf("-n NUM  -- with -w, stop after NUM fixes.\n");
+    printf("-r NUM  -- only receiver NUM (all of them).\n");
+    printf("NAME    -- the shared memory name (%s).\n", SHM_FIX_NAME);
+}
+
+static void print_heading(void)
+{
+    printf("receiver,count,latency_us,age_ms,date,time,lat,lon,altitude,"
+            "h_acc,v_acc,pdop,fix_type,num_sv\n");
+}
+
+/* latency_us is from reading the bytes to publishing the fix, age_ms
+ * from publishing it to now */
+static void print_fix(int receiver, const Shm_Fix_Data* data, uint64_t now)
+{
+    const GNSS_Fix* fix = &(data->fix);
+    uint32_t t = fix->time_of_day;
+
+    printf("%d,%llu,%.1f,%.3f,%04d-%02d-%02d,%02u:%02u:%02u.%03u,%.7f,%.7f,%.3f,"
+            "%.3f,%.3f,%.2f,%d,%d\n",
+            receiver, (unsigned long long)data->count,
+            (double)(data->publish_time - fix->receive_time) / 1.0e3,
+            (double)(now - data->publish_time) / 1.0e6,
+            fix->year, fix->month, fix->day,
+            t / 3600000, (t / 60000) % 60, (t / 1000) % 60, t % 1000,
+            fix->lat / 1.0e7, fix->lon / 1.0e7, fix->altitude / 1.0e3,
+            fix->h_acc / 1.0e3, fix->v_acc / 1.0e3, fix->pdop / 100.0,
+            fix->fix_type, fix->num_sv);
+}
+
+int main(int argc, char** argv)
+{
+    const char* name = SHM_FIX_NAME;
+    const Shm_Fix* shm;
+    uint64_t seen[SHM_FIX_SLOTS];
+    struct timespec interval = { 0, WATCH_INTERVAL_NS };
+    int watch = 0;
+    int only = -1;
+    long limit = 0;
+    long printed = 0;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "wn:r:h")) != -1) {
+        switch (opt) {
+            case 'w':
+                watch = 1;
+                break;
+            case 'n':
+                limit = atol(optarg);
+                break;
+            case 'r':
+                only = atoi(optarg);
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc) {
+        name = argv[optind];
+    }
+    shm = shm_fix_open(name);
+    if (shm == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    print_heading();
+    memset(seen, 0, sizeof(seen));
+    do {
+        for (i = 0; i < (int)shm->slots; i++) {
+            Shm_Fix_Data data;
+            if ((only >= 0 && i != only) || !shm_fix_read(shm, i, &data) ||
+                    data.count == seen[i]) {
+                continue;
+            }
+            seen[i] = data.count;
+            print_fix(i, &data, monotonic_ns());
+            printed++;
+        }
+        if (watch) {
+            fflush(stdout);
+            nanosleep(&interval, NULL);
+        }
+    } while (watch && atomic_load(&(shm->active)) && (limit == 0 || printed < limit));
+
+    shm_fix_close(shm);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,675 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+
+#include "config.h"
+#include "util.h"
+
+/* Simulates a u-blox receiver on a pseudo terminal, for testing mon
+ * without the hardware:
+ *
+ *   ./gnss_sim -t 60 -l /tmp/ttyGNSS &
+ *   ./mon -t 50 -D /tmp/ttyGNSS
+ *
+ * It answers the CFG messages mon sends, with the settings it keeps:
+ * CFG-PRT, CFG-MSG and CFG-RATE polls with the current values, other
+ * CFG polls with an empty-valued body, every valid CFG message with an
+ * ACK and anything else with a NAK. Every epoch it sends the NMEA
+ * sentences and UBX NAV messages that are switched on, with a position
+ * that wanders around a fixed point.
+ *
+ * Output can be limited to a byte rate, and bytes can be flipped or
+ * dropped at random, or held back for a while (a stall), all from a
+ * seeded generator so runs can be repeated.
+ */
+
+#define SIM_PORT (3)                /* USB, where mon expects to be */
+#define SIM_MIN_PERIOD_MS (20)      /* 50 Hz */
+#define SIM_OUT_SIZE (1024*1024)    /* The receiver's TX buffer, sort of */
+#define SIM_IN_SIZE (4096)
+#define SIM_LAT (521234567)         /* 1e-7 deg */
+#define SIM_LON (43456789)
+#define SIM_ALT (12345)             /* mm */
+#define SIM_NUM_SV (12)
+#define METERS_PER_LAT (6371000.0 * M_PI / 180.0e7)
+
+/* The output messages, with their rates per epoch */
+typedef struct Sim_Message {
+    uint8_t class;
+    uint8_t id;
+    uint8_t rate;
+    const char* name;
+} Sim_Message;
+
+static Sim_Message g_messages[] = {
+    { 0xF0, 0x04, 1, "RMC" },
+    { 0xF0, 0x05, 1, "VTG" },
+    { 0xF0, 0x00, 1, "GGA" },
+    { 0xF0, 0x02, 1, "GSA" },
+    { 0xF0, 0x03, 1, "GSV" },
+    { 0xF0, 0x01, 1, "GLL" },
+    { 0x01, 0x04, 0, "NAV-DOP" },
+    { 0x01, 0x07, 0, "NAV-PVT" },
+    { 0x01, 0x35, 0, "NAV-SAT" },
+};
+#define NUMBER_OF_MESSAGES (sizeof(g_messages) / sizeof(g_messages[0]))
+
+typedef struct Sim_Options {
+    const char* link;
+    int seconds;
+    uint32_t byte_rate;         /* 0 for no limit */
+    uint32_t flip_every;        /* A bit error every that many bytes */
+    uint32_t drop_every;        /* A dropped byte every that many bytes */
+    int stall_ms;
+    int stall_every_s;
+    int nak_id;                 /* NAK this CFG id, -1 for none */
+    uint32_t seed;
+} Sim_Options;
+
+typedef struct Sim_Stats {
+    uint64_t epochs;
+    uint64_t bytes;             /* Written to the pty */
+    uint64_t flipped;
+    uint64_t dropped;
+    uint64_t overflow;          /* Did not fit in the TX buffer */
+    uint64_t stalls;
+    uint64_t acks;
+    uint64_t naks;
+    uint64_t polls;
+} Sim_Stats;
+
+static uint8_t g_out[SIM_OUT_SIZE];
+static size_t g_out_n = 0;
+static uint8_t g_prt[6][20];        /* CFG-PRT body per port */
+static uint16_t g_period_ms = 1000;
+static uint32_t g_random;
+static Sim_Options g_options;
+static Sim_Stats g_stats;
+static volatile sig_atomic_t g_stop = 0;
+
+static void on_signal(int signal)
+{
+    (void)signal;
+    g_stop = 1;
+}
+
+/* xorshift32 */
+static uint32_t sim_random(void)
+{
+    uint32_t x = g_random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_random = x;
+    return x;
+}
+
+/* Roughly normal, sigma 1 */
+static double sim_gauss(void)
+{
+    double sum = 0.0;
+    int i;
+    for (i = 0; i < 12; i++) {
+        sum += (double)sim_random() / 4294967296.0;
+    }
+    return sum - 6.0;
+}
+
+/* Into the TX buffer, with the errors asked for */
+static void output(const uint8_t* data, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        uint8_t c = data[i];
+        if (g_options.drop_every > 0 && sim_random() % g_options.drop_every == 0) {
+            g_stats.dropped++;
+            continue;
+        }
+        if (g_options.flip_every > 0 && sim_random() % g_options.flip_every == 0) {
+            c ^= (uint8_t)(1U << (sim_random() & 7));
+            g_stats.flipped++;
+        }
+        if (g_out_n == SIM_OUT_SIZE) {
+            g_stats.overflow++;
+            continue;
+        }
+        g_out[g_out_n++] = c;
+    }
+}
+
+static void output_ubx(uint8_t class, uint8_t id, const uint8_t* body, uint16_t length)
+{
+    uint8_t frame[8 + 1024];
+    output(frame, config_frame(frame, class, id, body, length));
+}
+
+static void output_nmea(const char* body)
+{
+    char sentence[256];
+    uint8_t checksum = 0;
+    const char* p;
+
+    for (p = body; *p != 0; p++) {
+        checksum ^= (uint8_t)(*p);
+    }
+    snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+    output((const uint8_t*)sentence, strlen(sentence));
+}
+
+static Sim_Message* find_message(uint8_t class, uint8_t id)
+{
+    size_t i;
+    for (i = 0; i < NUMBER_OF_MESSAGES; i++) {
+        if (g_messages[i].class == class && g_messages[i].id == id) {
+            return &(g_messages[i]);
+        }
+    }
+    return NULL;
+}
+
+/* ddmm.mmmmm from 1e-7 degrees */
+static void nmea_angle(char* text, size_t size, int32_t value, int degree_digits)
+{
+    int32_t a = (value < 0) ? -value : value;
+    int32_t degrees = a / 10000000;
+    double minutes = (double)(a % 10000000) * 60.0 / 1.0e7;
+    snprintf(text, size, "%0*d%08.5f", degree_digits, degrees, minutes);
+}
+
+/* One epoch of output, at UTC time t (ms since the epoch) */
+static void output_epoch(uint64_t epoch, uint64_t t, int32_t lat, int32_t lon)
+{
+    time_t seconds = (time_t)(t / 1000);
+    uint32_t ms = (uint32_t)(t % 1000);
+    uint32_t itow;
+    struct tm utc;
+    char lat_text[24];
+    char lon_text[24];
+    char body[256];
+    char hms[16];
+    char date[40];
+    size_t i;
+
+    gmtime_r(&seconds, &utc);
+    itow = (uint32_t)((((utc.tm_wday * 24 + utc.tm_hour) * 60 + utc.tm_min) * 60 + utc.tm_sec) *
+            1000 + ms);
+    snprintf(hms, sizeof(hms), "%02d%02d%02d.%02u", utc.tm_hour, utc.tm_min, utc.tm_sec, ms / 10);
+    snprintf(date, sizeof(date), "%02d%02d%02d", utc.tm_mday, utc.tm_mon + 1, utc.tm_year % 100);
+    nmea_angle(lat_text, sizeof(lat_text), lat, 2);
+    nmea_angle(lon_text, sizeof(lon_text), lon, 3);
+
+    for (i = 0; i < NUMBER_OF_MESSAGES; i++) {
+        const Sim_Message* m = &(g_messages[i]);
+        if (m->rate == 0 || epoch % m->rate != 0) {
+            continue;
+        }
+        if (m->class == 0xF0) {
+            switch (m->id) {
+                case 0x04:
+                    snprintf(body, sizeof(body), "GPRMC,%s,A,%s,%c,%s,%c,0.012,,%s,,,A",
+                            hms, lat_text, (lat < 0) ? 'S' : 'N', lon_text, (lon < 0) ? 'W' : 'E',
+                            date);
+                    output_nmea(body);
+                    break;
+                case 0x05:
+                    output_nmea("GPVTG,,T,,M,0.012,N,0.022,K,A");
+                    break;
+                case 0x00:
+                    snprintf(body, sizeof(body), "GPGGA,%s,%s,%c,%s,%c,1,%02d,0.92,%.1f,M,46.9,M,,",
+                            hms, lat_text, (lat < 0) ? 'S' : 'N', lon_text, (lon < 0) ? 'W' : 'E',
+                            SIM_NUM_SV, SIM_ALT / 1000.0);
+                    output_nmea(body);
+                    break;
+                case 0x02:
+                    output_nmea("GPGSA,A,3,02,05,07,09,13,15,18,20,24,28,29,30,1.52,0.92,1.21");
+                    break;
+                case 0x03:
+                    output_nmea("GPGSV,3,1,12,02,35,141,44,05,62,279,47,07,18,042,38,09,07,324,31");
+                    output_nmea("GPGSV,3,2,12,13,71,101,48,15,22,221,40,18,11,188,35,20,45,062,45");
+                    output_nmea("GPGSV,3,3,12,24,09,287,33,28,30,122,42,29,53,301,46,30,26,253,41");
+                    break;
+                case 0x01:
+                    snprintf(body, sizeof(body), "GPGLL,%s,%c,%s,%c,%s,A,A",
+                            lat_text, (lat < 0) ? 'S' : 'N', lon_text, (lon < 0) ? 'W' : 'E', hms);
+                    output_nmea(body);
+                    break;
+            }
+        } else if (m->id == 0x04) {
+            uint8_t dop[18];
+            put_u32(&(dop[0]), itow);
+            put_u16(&(dop[4]), 180);    /* gDOP */
+            put_u16(&(dop[6]), 152);    /* pDOP */
+            put_u16(&(dop[8]), 95);     /* tDOP */
+            put_u16(&(dop[10]), 121);   /* vDOP */
+            put_u16(&(dop[12]), 92);    /* hDOP */
+            put_u16(&(dop[14]), 70);    /* nDOP */
+            put_u16(&(dop[16]), 60);    /* eDOP */
+            output_ubx(0x01, 0x04, dop, sizeof(dop));
+        } else if (m->id == 0x07) {
+            uint8_t pvt[92];
+            memset(pvt, 0, sizeof(pvt));
+            put_u32(&(pvt[0]), itow);
+            put_u16(&(pvt[4]), (uint16_t)(utc.tm_year + 1900));
+            pvt[6] = (uint8_t)(utc.tm_mon + 1);
+            pvt[7] = (uint8_t)utc.tm_mday;
+            pvt[8] = (uint8_t)utc.tm_hour;
+            pvt[9] = (uint8_t)utc.tm_min;
+            pvt[10] = (uint8_t)utc.tm_sec;
+            pvt[11] = 0x07;             /* Date, time, fully resolved */
+            put_u32(&(pvt[12]), 30);    /* tAcc */
+            put_u32(&(pvt[16]), ms * 1000000U);
+            pvt[20] = 3;                /* 3D */
+            pvt[21] = 0x01;             /* gnssFixOK */
+            pvt[23] = SIM_NUM_SV;
+            put_u32(&(pvt[24]), (uint32_t)lon);
+            put_u32(&(pvt[28]), (uint32_t)lat);
+            put_u32(&(pvt[32]), SIM_ALT + 46900);
+            put_u32(&(pvt[36]), SIM_ALT);
+            put_u32(&(pvt[40]), 1400);  /* hAcc */
+            put_u32(&(pvt[44]), 2100);  /* vAcc */
+            put_u32(&(pvt[60]), 12);    /* gSpeed */
+            put_u16(&(pvt[76]), 152);   /* pDOP */
+            output_ubx(0x01, 0x07, pvt, sizeof(pvt));
+        } else if (m->id == 0x35) {
+            uint8_t sat[8 + 12 * SIM_NUM_SV];
+            int k;
+            memset(sat, 0, sizeof(sat));
+            put_u32(&(sat[0]), itow);
+            sat[4] = 1;
+            sat[5] = SIM_NUM_SV;
+            for (k = 0; k < SIM_NUM_SV; k++) {
+                uint8_t* s = &(sat[8 + 12 * k]);
+                s[1] = (uint8_t)(2 + 2 * k);                /* svId */
+                s[2] = (uint8_t)(30 + (sim_random() % 18)); /* cno */
+                s[3] = (uint8_t)(10 + 6 * k);               /* elev */
+                put_u16(&(s[4]), (uint16_t)(30 * k));       /* azim */
+                put_u32(&(s[8]), 0x0000000F);               /* used */
+            }
+            output_ubx(0x01, 0x35, sat, sizeof(sat));
+        }
+    }
+}
+
+static void ack(uint8_t id, int ok)
+{
+    uint8_t body[2] = { 0x06, id };
+    output_ubx(0x05, ok ? 0x01 : 0x00, body, sizeof(body));
+    if (ok) {
+        g_stats.acks++;
+    } else {
+        g_stats.naks++;
+    }
+}
+
+/* Answer a message from mon, ACK or NAK for every CFG message */
+static void handle_input(uint8_t class, uint8_t id, const uint8_t* body, uint16_t length)
+{
+    uint8_t answer[64];
+    int ok = 1;
+
+    if (class != 0x06) {
+        return;
+    }
+    if (id == g_options.nak_id) {
+        ack(id, 0);
+        return;
+    }
+    switch (id) {
+        case 0x00:  /* CFG-PRT */
+            if (length == 1 && body[0] < 6) {
+                output_ubx(0x06, 0x00, g_prt[body[0]], 20);
+                g_stats.polls++;
+            } else if (length == 20 && body[0] < 6) {
+                memcpy(g_prt[body[0]], body, 20);
+            } else {
+                ok = 0;
+            }
+            break;
+        case 0x01:  /* CFG-MSG */
+            if (length == 2) {
+                Sim_Message* m = find_message(body[0], body[1]);
+                memset(answer, 0, 8);
+                answer[0] = body[0];
+                answer[1] = body[1];
+                answer[2 + SIM_PORT] = (m != NULL) ? m->rate : 0;
+                output_ubx(0x06, 0x01, answer, 8);
+                g_stats.polls++;
+            } else if (length == 3 || length == 8) {
+                Sim_Message* m = find_message(body[0], body[1]);
+                if (m != NULL) {
+                    m->rate = (length == 3) ? body[2] : body[2 + SIM_PORT];
+                }
+            } else {
+                ok = 0;
+            }
+            break;
+        case 0x08:  /* CFG-RATE */
+            if (length == 0) {
+                put_u16(&(answer[0]), g_period_ms);
+                put_u16(&(answer[2]), 1);
+                put_u16(&(answer[4]), 0);
+                output_ubx(0x06, 0x08, answer, 6);
+                g_stats.polls++;
+            } else if (length == 6 && (body[0] | (body[1] << 8)) >= SIM_MIN_PERIOD_MS) {
+                g_period_ms = (uint16_t)(body[0] | (body[1] << 8));
+            } else {
+                ok = 0;
+            }
+            break;
+        case 0x09:  /* CFG-CFG */
+            ok = (length == 12 || length == 13);
+            break;
+        case 0x06:  /* CFG-DAT */
+        case 0x23:  /* CFG-NAVX5 */
+        case 0x24:  /* CFG-NAV5 */
+        case 0x3E:  /* CFG-GNSS */
+            if (length == 0) {
+                static const uint16_t lengths[] = { [0x06] = 44, [0x23] = 40, [0x24] = 36, [0x3E] = 4 };
+                memset(answer, 0, sizeof(answer));
+                output_ubx(0x06, id, answer, lengths[id]);
+                g_stats.polls++;
+            }
+            break;
+        default:
+            ok = 0;
+            break;
+    }
+    ack(id, ok);
+}
+
+/* Take the UBX frames out of what came in, returns the bytes used */
+static size_t scan_input(const uint8_t* data, size_t n)
+{
+    size_t i = 0;
+
+    while (i + 8 <= n) {
+        uint16_t length;
+        uint8_t a = 0;
+        uint8_t b = 0;
+        size_t k;
+
+        if (data[i] != 0xB5 || data[i + 1] != 0x62) {
+            i++;
+            continue;
+        }
+        length = (uint16_t)(data[i + 4] | (data[i + 5] << 8));
+        if (length > SIM_IN_SIZE - 8) {
+            i++;
+            continue;
+        }
+        if (i + 8 + length > n) {
+            break;
+        }
+        for (k = i + 2; k < i + 6 + length; k++) {
+            a = a + data[k];
+            b = b + a;
+        }
+        if (data[i + 6 + length] == a && data[i + 7 + length] == b) {
+            handle_input(data[i + 2], data[i + 3], &(data[i + 6]), length);
+            i += 8 + length;
+        } else {
+            i++;
+        }
+    }
+    return i;
+}
+
+static int open_pty(void)
+{
+    struct termios tio;
+    const char* name;
+    int master;
+    int slave;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("pty");
+        return -1;
+    }
+    name = ptsname(master);
+    /* Raw, and kept open so the pty stays when mon closes its end */
+    slave = open(name, O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        perror(name);
+        close(master);
+        return -1;
+    }
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    if (g_options.link != NULL) {
+        unlink(g_options.link);
+        if (symlink(name, g_options.link) != 0) {
+            perror(g_options.link);
+            close(master);
+            return -1;
+        }
+    }
+    printf("Simulating a receiver on %s%s%s\n", name,
+            (g_options.link != NULL) ? " as " : "",
+            (g_options.link != NULL) ? g_options.link : "");
+    fflush(stdout);
+    return master;
+}
+
+static void usage(void)
+{
+    printf("gnss_sim:  u-blox receiver simulator on a pseudo terminal\n");
+    printf("Usage:\n");
+    printf("./gnss_sim [-t SECONDS] [-l LINK] [-r HZ] [-p] [-s] [-b BYTES] [-e NUM] [-d NUM]\n");
+    printf("           [-z MS,SECONDS] [-N ID] [-x SEED]\n");
+    printf("\n");
+    printf("-t SEC   -- stop after SEC seconds (0, run until SIGINT).\n");
+    printf("-l LINK  -- make LINK a symbolic link to the pty, for mon -D LINK.\n");
+    printf("-r HZ    -- navigation rate at start, 1 to 50 (1).\n");
+    printf("-p       -- NAV-PVT and NAV-DOP at start instead of NMEA.\n");
+    printf("-s       -- as -p, plus NAV-SAT.\n");
+    printf("-b BYTES -- send at most BYTES bytes per second.\n");
+    printf("-e NUM   -- flip a bit in about one of every NUM bytes.\n");
+    printf("-d NUM   -- drop about one of every NUM bytes.\n");
+    printf("-z MS,S  -- hold the output for MS milliseconds every S seconds.\n");
+    printf("-N ID    -- answer CFG messages with this id with a NAK.\n");
+    printf("-x SEED  -- seed of the errors and the position noise.\n");
+}
+
+int main(int argc, char** argv)
+{
+    uint8_t input[SIM_IN_SIZE];
+    size_t input_n = 0;
+    uint64_t start;
+    uint64_t next_epoch;
+    uint64_t next_stall = 0;
+    uint64_t stall_end = 0;
+    uint64_t last_send;
+    double allowance = 0.0;
+    double north = 0.0;
+    double east = 0.0;
+    int nav_mode = 0;
+    int fd;
+    int opt;
+    int i;
+
+    memset(&g_options, 0, sizeof(g_options));
+    g_options.nak_id = -1;
+    g_options.seed = 0x12345678U;
+    while ((opt = getopt(argc, argv, "t:l:r:psb:e:d:z:N:x:h")) != -1) {
+        switch (opt) {
+            case 't':
+                g_options.seconds = atoi(optarg);
+                break;
+            case 'l':
+                g_options.link = optarg;
+                break;
+            case 'r':
+                if (atoi(optarg) < 1 || atoi(optarg) > 1000 / SIM_MIN_PERIOD_MS) {
+                    printf("-r: 1 to %d Hz\n", 1000 / SIM_MIN_PERIOD_MS);
+                    return EXIT_FAILURE;
+                }
+                g_period_ms = (uint16_t)(1000 / atoi(optarg));
+                break;
+            case 'p':
+                nav_mode = 1;
+                break;
+            case 's':
+                nav_mode = 2;
+                break;
+            case 'b':
+                g_options.byte_rate = (uint32_t)atol(optarg);
+                break;
+            case 'e':
+                g_options.flip_every = (uint32_t)atol(optarg);
+                break;
+            case 'd':
+                g_options.drop_every = (uint32_t)atol(optarg);
+                break;
+            case 'z':
+                if (sscanf(optarg, "%d,%d", &(g_options.stall_ms), &(g_options.stall_every_s)) != 2 ||
+                        g_options.stall_ms <= 0 || g_options.stall_every_s <= 0) {
+                    printf("-z: MS,SECONDS\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'N':
+                g_options.nak_id = (int)strtol(optarg, NULL, 0);
+                break;
+            case 'x':
+                g_options.seed = (uint32_t)strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    g_random = (g_options.seed != 0) ? g_options.seed : 1;
+    if (nav_mode != 0) {
+        for (i = 0; i < (int)NUMBER_OF_MESSAGES; i++) {
+            Sim_Message* m = &(g_messages[i]);
+            m->rate = (m->class == 0x01) ? (m->id != 0x35 || nav_mode == 2) : 0;
+        }
+    }
+    for (i = 0; i < 6; i++) {
+        /* 8N1, 9600 baud, UBX and NMEA in and out */
+        memset(g_prt[i], 0, 20);
+        g_prt[i][0] = (uint8_t)i;
+        if (i == 1 || i == 2) {
+            put_u32(&(g_prt[i][4]), 0x000008C0);
+            put_u32(&(g_prt[i][8]), 9600);
+        }
+        put_u16(&(g_prt[i][12]), 0x0003);
+        put_u16(&(g_prt[i][14]), 0x0003);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    fd = open_pty();
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    start = monotonic_ns();
+    next_epoch = start;
+    last_send = start;
+    if (g_options.stall_ms > 0) {
+        next_stall = start + (uint64_t)g_options.stall_every_s * 1000000000ULL;
+    }
+    while (!g_stop) {
+        struct pollfd p;
+        struct timespec wall;
+        uint64_t now = monotonic_ns();
+        int timeout;
+
+        if (g_options.seconds > 0 && now - start >= (uint64_t)g_options.seconds * 1000000000ULL) {
+            break;
+        }
+        if (now >= next_epoch) {
+            /* A random walk, pulled back to the fixed point */
+            north = 0.9 * north + 0.5 * sim_gauss();
+            east = 0.9 * east + 0.5 * sim_gauss();
+            clock_gettime(CLOCK_REALTIME, &wall);
+            output_epoch(g_stats.epochs,
+                    (uint64_t)wall.tv_sec * 1000ULL + (uint64_t)wall.tv_nsec / 1000000ULL,
+                    SIM_LAT + (int32_t)(north / METERS_PER_LAT),
+                    SIM_LON + (int32_t)(east / (METERS_PER_LAT * cos(SIM_LAT * M_PI / 180.0e7))));
+            g_stats.epochs++;
+            next_epoch += (uint64_t)g_period_ms * 1000000ULL;
+            if (next_epoch < now) {
+                next_epoch = now;
+            }
+        }
+        if (next_stall != 0 && now >= next_stall) {
+            stall_end = now + (uint64_t)g_options.stall_ms * 1000000ULL;
+            next_stall += (uint64_t)g_options.stall_every_s * 1000000000ULL;
+            g_stats.stalls++;
+        }
+
+        /* Send what the byte rate and a stall allow */
+        if (g_options.byte_rate > 0) {
+            allowance += (double)(now - last_send) * g_options.byte_rate / 1.0e9;
+            if (allowance > g_options.byte_rate / 10.0 + 1) {
+                allowance = g_options.byte_rate / 10.0 + 1;
+            }
+        }
+        last_send = now;
+        if (g_out_n > 0 && now >= stall_end) {
+            size_t n = g_out_n;
+            ssize_t k;
+            if (g_options.byte_rate > 0 && n > (size_t)allowance) {
+                n = (size_t)allowance;
+            }
+            k = (n > 0) ? write(fd, g_out, n) : 0;
+            if (k > 0) {
+                memmove(g_out, &(g_out[k]), g_out_n - (size_t)k);
+                g_out_n -= (size_t)k;
+                g_stats.bytes += (uint64_t)k;
+                allowance -= (double)k;
+            }
+        }
+
+        timeout = (int)((next_epoch - now) / 1000000ULL);
+        if (g_out_n > 0) {
+            timeout = 1;
+        }
+        p.fd = fd;
+        p.events = POLLIN;
+        if (poll(&p, 1, timeout) > 0 && (p.revents & POLLIN)) {
+            ssize_t k = read(fd, &(input[input_n]), sizeof(input) - input_n);
+            if (k > 0) {
+                size_t used;
+                input_n += (size_t)k;
+                used = scan_input(input, input_n);
+                if (used == 0 && input_n == sizeof(input)) {
+                    used = input_n;
+                }
+                memmove(input, &(input[used]), input_n - used);
+                input_n -= used;
+            }
+        }
+    }
+
+    printf("Simulated %llu epochs at %u ms, %llu bytes sent, %llu bits flipped, "
+            "%llu bytes dropped, %llu bytes overflowed, %llu stalls\n",
+            (unsigned long long)g_stats.epochs, g_period_ms, (unsigned long long)g_stats.bytes,
+            (unsigned long long)g_stats.flipped, (unsigned long long)g_stats.dropped,
+            (unsigned long long)g_stats.overflow, (unsigned long long)g_stats.stalls);
+    printf("Configuration: %llu ACK, %llu NAK, %llu polls answered\n",
+            (unsigned long long)g_stats.acks, (unsigned long long)g_stats.naks,
+            (unsigned long long)g_stats.polls);
+    if (g_options.link != NULL) {
+        unlink(g_options.link);
+    }
+    close(fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+
+#include "link.h"
+#include "config.h"
+#include "util.h"
+
+#define LINK_BUFFER_SIZE (4096)
+#define LINK_MAX_NMEA (100)
+#define LINK_MAX_UBX (1024)
+
+typedef struct Baud_Rate {
+    uint32_t baud;
+    speed_t speed;
+} Baud_Rate;
+
+/* In the order they are tried */
+static const Baud_Rate baud_rates[] = {
+    { 9600, B9600 },
+    { 38400, B38400 },
+    { 115200, B115200 },
+    { 230400, B230400 },
+    { 460800, B460800 },
+    { 921600, B921600 },
+};
+#define NUMBER_OF_BAUD_RATES (sizeof(baud_rates) / sizeof(baud_rates[0]))
+
+/* Index of baud in baud_rates, NUMBER_OF_BAUD_RATES if it is not there */
+static size_t find_rate(uint32_t baud)
+{
+    size_t i;
+
+    for (i = 0; i < NUMBER_OF_BAUD_RATES; i++) {
+        if (baud_rates[i].baud == baud) {
+            break;
+        }
+    }
+    return i;
+}
+
+int link_supported(uint32_t baud)
+{
+    return find_rate(baud) < NUMBER_OF_BAUD_RATES;
+}
+
+int link_set_speed(int fd, uint32_t baud)
+{
+    struct termios tio;
+    size_t i = find_rate(baud);
+
+    if (i == NUMBER_OF_BAUD_RATES) {
+        printf("Link: unsupported rate %u\n", baud);
+        return 0;
+    }
+    if (tcgetattr(fd, &tio) != 0 ||
+            cfsetispeed(&tio, baud_rates[i].speed) != 0 ||
+            cfsetospeed(&tio, baud_rates[i].speed) != 0 ||
+            tcsetattr(fd, TCSANOW, &tio) != 0) {
+        perror("link speed");
+        return 0;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return 1;
+}
+
+static int hex_value(uint8_t c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/* data holds a sentence from '$' up to '\n' */
+static int nmea_ok(const uint8_t* data, size_t n)
+{
+    uint8_t sum = 0;
+    size_t i;
+
+    for (i = 1; i < n && data[i] != '*'; i++) {
+        sum ^= data[i];
+    }
+    if (i + 3 > n) {
+        return 0;
+    }
+    return hex_value(data[i + 1]) == (sum >> 4) && hex_value(data[i + 2]) == (sum & 0x0F);
+}
+
+static int ubx_ok(const uint8_t* data, size_t n)
+{
+    uint8_t a = 0;
+    uint8_t b = 0;
+    size_t i;
+
+    for (i = 2; i < n - 2; i++) {
+        a = a + data[i];
+        b = b + a;
+    }
+    return data[n - 2] == a && data[n - 1] == b;
+}
+
+/* Count the good frames in data. Returns the number of bytes looked
+ * at, what is left is the start of a frame that is not complete yet. */
+static size_t scan(Link_Stats* stats, uint8_t port, const uint8_t* data, size_t n)
+{
+    size_t i = 0;
+
+    while (i < n) {
+        size_t left = n - i;
+        if (data[i] == 0xB5) {
+            if (left < 6) {
+                break;
+            }
+            if (data[i + 1] == 0x62) {
+                size_t length = (size_t)(data[i + 4] | (data[i + 5] << 8)) + 8;
+                if (length <= LINK_MAX_UBX && left < length) {
+                    break;
+                }
+                if (length <= LINK_MAX_UBX && ubx_ok(&(data[i]), length)) {
+                    if (data[i + 2] == UBX_CFG_PRT_CLASS && data[i + 3] == UBX_CFG_PRT_ID &&
+                            length == 8 + UBX_CFG_PRT_LENGTH && data[i + 6] == port) {
+                        ubx_decode_CFG_PRT(&(data[i + 6]), UBX_CFG_PRT_LENGTH, &(stats->port_config));
+                        stats->has_port_config = 1;
+                    }
+                    stats->frames++;
+                    stats->good_bytes += length;
+                    i += length;
+                    continue;
+                }
+            }
+        } else if (data[i] == '$') {
+            const uint8_t* end = memchr(&(data[i]), '\n', (left < LINK_MAX_NMEA) ? left : LINK_MAX_NMEA);
+            if (end == NULL && left < LINK_MAX_NMEA) {
+                break;
+            }
+            if (end != NULL && nmea_ok(&(data[i]), (size_t)(end - &(data[i])))) {
+                size_t length = (size_t)(end - &(data[i])) + 1;
+                stats->frames++;
+                stats->good_bytes += length;
+                i += length;
+                continue;
+            }
+        }
+        i++;
+    }
+    return i;
+}
+
+/* Read for ms milliseconds and count what comes in. A poll of the
+ * CFG-PRT of port is sent first, so there is an answer even when the
+ * receiver has its output switched off. */
+void link_measure(int fd, uint8_t port, int ms, Link_Stats* stats)
+{
+    uint8_t buffer[LINK_BUFFER_SIZE];
+    uint8_t frame[16];
+    uint8_t body[UBX_CFG_PRT_POLL_LENGTH];
+    UBX_CFG_PRT_POLL prt;
+    size_t fill = 0;
+    uint64_t start = monotonic_ns();
+    uint64_t end = start + (uint64_t)ms * 1000000ULL;
+    uint64_t now;
+
+    memset(stats, 0, sizeof(Link_Stats));
+    prt.portID = port;
+    if (write(fd, frame, config_frame(frame, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+                    ubx_encode_CFG_PRT_POLL(&prt, body))) < 0) {
+        perror("link write");
+    }
+    while ((now = monotonic_ns()) < end) {
+        struct pollfd p;
+        ssize_t k;
+        size_t used;
+
+        p.fd = fd;
+        p.events = POLLIN;
+        if (poll(&p, 1, (int)((end - now) / 1000000ULL) + 1) <= 0) {
+            continue;
+        }
+        k = read(fd, &(buffer[fill]), sizeof(buffer) - fill);
+        if (k <= 0) {
+            continue;
+        }
+        stats->bytes += (uint64_t)k;
+        fill += (size_t)k;
+        used = scan(stats, port, buffer, fill);
+        if (used == 0 && fill == sizeof(buffer)) {
+            used = 1;
+        }
+        memmove(buffer, &(buffer[used]), fill - used);
+        fill -= used;
+    }
+    stats->seconds = (double)(monotonic_ns() - start) / 1.0e9;
+}
+
+static int link_good(const Link_Stats* stats)
+{
+    return stats->frames >= LINK_MIN_FRAMES &&
+        (double)(stats->bytes - stats->good_bytes) <= LINK_MAX_LOSS * (double)stats->bytes;
+}
+
+static void report(uint32_t baud, const Link_Stats* stats)
+{
+    printf("Link: %6u baud: %7.0f bytes/s in %u frames, %.1f%% of %llu bytes lost\n",
+            baud, (double)stats->good_bytes / stats->seconds, stats->frames,
+            (stats->bytes > 0) ?
+                100.0 * (double)(stats->bytes - stats->good_bytes) / (double)stats->bytes : 0.0,
+            (unsigned long long)stats->bytes);
+}
+
+static int try_rate(int fd, uint8_t port, uint32_t baud, int ms, Link_Stats* stats)
+{
+    if (!link_set_speed(fd, baud)) {
+        return 0;
+    }
+    link_measure(fd, port, ms, stats);
+    report(baud, stats);
+    return link_good(stats);
+}
+
+/* The rate the receiver sends at, 0 if it is not found */
+uint32_t link_probe(int fd, uint8_t port, Link_Stats* stats)
+{
+    size_t i;
+
+    for (i = 0; i < NUMBER_OF_BAUD_RATES; i++) {
+        if (try_rate(fd, port, baud_rates[i].baud, LINK_PROBE_MS, stats)) {
+            return baud_rates[i].baud;
+        }
+    }
+    return 0;
+}
+
+/* Switch the link on port of the receiver to baud. Returns the rate
+ * the link ends up at, 0 when the receiver can not be found. */
+uint32_t link_setup(int fd, uint8_t port, uint32_t baud)
+{
+    Link_Stats stats;
+    uint32_t current;
+    UBX_CFG_PRT prt;
+    uint8_t body[UBX_CFG_PRT_LENGTH];
+    uint8_t frame[8 + UBX_CFG_PRT_LENGTH];
+
+    if (!link_supported(baud)) {
+        /* The receiver would switch, but the port here could not follow */
+        printf("Link: unsupported rate %u\n", baud);
+        return 0;
+    }
+    current = link_probe(fd, port, &stats);
+    if (current == 0) {
+        printf("Link: no receiver found\n");
+        return 0;
+    }
+    if (current == baud) {
+        return current;
+    }
+    if (!stats.has_port_config) {
+        /* Ask again, for the settings of the port */
+        link_measure(fd, port, LINK_PROBE_MS, &stats);
+    }
+    if (!stats.has_port_config) {
+        printf("Link: no CFG-PRT for port %d, staying at %u baud\n", port, current);
+        return current;
+    }
+
+    /* Same port settings, other rate */
+    prt = stats.port_config;
+    prt.baudRate = baud;
+    if (write(fd, frame, config_frame(frame, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+                    ubx_encode_CFG_PRT(&prt, body))) < 0) {
+        perror("link write");
+    }
+    tcdrain(fd);
+    usleep(LINK_SWITCH_MS * 1000);
+
+    if (try_rate(fd, port, baud, LINK_VERIFY_MS, &stats)) {
+        return baud;
+    }
+    printf("Link: %u baud failed, back to %u baud\n", baud, current);
+    if (try_rate(fd, port, current, LINK_VERIFY_MS, &stats)) {
+        return current;
+    }
+    current = link_probe(fd, port, &stats);
+    if (current == 0) {
+        printf("Link: receiver lost\n");
+    }
+    return current;
+}
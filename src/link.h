@@ -0,0 +1,44 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stdint.h>
+
+#include "ubx.h"
+
+/* Setting up the serial link to the receiver.
+ *
+ * The rate the receiver sends at is found by trying the usual rates
+ * in turn and counting the good frames received. The receiver is then
+ * switched to the wanted rate with CFG-PRT, and the link is checked at
+ * the new rate. When that fails the old rate is tried again, and if
+ * the receiver is not found there either, all rates once more.
+ *
+ * For every rate tried the throughput, in bytes of good frames per
+ * second, and the share of the bytes that were not part of a good
+ * frame is reported.
+ */
+
+#define LINK_PROBE_MS   (1200)  /* Long enough to see an epoch at 1 Hz */
+#define LINK_VERIFY_MS  (2000)
+#define LINK_SWITCH_MS  (100)   /* For the receiver to change its rate */
+#define LINK_MIN_FRAMES (2)
+#define LINK_MAX_LOSS   (0.05)  /* At most this share of the bytes bad */
+
+typedef struct Link_Stats {
+    uint64_t bytes;
+    uint64_t good_bytes;    /* In frames with a good checksum */
+    uint32_t frames;
+    double seconds;
+    int has_port_config;
+    UBX_CFG_PRT port_config;    /* Of the port polled */
+} Link_Stats;
+
+/* Whether the link can run at baud: 9600, 38400, 115200, 230400,
+ * 460800 or 921600 */
+int link_supported(uint32_t baud);
+int link_set_speed(int fd, uint32_t baud);
+void link_measure(int fd, uint8_t port, int ms, Link_Stats* stats);
+uint32_t link_probe(int fd, uint8_t port, Link_Stats* stats);
+uint32_t link_setup(int fd, uint8_t port, uint32_t baud);
+
+#endif /* LINK_H */
@@ -0,0 +1,869 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "binlog.h"
+#include "fix.h"
+#include "logwriter.h"
+#include "crc32.h"
+#include "columns.h"
+#include "satellites.h"
+#include "util.h"
+
+/* Offline tools for the logs written by mon */
+
+typedef struct Mapped_File {
+    int fd;
+    const uint8_t* data;
+    size_t size;
+} Mapped_File;
+
+static int map_file(const char* name, Mapped_File* m)
+{
+    struct stat st;
+
+    m->data = NULL;
+    m->size = 0;
+    m->fd = open(name, O_RDONLY);
+    if (m->fd < 0) {
+        perror(name);
+        return 0;
+    }
+    if (fstat(m->fd, &st) != 0) {
+        perror(name);
+        close(m->fd);
+        return 0;
+    }
+    m->size = (size_t)st.st_size;
+    if (m->size > 0) {
+        void* p = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, m->fd, 0);
+        if (p == MAP_FAILED) {
+            perror("mmap");
+            close(m->fd);
+            return 0;
+        }
+        m->data = p;
+    }
+    return 1;
+}
+
+static void unmap_file(Mapped_File* m)
+{
+    if (m->data != NULL) {
+        munmap((void*)m->data, m->size);
+    }
+    close(m->fd);
+}
+
+/* Print a record the way mon writes it to the text log */
+static void print_record(FILE* out, const Log_Record* r)
+{
+    uint16_t i;
+
+    switch (r->type) {
+        case LOG_NMEA:
+            fwrite(r->payload, r->length, 1, out);
+            break;
+        case LOG_UBX:
+            if (r->length >= 4) {
+                fprintf(out, "%d %d ", r->payload[0], r->payload[1]);
+                fprintf(out, "%d: ", r->length - 4);
+                for (i = 4; i < r->length; ++i) {
+                    fprintf(out, "%02x ", r->payload[i]);
+                }
+                fprintf(out, "\n");
+            }
+            break;
+        case LOG_ERR1:
+            fprintf(out, "Err1:");
+            for (i = 0; i < r->length; ++i) {
+                fprintf(out, "%02x ", r->payload[i]);
+            }
+            fprintf(out, "\n");
+            break;
+        case LOG_ERR2:
+            fprintf(out, "Err2:");
+            break;
+        case LOG_ERR3:
+            fprintf(out, "Err3:");
+            break;
+        case LOG_ERR4:
+            fprintf(out, "Err4:");
+            break;
+        case LOG_ERR5:
+            fprintf(out, "Err5:");
+            break;
+        case LOG_FIX:
+            /* Not part of the text log */
+            break;
+        case LOG_STATS:
+        case LOG_PHASE:
+            fwrite(r->payload, r->length, 1, out);
+            break;
+        default:
+            /* Unknown record, written by a newer mon */
+            break;
+    }
+}
+
+static void print_fix_heading(FILE* out)
+{
+    fprintf(out, "receive_time,date,time,lat,lon,altitude,speed,course,"
+            "h_acc,v_acc,pdop,hdop,vdop,fix_type,num_sv,flags,source\n");
+}
+
+/* One CSV line, in units of degrees, meters, m/s */
+static void print_fix(FILE* out, const Log_Record* r)
+{
+    GNSS_Fix fix;
+    uint32_t t;
+
+    if (r->type != LOG_FIX || !binlog_decode_fix(r->payload, r->length, &fix)) {
+        return;
+    }
+    t = fix.time_of_day;
+    fprintf(out, "%.6f,%04d-%02d-%02d,%02u:%02u:%02u.%03u,%.7f,%.7f,%.3f,%.3f,%.5f,"
+            "%.3f,%.3f,%.2f,%.2f,%.2f,%d,%d,%d,%d\n",
+            (double)fix.receive_time / 1.0e9,
+            fix.year, fix.month, fix.day,
+            t / 3600000, (t / 60000) % 60, (t / 1000) % 60, t % 1000,
+            fix.lat / 1.0e7, fix.lon / 1.0e7, fix.altitude / 1.0e3,
+            fix.speed / 1.0e3, fix.course / 1.0e5,
+            fix.h_acc / 1.0e3, fix.v_acc / 1.0e3,
+            fix.pdop / 100.0, fix.hdop / 100.0, fix.vdop / 100.0,
+            fix.fix_type, fix.num_sv, fix.flags, fix.source);
+}
+
+/* Map a binary log and check its header. Returns the offset of the
+ * first record, 0 on failure. */
+static size_t open_log(const char* name, Mapped_File* m, Log_Header* header)
+{
+    if (!map_file(name, m)) {
+        return 0;
+    }
+    if (!binlog_read_header(m->data, m->size, header)) {
+        fprintf(stderr, "%s: not a binary log\n", name);
+        unmap_file(m);
+        return 0;
+    }
+    if (header->version != BINLOG_VERSION) {
+        fprintf(stderr, "%s: unsupported version %u\n", name, header->version);
+        unmap_file(m);
+        return 0;
+    }
+    return BINLOG_HEADER_SIZE;
+}
+
+static int decode(const char* name, int fixes_only)
+{
+    Mapped_File m;
+    Log_Header header;
+    Log_Record record;
+    size_t offset;
+    size_t n;
+
+    offset = open_log(name, &m, &header);
+    if (offset == 0) {
+        return EXIT_FAILURE;
+    }
+    if (fixes_only) {
+        print_fix_heading(stdout);
+    } else {
+        printf("mon: rate %s version: %s\n", header.rate, header.mon_version);
+    }
+
+    while ((n = binlog_next_record(&(m.data[offset]), m.size - offset, &record)) > 0) {
+        if (fixes_only) {
+            print_fix(stdout, &record);
+        } else {
+            print_record(stdout, &record);
+        }
+        offset += n;
+    }
+    if (offset != m.size) {
+        fprintf(stderr, "%s: truncated after %zu bytes\n", name, offset);
+    }
+
+    unmap_file(&m);
+    return EXIT_SUCCESS;
+}
+
+/* Copy the log to out, up to the end of the last block in its index
+ * whose CRC is still good. Works for text and binary logs. */
+static int recover(const char* name, const char* out_name)
+{
+    Mapped_File log;
+    Mapped_File index;
+    char index_name[256];
+    uint64_t good = 0;
+    size_t blocks = 0;
+    size_t offset;
+    int result = EXIT_FAILURE;
+    FILE* out;
+
+    snprintf(index_name, sizeof(index_name), "%s%s", name, LOG_INDEX_SUFFIX);
+    if (!map_file(name, &log)) {
+        return EXIT_FAILURE;
+    }
+    if (!map_file(index_name, &index)) {
+        unmap_file(&log);
+        return EXIT_FAILURE;
+    }
+    if (index.size < LOG_INDEX_HEADER_SIZE ||
+            memcmp(index.data, LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a log index\n", index_name);
+    } else if (get_u32(&(index.data[8])) != LOG_INDEX_VERSION) {
+        fprintf(stderr, "%s: unsupported version %u\n", index_name, get_u32(&(index.data[8])));
+    } else {
+        /* Records are in the order they were synced. A block committed
+         * before it was full comes again, longer, later on. */
+        for (offset = LOG_INDEX_HEADER_SIZE;
+                offset + LOG_INDEX_RECORD_SIZE <= index.size;
+                offset += LOG_INDEX_RECORD_SIZE) {
+            const uint8_t* r = &(index.data[offset]);
+            uint64_t start = (uint64_t)get_u32(&(r[0])) | ((uint64_t)get_u32(&(r[4])) << 32);
+            uint32_t length = get_u32(&(r[8]));
+            uint32_t crc = get_u32(&(r[12]));
+
+            if (start > good || start + length > log.size ||
+                    crc32_update(0, &(log.data[start]), length) != crc) {
+                fprintf(stderr, "%s: bad block at %llu\n", name, (unsigned long long)start);
+                break;
+            }
+            if (start + length > good) {
+                good = start + length;
+            }
+            blocks++;
+        }
+        out = fopen(out_name, "w");
+        if (out == NULL) {
+            perror(out_name);
+        } else {
+            if (good > 0 && fwrite(log.data, good, 1, out) != 1) {
+                perror(out_name);
+            } else {
+                result = EXIT_SUCCESS;
+            }
+            if (fclose(out) != 0) {
+                perror(out_name);
+                result = EXIT_FAILURE;
+            }
+            printf("Recovered %llu of %zu bytes from %zu index records\n",
+                    (unsigned long long)good, log.size, blocks);
+        }
+    }
+
+    unmap_file(&index);
+    unmap_file(&log);
+    return result;
+}
+
+/* What query prints */
+#define QUERY_ALL   (0)
+#define QUERY_NMEA  (1)     /* NMEA sentences, of type nmea_type if set */
+#define QUERY_UBX   (2)     /* UBX messages, of ubx_class/ubx_id if >= 0 */
+#define QUERY_ERR   (3)
+#define QUERY_FIX   (4)     /* Binary logs only, as CSV */
+
+typedef struct Query_Filter {
+    int kind;
+    char nmea_type[4];
+    int ubx_class;
+    int ubx_id;
+} Query_Filter;
+
+/* One mark of the time index, see logwriter.h */
+typedef struct Time_Mark {
+    uint64_t time;
+    uint64_t offset;
+    uint64_t gnss;          /* ms since 1970, 0 when not known */
+} Time_Mark;
+
+/* Parse all, nmea, ubx, err, fix, an NMEA sentence type (GGA) or a UBX
+ * class and id (1,7), or only a class (1) */
+static int parse_filter(const char* text, Query_Filter* f)
+{
+    char* end;
+
+    memset(f, 0, sizeof(Query_Filter));
+    f->ubx_class = -1;
+    f->ubx_id = -1;
+    if (strcmp(text, "all") == 0) {
+        f->kind = QUERY_ALL;
+    } else if (strcmp(text, "nmea") == 0) {
+        f->kind = QUERY_NMEA;
+    } else if (strcmp(text, "ubx") == 0) {
+        f->kind = QUERY_UBX;
+    } else if (strcmp(text, "err") == 0) {
+        f->kind = QUERY_ERR;
+    } else if (strcmp(text, "fix") == 0) {
+        f->kind = QUERY_FIX;
+    } else if (strlen(text) == 3 && text[0] >= 'A' && text[0] <= 'Z') {
+        f->kind = QUERY_NMEA;
+        memcpy(f->nmea_type, text, 4);
+    } else {
+        f->kind = QUERY_UBX;
+        f->ubx_class = (int)strtol(text, &end, 0);
+        if (*end == ',') {
+            f->ubx_id = (int)strtol(end + 1, &end, 0);
+        }
+        if (*end != 0 || end == text) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Does a line of a text log pass the filter */
+static int text_line_wanted(const Query_Filter* f, const uint8_t* line, size_t n)
+{
+    int class;
+    int id;
+
+    switch (f->kind) {
+        case QUERY_NMEA:
+            return n > 6 && line[0] == '$' &&
+                (f->nmea_type[0] == 0 || memcmp(&(line[3]), f->nmea_type, 3) == 0);
+        case QUERY_UBX:
+            if (n == 0 || line[0] < '0' || line[0] > '9' ||
+                    sscanf((const char*)line, "%d %d ", &class, &id) != 2) {
+                return 0;
+            }
+            return (f->ubx_class < 0 || class == f->ubx_class) &&
+                (f->ubx_id < 0 || id == f->ubx_id);
+        case QUERY_ERR:
+            return n > 3 && memcmp(line, "Err", 3) == 0;
+        default:
+            return 1;
+    }
+}
+
+/* Does a record of a binary log pass the filter */
+static int record_wanted(const Query_Filter* f, const Log_Record* r)
+{
+    switch (f->kind) {
+        case QUERY_NMEA:
+            return r->type == LOG_NMEA &&
+                (f->nmea_type[0] == 0 ||
+                 (r->length > 6 && memcmp(&(r->payload[3]), f->nmea_type, 3) == 0));
+        case QUERY_UBX:
+            return r->type == LOG_UBX && r->length >= 4 &&
+                (f->ubx_class < 0 || r->payload[0] == f->ubx_class) &&
+                (f->ubx_id < 0 || r->payload[1] == f->ubx_id);
+        case QUERY_ERR:
+            return r->type == LOG_ERR1 || r->type == LOG_ERR2 || r->type == LOG_ERR3 ||
+                r->type == LOG_ERR4 || r->type == LOG_ERR5;
+        case QUERY_FIX:
+            return r->type == LOG_FIX;
+        default:
+            return 1;
+    }
+}
+
+static void get_mark(const Mapped_File* index, size_t k, Time_Mark* mark)
+{
+    const uint8_t* p = &(index->data[LOG_TIME_INDEX_HEADER_SIZE + k * LOG_TIME_INDEX_MARK_SIZE]);
+    uint32_t date = get_u32(&(p[16]));
+    uint32_t time_of_day = get_u32(&(p[20]));
+
+    mark->time = (uint64_t)get_u32(&(p[0])) | ((uint64_t)get_u32(&(p[4])) << 32);
+    mark->offset = (uint64_t)get_u32(&(p[8])) | ((uint64_t)get_u32(&(p[12])) << 32);
+    mark->gnss = 0;
+    if (date != 0) {
+        mark->gnss = (uint64_t)utc_days(date / 10000, (date / 100) % 100, date % 100) *
+            86400000ULL + time_of_day;
+    }
+}
+
+/* The first mark with a time, or GNSS time, above t; n if none */
+static size_t find_mark(const Mapped_File* index, size_t n, uint64_t t, int gnss)
+{
+    size_t low = 0;
+    size_t high = n;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        Time_Mark mark;
+        get_mark(index, middle, &mark);
+        if ((gnss ? mark.gnss : mark.time) <= t) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/* "HH:MM:SS[.sss]" in ms since midnight, -1 if it is not */
+static int64_t parse_time_of_day(const char* text)
+{
+    unsigned hours;
+    unsigned minutes;
+    double seconds;
+
+    if (sscanf(text, "%u:%u:%lf", &hours, &minutes, &seconds) != 3 ||
+            hours > 23 || minutes > 59 || seconds < 0.0 || seconds >= 61.0) {
+        return -1;
+    }
+    return ((int64_t)hours * 60 + minutes) * 60000 + (int64_t)(seconds * 1000.0 + 0.5);
+}
+
+/* Print the part of a log between from and to, in seconds since the
+ * first mark, or with gnss UTC times of day. Binary search in the
+ * time index finds where to start, then only what is printed is read.
+ *
+ * Records of a binary log have their receive time, so the range is
+ * exact. A text log has no times, it is cut at the marks around the
+ * range; GNSS times are also looked up at the marks. Both are as
+ * precise as the interval of the index (mon -i). */
+static int query(const char* name, const char* from_text, const char* to_text,
+        int gnss, const Query_Filter* filter)
+{
+    Mapped_File log;
+    Mapped_File index;
+    Log_Header header;
+    Time_Mark first;
+    Time_Mark mark;
+    char index_name[256];
+    uint64_t from;
+    uint64_t to;
+    uint64_t start;
+    uint64_t end;
+    uint64_t interval;
+    size_t marks;
+    size_t k;
+    int binary;
+
+    snprintf(index_name, sizeof(index_name), "%s%s", name, LOG_TIME_INDEX_SUFFIX);
+    if (!map_file(name, &log)) {
+        return EXIT_FAILURE;
+    }
+    if (!map_file(index_name, &index)) {
+        unmap_file(&log);
+        return EXIT_FAILURE;
+    }
+    if (index.size < LOG_TIME_INDEX_HEADER_SIZE ||
+            memcmp(index.data, LOG_TIME_INDEX_MAGIC, sizeof(LOG_TIME_INDEX_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a time index\n", index_name);
+        goto fail;
+    }
+    if (get_u32(&(index.data[8])) != LOG_TIME_INDEX_VERSION) {
+        fprintf(stderr, "%s: unsupported version %u\n", index_name, get_u32(&(index.data[8])));
+        goto fail;
+    }
+    interval = (uint64_t)get_u32(&(index.data[12])) * 1000000ULL;
+    marks = (index.size - LOG_TIME_INDEX_HEADER_SIZE) / LOG_TIME_INDEX_MARK_SIZE;
+    /* After a crash the last marks can be past the end of the log */
+    while (marks > 0) {
+        get_mark(&index, marks - 1, &mark);
+        if (mark.offset < log.size) {
+            break;
+        }
+        marks--;
+    }
+    if (marks == 0) {
+        fprintf(stderr, "%s: no marks\n", index_name);
+        goto fail;
+    }
+    binary = binlog_read_header(log.data, log.size, &header);
+    if (!binary && filter->kind == QUERY_FIX) {
+        fprintf(stderr, "%s: fix records are only in binary logs\n", name);
+        goto fail;
+    }
+
+    get_mark(&index, 0, &first);
+    if (gnss) {
+        int64_t from_ms = parse_time_of_day(from_text);
+        int64_t to_ms = parse_time_of_day(to_text);
+        uint64_t day;
+
+        if (from_ms < 0 || to_ms < 0) {
+            fprintf(stderr, "Times are HH:MM:SS[.sss]\n");
+            goto fail;
+        }
+        /* On the day of the first GNSS time in the log */
+        k = find_mark(&index, marks, 0, 1);
+        if (k == marks) {
+            fprintf(stderr, "%s: no GNSS time in the index\n", index_name);
+            goto fail;
+        }
+        get_mark(&index, k, &mark);
+        day = mark.gnss - mark.gnss % 86400000ULL;
+        from = day + (uint64_t)from_ms;
+        to = day + (uint64_t)to_ms;
+        if (from + 43200000ULL < mark.gnss) {
+            /* Well before the log started, so after midnight */
+            from += 86400000ULL;
+            to += 86400000ULL;
+        }
+        if (to < from) {
+            to += 86400000ULL;
+        }
+        /* From the last mark before the range to the first after it */
+        k = find_mark(&index, marks, from - 1, 1);
+        get_mark(&index, (k > 0) ? k - 1 : 0, &mark);
+        from = (k < marks) ? mark.time : mark.time + interval;
+        k = find_mark(&index, marks, to, 1);
+        if (k < marks) {
+            get_mark(&index, k, &mark);
+            to = mark.time - 1;
+        } else {
+            to = UINT64_MAX;
+        }
+    } else {
+        double from_seconds = atof(from_text);
+        double to_seconds = atof(to_text);
+        if (from_seconds < 0.0 || to_seconds < from_seconds) {
+            fprintf(stderr, "Need 0 <= FROM <= TO\n");
+            goto fail;
+        }
+        from = first.time + (uint64_t)(from_seconds * 1.0e9);
+        to = first.time + (uint64_t)(to_seconds * 1.0e9);
+    }
+
+    /* The last mark at or before from, and the first after to. The
+     * last mark covers one interval. */
+    k = find_mark(&index, marks, from, 0);
+    get_mark(&index, (k > 0) ? k - 1 : 0, &mark);
+    start = mark.offset;
+    if (k == marks && from >= mark.time + interval) {
+        start = log.size;
+    }
+    k = find_mark(&index, marks, to, 0);
+    end = log.size;
+    if (k < marks) {
+        get_mark(&index, k, &mark);
+        end = mark.offset;
+    }
+
+    if (binary) {
+        Log_Record record;
+        size_t n;
+
+        if (filter->kind == QUERY_FIX) {
+            print_fix_heading(stdout);
+        }
+        while (start < log.size &&
+                (n = binlog_next_record(&(log.data[start]), log.size - start, &record)) > 0) {
+            if (record.time > to) {
+                break;
+            }
+            if (record.time >= from && record_wanted(filter, &record)) {
+                if (filter->kind == QUERY_FIX) {
+                    print_fix(stdout, &record);
+                } else {
+                    print_record(stdout, &record);
+                }
+            }
+            start += n;
+        }
+    } else if (filter->kind == QUERY_ALL) {
+        if (end > start) {
+            fwrite(&(log.data[start]), end - start, 1, stdout);
+        }
+    } else {
+        while (start < end) {
+            const uint8_t* line = &(log.data[start]);
+            const uint8_t* newline = memchr(line, '\n', end - start);
+            size_t n = (newline != NULL) ? (size_t)(newline - line) + 1 : end - start;
+            if (text_line_wanted(filter, line, n)) {
+                fwrite(line, n, 1, stdout);
+            }
+            start += n;
+        }
+    }
+
+    unmap_file(&index);
+    unmap_file(&log);
+    return EXIT_SUCCESS;
+
+fail:
+    unmap_file(&index);
+    unmap_file(&log);
+    return EXIT_FAILURE;
+}
+
+/* One value of a column, in degrees, meters and so on */
+static void print_column_value(FILE* out, int column, int64_t v)
+{
+    int64_t year;
+    unsigned month;
+    unsigned day;
+    int64_t t;
+
+    switch (column) {
+        case COLUMN_TIME:
+            t = v % 86400000;
+            if (v >= 86400000) {
+                utc_date(v / 86400000, &year, &month, &day);
+                fprintf(out, "%04lld-%02u-%02uT", (long long)year, month, day);
+            }
+            fprintf(out, "%02d:%02d:%02d.%03d", (int)(t / 3600000), (int)((t / 60000) % 60),
+                    (int)((t / 1000) % 60), (int)(t % 1000));
+            break;
+        case COLUMN_LAT:
+        case COLUMN_LON:
+            fprintf(out, "%.7f", v / 1.0e7);
+            break;
+        case COLUMN_ALT:
+            fprintf(out, "%.3f", v / 1.0e3);
+            break;
+        case COLUMN_HDOP:
+            fprintf(out, "%.2f", v / 100.0);
+            break;
+        default:
+            fprintf(out, "%lld", (long long)v);
+            break;
+    }
+}
+
+/* Print the named columns of a columns file as CSV, all if there are
+ * none. Only those columns are decoded. With summary only the rows,
+ * minimum and maximum of every chunk. */
+static int print_columns(const char* name, char** wanted_names, int n_wanted, int summary)
+{
+    Mapped_File m;
+    Column_Chunk chunk;
+    int wanted[NUMBER_OF_COLUMNS];
+    int64_t* values[NUMBER_OF_COLUMNS];
+    uint32_t capacity = 0;
+    size_t offset = COLUMNS_HEADER_SIZE;
+    size_t n;
+    int result = EXIT_SUCCESS;
+    int chunks = 0;
+    int i;
+    int c;
+
+    if (n_wanted == 0) {
+        for (i = 0; i < NUMBER_OF_COLUMNS; i++) {
+            wanted[i] = i;
+        }
+        n_wanted = NUMBER_OF_COLUMNS;
+    } else {
+        for (i = 0; i < n_wanted; i++) {
+            for (c = 0; c < NUMBER_OF_COLUMNS && strcmp(wanted_names[i], column_names[c]) != 0; c++) {
+            }
+            if (c == NUMBER_OF_COLUMNS) {
+                fprintf(stderr, "No column %s\n", wanted_names[i]);
+                return EXIT_FAILURE;
+            }
+            wanted[i] = c;
+        }
+    }
+    if (!map_file(name, &m)) {
+        return EXIT_FAILURE;
+    }
+    if (!columns_read_header(m.data, m.size)) {
+        fprintf(stderr, "%s: not a columns file\n", name);
+        unmap_file(&m);
+        return EXIT_FAILURE;
+    }
+    memset(values, 0, sizeof(values));
+
+    if (summary) {
+        printf("chunk,rows");
+        for (i = 0; i < n_wanted; i++) {
+            printf(",%s_min,%s_max", column_names[wanted[i]], column_names[wanted[i]]);
+        }
+    } else {
+        for (i = 0; i < n_wanted; i++) {
+            printf("%s%s", (i > 0) ? "," : "", column_names[wanted[i]]);
+        }
+    }
+    printf("\n");
+
+    while ((n = columns_next_chunk(&(m.data[offset]), m.size - offset, &chunk)) > 0) {
+        uint32_t row;
+
+        if (summary) {
+            printf("%d,%u", chunks, chunk.rows);
+            for (i = 0; i < n_wanted; i++) {
+                printf(",");
+                print_column_value(stdout, wanted[i], chunk.min[wanted[i]]);
+                printf(",");
+                print_column_value(stdout, wanted[i], chunk.max[wanted[i]]);
+            }
+            printf("\n");
+        } else {
+            if (chunk.rows > capacity) {
+                for (i = 0; i < n_wanted; i++) {
+                    free(values[i]);
+                    values[i] = malloc(chunk.rows * sizeof(int64_t));
+                    if (values[i] == NULL) {
+                        perror("malloc");
+                        result = EXIT_FAILURE;
+                        goto done;
+                    }
+                }
+                capacity = chunk.rows;
+            }
+            for (i = 0; i < n_wanted; i++) {
+                c = wanted[i];
+                if (!columns_decode(chunk.data[c], chunk.bytes[c], values[i], chunk.rows)) {
+                    fprintf(stderr, "%s: bad column %s in chunk %d\n", name, column_names[c], chunks);
+                    result = EXIT_FAILURE;
+                    goto done;
+                }
+            }
+            for (row = 0; row < chunk.rows; row++) {
+                for (i = 0; i < n_wanted; i++) {
+                    if (i > 0) {
+                        putchar(',');
+                    }
+                    print_column_value(stdout, wanted[i], values[i][row]);
+                }
+                putchar('\n');
+            }
+        }
+        offset += n;
+        chunks++;
+    }
+    if (offset != m.size) {
+        fprintf(stderr, "%s: truncated after %zu bytes\n", name, offset);
+    }
+
+done:
+    for (i = 0; i < NUMBER_OF_COLUMNS; i++) {
+        free(values[i]);
+    }
+    unmap_file(&m);
+    return result;
+}
+
+/* Print the satellites mon -V wrote as CSV, every satellite of every
+ * epoch, or with changes_only only the ones that were written */
+static int print_satellites(const char* name, int changes_only)
+{
+    Mapped_File m;
+    Sat_Epoch satellites;
+    Sat_Epoch previous;
+    size_t offset = SATELLITES_HEADER_SIZE;
+    size_t n;
+    uint32_t t;
+    int i;
+
+    if (!map_file(name, &m)) {
+        return EXIT_FAILURE;
+    }
+    if (!satellites_read_header(m.data, m.size)) {
+        fprintf(stderr, "%s: not a satellites file\n", name);
+        unmap_file(&m);
+        return EXIT_FAILURE;
+    }
+    satellites.n = 0;
+    previous.n = 0;
+    printf("time,gnss,svid,elevation,azimuth,cno\n");
+    while ((n = satellites_next_epoch(&(m.data[offset]), m.size - offset, &satellites, &t)) > 0) {
+        for (i = 0; i < satellites.n; i++) {
+            int k;
+            if (changes_only) {
+                for (k = 0; k < previous.n; k++) {
+                    if (previous.gnss[k] == satellites.gnss[i] &&
+                            previous.svid[k] == satellites.svid[i]) {
+                        break;
+                    }
+                }
+                if (k < previous.n && previous.elevation[k] == satellites.elevation[i] &&
+                        previous.azimuth[k] == satellites.azimuth[i] &&
+                        previous.cno[k] == satellites.cno[i]) {
+                    continue;
+                }
+            }
+            printf("%02u:%02u:%02u.%03u,%u,%u,", t / 3600000, (t / 60000) % 60, (t / 1000) % 60,
+                    t % 1000, satellites.gnss[i], satellites.svid[i]);
+            if (satellites.elevation[i] != ELEVATION_UNKNOWN) {
+                printf("%d", satellites.elevation[i]);
+            }
+            printf(",");
+            if (satellites.azimuth[i] != AZIMUTH_UNKNOWN) {
+                printf("%u", satellites.azimuth[i]);
+            }
+            printf(",%u\n", satellites.cno[i]);
+        }
+        previous = satellites;
+        offset += n;
+    }
+    if (offset != m.size) {
+        fprintf(stderr, "%s: truncated after %zu bytes\n", name, offset);
+    }
+    unmap_file(&m);
+    return EXIT_SUCCESS;
+}
+
+static void usage(void)
+{
+    printf( "logtool:  tools for the logs written by mon\n" );
+    printf( "Usage:\n");
+    printf( "./logtool decode FILE  -- print a binary log in the text log format.\n" );
+    printf( "./logtool fixes FILE   -- print the decoded fixes of a binary log as CSV.\n" );
+    printf( "./logtool recover FILE OUT -- copy the part of a log that was safely\n" );
+    printf( "                          on disk, according to FILE.blk, to OUT.\n" );
+    printf( "./logtool query [-g] [-m TYPE] FILE FROM TO -- print the part of a log\n" );
+    printf( "                          from FROM to TO seconds after its start, found\n" );
+    printf( "                          with FILE.tix. -g: FROM and TO are UTC times,\n" );
+    printf( "                          HH:MM:SS. -m: only TYPE, one of nmea, ubx, err,\n" );
+    printf( "                          fix (CSV, binary logs), an NMEA sentence like\n" );
+    printf( "                          GGA, or a UBX CLASS[,ID].\n" );
+    printf( "./logtool columns [-s] FILE [COLUMN...] -- print the fixes mon -C wrote\n" );
+    printf( "                          as CSV, only the columns given. -s: the rows,\n" );
+    printf( "                          minimum and maximum of each chunk instead.\n" );
+    printf( "                          Columns: time lat lon alt num_sv hdop fix_type.\n" );
+    printf( "./logtool satellites [-c] FILE -- print the satellites in view mon -V\n" );
+    printf( "                          wrote as CSV. -c: only the ones that changed.\n" );
+}
+
+int main(int argc, char** argv)
+{
+    int result = EXIT_FAILURE;
+
+    if (argc == 3 && strcmp(argv[1], "decode") == 0) {
+        result = decode(argv[2], 0);
+    } else if (argc == 3 && strcmp(argv[1], "fixes") == 0) {
+        result = decode(argv[2], 1);
+    } else if (argc == 4 && strcmp(argv[1], "recover") == 0) {
+        result = recover(argv[2], argv[3]);
+    } else if (argc >= 3 && strcmp(argv[1], "columns") == 0) {
+        int summary = (strcmp(argv[2], "-s") == 0);
+        if (argc >= 3 + summary) {
+            result = print_columns(argv[2 + summary], &(argv[3 + summary]), argc - 3 - summary,
+                    summary);
+        } else {
+            usage();
+        }
+    } else if (argc == 3 && strcmp(argv[1], "satellites") == 0) {
+        result = print_satellites(argv[2], 0);
+    } else if (argc == 4 && strcmp(argv[1], "satellites") == 0 && strcmp(argv[2], "-c") == 0) {
+        result = print_satellites(argv[3], 1);
+    } else if (argc >= 5 && strcmp(argv[1], "query") == 0) {
+        Query_Filter filter;
+        int gnss = 0;
+        int i = 2;
+
+        parse_filter("all", &filter);
+        while (i < argc - 3) {
+            if (strcmp(argv[i], "-g") == 0) {
+                gnss = 1;
+                i++;
+            } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc - 3 &&
+                    parse_filter(argv[i + 1], &filter)) {
+                i += 2;
+            } else {
+                break;
+            }
+        }
+        if (i == argc - 3) {
+            result = query(argv[i], argv[i + 1], argv[i + 2], gnss, &filter);
+        } else {
+            usage();
+        }
+    } else {
+        usage();
+    }
+
+    return result;
+}
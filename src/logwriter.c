@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "logwriter.h"
+#include "crc32.h"
+#include "util.h"
+
+/* stdio only buffers a little, the blocks do the real buffering */
+#define LOG_STDIO_BUFFER_SIZE (4096)
+
+static int pwrite_all(int fd, const uint8_t* data, size_t n, uint64_t offset)
+{
+    while (n > 0) {
+        ssize_t k = pwrite(fd, data, n, (off_t)offset);
+        if (k < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += k;
+        n -= (size_t)k;
+        offset += (uint64_t)k;
+    }
+    return 0;
+}
+
+/* Write out one job: the data, then its index record, each synced */
+static int sync_job(Log_Writer* w, const uint8_t* data, size_t n, uint64_t offset)
+{
+    uint8_t record[LOG_INDEX_RECORD_SIZE];
+
+    if (pwrite_all(w->fd, data, n, offset) != 0 || fdatasync(w->fd) != 0) {
+        perror("log write");
+        return 0;
+    }
+    put_u32(&(record[0]), (uint32_t)offset);
+    put_u32(&(record[4]), (uint32_t)(offset >> 32));
+    put_u32(&(record[8]), (uint32_t)n);
+    put_u32(&(record[12]), crc32_update(0, data, n));
+    if (write_all(w->index_fd, record, sizeof(record)) != 0 || fdatasync(w->index_fd) != 0) {
+        perror("log index write");
+        return 0;
+    }
+    return 1;
+}
+
+static void* sync_thread(void* arg)
+{
+    Log_Writer* w = arg;
+
+    pthread_mutex_lock(&(w->lock));
+    for (;;) {
+        const uint8_t* data;
+        size_t n;
+        uint64_t offset;
+        int ok;
+
+        while (!w->busy && !w->stop) {
+            pthread_cond_wait(&(w->changed), &(w->lock));
+        }
+        if (!w->busy) {
+            break;
+        }
+        data = w->job_data;
+        n = w->job_length;
+        offset = w->job_offset;
+        pthread_mutex_unlock(&(w->lock));
+
+        ok = sync_job(w, data, n, offset);
+
+        pthread_mutex_lock(&(w->lock));
+        if (!ok) {
+            w->failed = 1;
+        }
+        w->syncs++;
+        w->busy = 0;
+        pthread_cond_broadcast(&(w->changed));
+    }
+    pthread_mutex_unlock(&(w->lock));
+    return NULL;
+}
+
+/* Wait until the sync thread is done with its job, if it has one */
+static void wait_idle(Log_Writer* w)
+{
+    pthread_mutex_lock(&(w->lock));
+    if (w->busy) {
+        w->waits++;
+    }
+    while (w->busy) {
+        pthread_cond_wait(&(w->changed), &(w->lock));
+    }
+    pthread_mutex_unlock(&(w->lock));
+}
+
+/* The sync thread must be idle */
+static void start_job(Log_Writer* w, const uint8_t* data, size_t n, uint64_t offset)
+{
+    pthread_mutex_lock(&(w->lock));
+    w->job_data = data;
+    w->job_length = n;
+    w->job_offset = offset;
+    w->busy = 1;
+    pthread_cond_broadcast(&(w->changed));
+    pthread_mutex_unlock(&(w->lock));
+    w->last_commit = monotonic_ns();
+}
+
+/* Commit the block that is being filled. It is copied to the other
+ * block, so filling can go on while it is written. */
+static void commit_partial(Log_Writer* w)
+{
+    uint8_t* spare = w->blocks[1 - w->active];
+
+    if (w->fill == w->committed) {
+        return;
+    }
+    wait_idle(w);
+    memcpy(spare, w->blocks[w->active], w->fill);
+    start_job(w, spare, w->fill, w->offset);
+    w->committed = w->fill;
+}
+
+/* Hand the full block over and continue in the other one */
+static void commit_full(Log_Writer* w)
+{
+    wait_idle(w);
+    start_job(w, w->blocks[w->active], LOG_BLOCK_SIZE, w->offset);
+    w->active = 1 - w->active;
+    w->offset += LOG_BLOCK_SIZE;
+    w->fill = 0;
+    w->committed = 0;
+}
+
+static ssize_t cookie_write(void* cookie, const char* data, size_t n)
+{
+    Log_Writer* w = cookie;
+    size_t done = 0;
+
+    while (done < n) {
+        size_t room = LOG_BLOCK_SIZE - w->fill;
+        size_t k = (n - done < room) ? (n - done) : room;
+        memcpy(&(w->blocks[w->active][w->fill]), &(data[done]), k);
+        w->fill += k;
+        done += k;
+        if (w->fill == LOG_BLOCK_SIZE) {
+            commit_full(w);
+        }
+    }
+    return (ssize_t)n;
+}
+
+/* Where the next byte written to w->file ends up in the log */
+static uint64_t log_position(Log_Writer* w)
+{
+    return w->offset + w->fill + __fpending(w->file);
+}
+
+void log_writer_add_mark(Log_Writer* w, uint64_t time, const GNSS_Fix* fix)
+{
+    uint8_t mark[LOG_TIME_INDEX_MARK_SIZE];
+    uint64_t offset = log_position(w);
+    uint32_t date = 0;
+    uint32_t time_of_day = 0;
+
+    if (fix->flags & FIX_VALID_DATE) {
+        date = (uint32_t)fix->year * 10000 + fix->month * 100 + fix->day;
+    }
+    if (fix->flags & FIX_VALID_TIME) {
+        time_of_day = fix->time_of_day;
+    }
+    put_u32(&(mark[0]), (uint32_t)time);
+    put_u32(&(mark[4]), (uint32_t)(time >> 32));
+    put_u32(&(mark[8]), (uint32_t)offset);
+    put_u32(&(mark[12]), (uint32_t)(offset >> 32));
+    put_u32(&(mark[16]), date);
+    put_u32(&(mark[20]), time_of_day);
+    if (write_all(w->time_index_fd, mark, sizeof(mark)) != 0) {
+        perror("time index write");
+        w->next_mark = UINT64_MAX;
+        return;
+    }
+    w->marks++;
+    /* Keep to the grid, but start a new one after a gap */
+    if (time - w->next_mark >= w->mark_interval_ns) {
+        w->next_mark = time + w->mark_interval_ns;
+    } else {
+        w->next_mark += w->mark_interval_ns;
+    }
+}
+
+static int cookie_close(void* cookie)
+{
+    Log_Writer* w = cookie;
+    int failed;
+
+    commit_partial(w);
+    pthread_mutex_lock(&(w->lock));
+    w->stop = 1;
+    pthread_cond_broadcast(&(w->changed));
+    pthread_mutex_unlock(&(w->lock));
+    pthread_join(w->thread, NULL);
+
+    printf("Log: %llu synced writes, waited for the disk %llu times\n",
+            (unsigned long long)w->syncs, (unsigned long long)w->waits);
+    failed = w->failed;
+    close(w->fd);
+    close(w->index_fd);
+    if (w->time_index_fd >= 0) {
+        close(w->time_index_fd);
+    }
+    pthread_mutex_destroy(&(w->lock));
+    pthread_cond_destroy(&(w->changed));
+    free(w->blocks[0]);
+    free(w->blocks[1]);
+    free(w);
+    return failed ? -1 : 0;
+}
+
+/* The time index of the log name, with a mark every interval_ns.
+ * Returns the file descriptor, -1 on failure. */
+static int open_time_index(const char* name, uint64_t interval_ns)
+{
+    char index_name[256];
+    uint8_t header[LOG_TIME_INDEX_HEADER_SIZE];
+    int fd;
+
+    snprintf(index_name, sizeof(index_name), "%s%s", name, LOG_TIME_INDEX_SUFFIX);
+    fd = open(index_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(index_name);
+        return -1;
+    }
+    memset(header, 0, sizeof(header));
+    memcpy(header, LOG_TIME_INDEX_MAGIC, sizeof(LOG_TIME_INDEX_MAGIC));
+    put_u32(&(header[8]), LOG_TIME_INDEX_VERSION);
+    put_u32(&(header[12]), (uint32_t)(interval_ns / 1000000ULL));
+    if (write_all(fd, header, sizeof(header)) != 0) {
+        perror(index_name);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Create the log name and its index. At most window_ns of time or
+ * window_bytes of log are lost in a crash, 0 for either means no limit
+ * other than the two blocks. With a mark_interval_ns other than 0 the
+ * time index is written too. Returns NULL on failure. */
+Log_Writer* log_writer_open(const char* name, uint64_t window_ns, size_t window_bytes,
+        uint64_t mark_interval_ns)
+{
+    cookie_io_functions_t io = { NULL, cookie_write, NULL, cookie_close };
+    Log_Writer* w;
+    char index_name[256];
+    uint8_t header[LOG_INDEX_HEADER_SIZE];
+    void* block;
+
+    w = calloc(1, sizeof(Log_Writer));
+    if (w == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    w->fd = -1;
+    w->index_fd = -1;
+    w->time_index_fd = -1;
+    w->next_mark = UINT64_MAX;
+    /* Aligned, so they can be written straight to the card */
+    if (posix_memalign(&block, 4096, LOG_BLOCK_SIZE) == 0) {
+        w->blocks[0] = block;
+    }
+    if (posix_memalign(&block, 4096, LOG_BLOCK_SIZE) == 0) {
+        w->blocks[1] = block;
+    }
+    snprintf(index_name, sizeof(index_name), "%s%s", name, LOG_INDEX_SUFFIX);
+    if (w->blocks[0] == NULL || w->blocks[1] == NULL) {
+        perror("posix_memalign");
+    } else if ((w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(name);
+    } else if ((w->index_fd = open(index_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(index_name);
+    } else if (mark_interval_ns > 0 &&
+            (w->time_index_fd = open_time_index(name, mark_interval_ns)) < 0) {
+        /* Already reported */
+    } else {
+        memset(header, 0, sizeof(header));
+        memcpy(header, LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC));
+        put_u32(&(header[8]), LOG_INDEX_VERSION);
+        put_u32(&(header[12]), LOG_BLOCK_SIZE);
+        if (write_all(w->index_fd, header, sizeof(header)) != 0) {
+            perror(index_name);
+        } else {
+            w->window_ns = window_ns;
+            w->window_bytes = window_bytes;
+            if (mark_interval_ns > 0) {
+                w->mark_interval_ns = mark_interval_ns;
+                w->next_mark = 0;
+            }
+            w->last_commit = monotonic_ns();
+            pthread_mutex_init(&(w->lock), NULL);
+            pthread_cond_init(&(w->changed), NULL);
+            if (pthread_create(&(w->thread), NULL, sync_thread, w) != 0) {
+                perror("pthread_create");
+            } else {
+                w->file = fopencookie(w, "w", io);
+                if (w->file != NULL) {
+                    setvbuf(w->file, NULL, _IOFBF, LOG_STDIO_BUFFER_SIZE);
+                    return w;
+                }
+                perror("fopencookie");
+                pthread_mutex_lock(&(w->lock));
+                w->stop = 1;
+                pthread_cond_broadcast(&(w->changed));
+                pthread_mutex_unlock(&(w->lock));
+                pthread_join(w->thread, NULL);
+            }
+        }
+    }
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+    if (w->index_fd >= 0) {
+        close(w->index_fd);
+    }
+    if (w->time_index_fd >= 0) {
+        close(w->time_index_fd);
+    }
+    free(w->blocks[0]);
+    free(w->blocks[1]);
+    free(w);
+    return NULL;
+}
+
+/* Call regularly from the thread that writes the log. Commits the
+ * block being filled once the loss window has passed. */
+void log_writer_tick(Log_Writer* w)
+{
+    size_t pending;
+
+    if (w == NULL || (w->window_ns == 0 && w->window_bytes == 0)) {
+        return;
+    }
+    /* Cheap, it only moves the stdio buffer into the block */
+    fflush(w->file);
+    pending = w->fill - w->committed;
+    if (pending == 0) {
+        return;
+    }
+    if ((w->window_bytes > 0 && pending >= w->window_bytes) ||
+            (w->window_ns > 0 && monotonic_ns() - w->last_commit >= w->window_ns)) {
+        commit_partial(w);
+    }
+}
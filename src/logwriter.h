@@ -0,0 +1,110 @@
+#ifndef LOGWRITER_H
+#define LOGWRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "fix.h"
+
+/* Log writer with a bounded loss window.
+ *
+ * The log is written in LOG_BLOCK_SIZE blocks at aligned offsets. Two
+ * block buffers are used: while one is filled, a background thread
+ * writes out and fdatasync()s the other. A block that is not full yet
+ * is committed as well once the loss window, in time or in bytes, has
+ * passed; it is then written again from its start when it grows.
+ *
+ * After each synced write a record is appended to the index file,
+ * NAME.blk, so that after a crash the log can be recovered up to the
+ * last good block (logtool recover).
+ *
+ * Index layout (all numbers little endian):
+ *
+ *   header  "GNSSBLK" 0x00, uint32 version, uint32 block size
+ *   record  uint64 offset, uint32 length, uint32 CRC-32 of the
+ *           length bytes of the log at offset
+ *
+ * A record is only written once the bytes it covers are on disk.
+ *
+ * A second index, the time index NAME.tix, maps time to offsets in the
+ * log so a stretch of it can be found without reading all that comes
+ * before (logtool query). The writer of the log calls log_writer_mark()
+ * before every record; once every interval this appends a mark:
+ *
+ *   header  "GNSSTIX" 0x00, uint32 version, uint32 interval in ms
+ *   mark    uint64 receive time of the record (CLOCK_MONOTONIC, ns),
+ *           uint64 offset of the record in the log,
+ *           uint32 date (yyyymmdd) and uint32 UTC time of day (ms) of
+ *           the last fix before it, 0 when not known yet
+ *
+ * Both times only go up, so the marks can be searched either way. The
+ * time index is not synced, after a crash it may point past the end of
+ * the recovered log.
+ *
+ * Closing file with fclose() commits what is left and frees the
+ * writer.
+ */
+
+#define LOG_BLOCK_SIZE (256*1024)
+#define LOG_INDEX_MAGIC "GNSSBLK"
+#define LOG_INDEX_VERSION (1U)
+#define LOG_INDEX_HEADER_SIZE (16U)
+#define LOG_INDEX_RECORD_SIZE (16U)
+#define LOG_INDEX_SUFFIX ".blk"
+#define LOG_TIME_INDEX_MAGIC "GNSSTIX"
+#define LOG_TIME_INDEX_VERSION (1U)
+#define LOG_TIME_INDEX_HEADER_SIZE (16U)
+#define LOG_TIME_INDEX_MARK_SIZE (24U)
+#define LOG_TIME_INDEX_SUFFIX ".tix"
+
+typedef struct Log_Writer {
+    FILE* file;             /* Write the log through this */
+    int fd;
+    int index_fd;
+    uint8_t* blocks[2];
+    int active;             /* Block being filled */
+    size_t fill;            /* Bytes in the active block */
+    size_t committed;       /* Of those, bytes handed to the sync thread */
+    uint64_t offset;        /* File offset of the active block */
+    uint64_t window_ns;     /* Loss window, 0 is no limit */
+    size_t window_bytes;
+    uint64_t last_commit;   /* Time of the last commit */
+
+    /* Time index, -1 when not wanted */
+    int time_index_fd;
+    uint64_t mark_interval_ns;
+    uint64_t next_mark;     /* Receive time of the next mark */
+
+    /* Hand over to the sync thread, one job at a time */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int busy;               /* A job is waiting or being written */
+    int stop;
+    const uint8_t* job_data;
+    size_t job_length;
+    uint64_t job_offset;
+    int failed;
+
+    /* Statistics */
+    uint64_t syncs;
+    uint64_t waits;         /* Times the writer waited for a sync */
+    uint64_t marks;
+} Log_Writer;
+
+Log_Writer* log_writer_open(const char* name, uint64_t window_ns, size_t window_bytes,
+        uint64_t mark_interval_ns);
+void log_writer_tick(Log_Writer* w);
+void log_writer_add_mark(Log_Writer* w, uint64_t time, const GNSS_Fix* fix);
+
+/* Call before writing a record received at time; fix is the last one
+ * decoded. Cheap when no mark is due. */
+static inline void log_writer_mark(Log_Writer* w, uint64_t time, const GNSS_Fix* fix)
+{
+    if (w != NULL && time >= w->next_mark) {
+        log_writer_add_mark(w, time, fix);
+    }
+}
+
+#endif /* LOGWRITER_H */
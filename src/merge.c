@@ -0,0 +1,148 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "merge.h"
+
+/* Days since 2000-01-01, good enough to order dates */
+static uint64_t day_number(const GNSS_Fix* fix)
+{
+    return ((uint64_t)(fix->year - 2000) * 12 + (fix->month - 1)) * 31 + (fix->day - 1);
+}
+
+static uint64_t epoch_key(const GNSS_Fix* fix)
+{
+    return day_number(fix) * 86400000ULL + fix->time_of_day;
+}
+
+static void write_epoch(Merge* m, const Merge_Epoch* e)
+{
+    uint64_t first = 0;
+    int i;
+
+    /* Receive times relative to the first receiver to have it */
+    for (i = 0; i < m->receivers; i++) {
+        if ((e->present & (1U << i)) &&
+                (first == 0 || e->fixes[i].receive_time < first)) {
+            first = e->fixes[i].receive_time;
+        }
+    }
+    for (i = 0; i < m->receivers; i++) {
+        const GNSS_Fix* fix = &(e->fixes[i]);
+        uint32_t t = fix->time_of_day;
+        if (!(e->present & (1U << i))) {
+            continue;
+        }
+        fprintf(m->file, "%04d-%02d-%02d,%02u:%02u:%02u.%03u,%d,%.3f,%.7f,%.7f,%.3f,"
+                "%.3f,%.3f,%.2f,%d,%d\n",
+                fix->year, fix->month, fix->day,
+                t / 3600000, (t / 60000) % 60, (t / 1000) % 60, t % 1000,
+                i, (double)(fix->receive_time - first) / 1.0e6,
+                fix->lat / 1.0e7, fix->lon / 1.0e7, fix->altitude / 1.0e3,
+                fix->h_acc / 1.0e3, fix->v_acc / 1.0e3, fix->pdop / 100.0,
+                fix->fix_type, fix->num_sv);
+    }
+    if (e->present == (1U << m->receivers) - 1) {
+        m->complete++;
+    } else {
+        m->partial++;
+    }
+    m->written = e->key;
+}
+
+/* Write the oldest epochs while they are complete or waited long
+ * enough for, or all of them */
+static void flush(Merge* m, int all)
+{
+    int k = 0;
+
+    while (k < m->n) {
+        const Merge_Epoch* e = &(m->epochs[k]);
+        if (!all && e->present != (1U << m->receivers) - 1 &&
+                e->key + MERGE_WAIT_MS > m->newest && m->n - k < MERGE_EPOCHS) {
+            break;
+        }
+        write_epoch(m, e);
+        k++;
+    }
+    memmove(&(m->epochs[0]), &(m->epochs[k]), (m->n - k) * sizeof(Merge_Epoch));
+    m->n -= k;
+}
+
+Merge* merge_open(const char* name, int receivers)
+{
+    Merge* m;
+
+    if (receivers > MERGE_MAX_RECEIVERS) {
+        printf("Merge: at most %d receivers\n", MERGE_MAX_RECEIVERS);
+        return NULL;
+    }
+    m = calloc(1, sizeof(Merge));
+    if (m == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    m->file = fopen(name, "w");
+    if (m->file == NULL) {
+        perror(name);
+        free(m);
+        return NULL;
+    }
+    m->receivers = receivers;
+    pthread_mutex_init(&(m->lock), NULL);
+    fprintf(m->file, "date,time,receiver,delay_ms,lat,lon,altitude,"
+            "h_acc,v_acc,pdop,fix_type,num_sv\n");
+    return m;
+}
+
+void merge_fix(Merge* m, int receiver, const GNSS_Fix* fix)
+{
+    uint64_t key;
+    int i;
+
+    if ((fix->flags & (FIX_VALID_DATE | FIX_VALID_TIME)) != (FIX_VALID_DATE | FIX_VALID_TIME) ||
+            fix->year < 2000 || fix->month < 1 || fix->day < 1) {
+        return;
+    }
+    key = epoch_key(fix);
+
+    pthread_mutex_lock(&(m->lock));
+    if (m->written != 0 && key <= m->written) {
+        m->late++;
+    } else {
+        /* Find the epoch, or insert it in order */
+        for (i = 0; i < m->n && m->epochs[i].key < key; i++) {
+        }
+        if (i == m->n || m->epochs[i].key != key) {
+            /* flush() keeps a free one */
+            assert(m->n < MERGE_EPOCHS);
+            memmove(&(m->epochs[i + 1]), &(m->epochs[i]), (m->n - i) * sizeof(Merge_Epoch));
+            memset(&(m->epochs[i]), 0, sizeof(Merge_Epoch));
+            m->epochs[i].key = key;
+            m->n++;
+        }
+        m->epochs[i].fixes[receiver] = *fix;
+        m->epochs[i].present |= 1U << receiver;
+        if (key > m->newest) {
+            m->newest = key;
+        }
+        flush(m, 0);
+    }
+    pthread_mutex_unlock(&(m->lock));
+}
+
+/* Write what is left and close. Returns 0 on a write error. */
+int merge_close(Merge* m)
+{
+    int ok;
+
+    flush(m, 1);
+    printf("Merge: %llu complete epochs, %llu partial, %llu late fixes\n",
+            (unsigned long long)m->complete, (unsigned long long)m->partial,
+            (unsigned long long)m->late);
+    ok = (fclose(m->file) == 0);
+    pthread_mutex_destroy(&(m->lock));
+    free(m);
+    return ok;
+}
@@ -0,0 +1,50 @@
+#ifndef MERGE_H
+#define MERGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "fix.h"
+
+/* Fixes of several receivers merged into one CSV stream, aligned on
+ * the GNSS time of their epoch.
+ *
+ * The fixes of an epoch are written together, one line per receiver,
+ * once every receiver has one, or once a fix MERGE_WAIT_MS later than
+ * the epoch has come in from any receiver. Epochs are written in time
+ * order. Fixes without a valid date and time are left out.
+ *
+ * merge_fix() can be called from any thread.
+ */
+
+#define MERGE_MAX_RECEIVERS (8)
+#define MERGE_EPOCHS (32)       /* Epochs waiting at most */
+#define MERGE_WAIT_MS (2000)
+
+typedef struct Merge_Epoch {
+    uint64_t key;           /* Date and time, ms */
+    uint32_t present;       /* Receivers with a fix, bit per receiver */
+    GNSS_Fix fixes[MERGE_MAX_RECEIVERS];
+} Merge_Epoch;
+
+typedef struct Merge {
+    FILE* file;
+    int receivers;
+    pthread_mutex_t lock;
+    Merge_Epoch epochs[MERGE_EPOCHS];   /* Oldest first */
+    int n;
+    uint64_t newest;        /* Latest key seen */
+    uint64_t written;       /* Last key written */
+
+    /* Statistics */
+    uint64_t complete;
+    uint64_t partial;
+    uint64_t late;          /* Fixes for an epoch already written */
+} Merge;
+
+Merge* merge_open(const char* name, int receivers);
+void merge_fix(Merge* m, int receiver, const GNSS_Fix* fix);
+int merge_close(Merge* m);
+
+#endif /* MERGE_H */
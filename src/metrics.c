@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+void metrics_init(Metrics* m, uint64_t now)
+{
+    memset(m, 0, sizeof(Metrics));
+    m->started = now;
+}
+
+/* Non-empty buckets, as "lo-hi: count" */
+static void write_histogram(FILE* out, const char* name, const char* unit,
+        const Metrics_Histogram* h)
+{
+    int k;
+
+    fprintf(out, "%s (%s):", name, unit);
+    for (k = 0; k < METRICS_BUCKETS; k++) {
+        if (h->count[k] == 0) {
+            continue;
+        }
+        if (k == 0) {
+            fprintf(out, " 0: %llu", (unsigned long long)h->count[k]);
+        } else if (k == METRICS_BUCKETS - 1) {
+            fprintf(out, " %llu-: %llu", 1ULL << (k - 1), (unsigned long long)h->count[k]);
+        } else {
+            fprintf(out, " %llu-%llu: %llu", 1ULL << (k - 1), (1ULL << k) - 1,
+                    (unsigned long long)h->count[k]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+static int compare_ubx(const void* a, const void* b)
+{
+    const Metrics_UBX_Count* x = a;
+    const Metrics_UBX_Count* y = b;
+    return (int)x->key - (int)y->key;
+}
+
+void metrics_write(FILE* out, const Metrics* m)
+{
+    Metrics_UBX_Count ubx[METRICS_UBX_IDS];
+    int n = 0;
+    int i;
+
+    fprintf(out, "Reads: %llu, %llu bytes\n",
+            (unsigned long long)m->reads, (unsigned long long)m->bytes_read);
+    write_histogram(out, "Read size", "bytes", &(m->chunk_size));
+    write_histogram(out, "Read gap", "us", &(m->read_gap));
+
+    /* In class and id order */
+    for (i = 0; i < METRICS_UBX_IDS; i++) {
+        if (m->ubx[i].count > 0) {
+            ubx[n++] = m->ubx[i];
+        }
+    }
+    qsort(ubx, n, sizeof(Metrics_UBX_Count), compare_ubx);
+    fprintf(out, "UBX frames:");
+    for (i = 0; i < n; i++) {
+        fprintf(out, " %02x-%02x: %llu", ubx[i].key >> 8, ubx[i].key & 0xFF,
+                (unsigned long long)ubx[i].count);
+    }
+    if (m->ubx_other > 0) {
+        fprintf(out, " other: %llu", (unsigned long long)m->ubx_other);
+    }
+    fprintf(out, "\n");
+}
@@ -0,0 +1,91 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Runtime counters of one receiver, kept by its reader thread only, so
+ * plain increments do.
+ *
+ * Per read(): the bytes, a log2 histogram of the chunk sizes and a log2
+ * histogram of the time since the previous read. Chunks that come in
+ * full, or long gaps followed by big chunks, point at a reader that
+ * does not keep up with the port. Per UBX class and id the frames
+ * parsed.
+ *
+ * The parser and configuration counters are already kept elsewhere
+ * and are copied in by whoever writes the metrics out. mon appends a
+ * dump to NAME.metrics, next to the log NAME, on SIGUSR1 and at the
+ * end of the run.
+ */
+
+#define METRICS_SUFFIX ".metrics"
+#define METRICS_BUCKETS (32)        /* Bucket k counts values in [2^(k-1), 2^k) */
+#define METRICS_UBX_IDS (64)        /* Distinct class/id pairs counted */
+
+typedef struct Metrics_Histogram {
+    uint64_t count[METRICS_BUCKETS];
+} Metrics_Histogram;
+
+typedef struct Metrics_UBX_Count {
+    uint16_t key;           /* class << 8 | id */
+    uint64_t count;         /* 0 for a free slot */
+} Metrics_UBX_Count;
+
+typedef struct Metrics {
+    uint64_t started;       /* CLOCK_MONOTONIC, ns */
+    uint64_t reads;
+    uint64_t bytes_read;
+    uint64_t last_read;     /* Time of the previous read, ns */
+    Metrics_Histogram chunk_size;   /* bytes */
+    Metrics_Histogram read_gap;     /* us */
+    Metrics_UBX_Count ubx[METRICS_UBX_IDS];
+    uint64_t ubx_other;     /* Frames of class/id pairs that did not fit */
+    uint64_t dumps;
+} Metrics;
+
+static inline int metrics_bucket(uint64_t value)
+{
+    int k = (value == 0) ? 0 : 64 - __builtin_clzll(value);
+    return (k < METRICS_BUCKETS) ? k : METRICS_BUCKETS - 1;
+}
+
+/* n bytes read at time, ns */
+static inline void metrics_read(Metrics* m, size_t n, uint64_t time)
+{
+    m->reads++;
+    m->bytes_read += n;
+    m->chunk_size.count[metrics_bucket(n)]++;
+    if (m->last_read != 0 && time >= m->last_read) {
+        m->read_gap.count[metrics_bucket((time - m->last_read) / 1000)]++;
+    }
+    m->last_read = time;
+}
+
+static inline void metrics_ubx(Metrics* m, uint8_t class, uint8_t id)
+{
+    uint16_t key = (uint16_t)((class << 8) | id);
+    unsigned slot = (class * 31U + id) & (METRICS_UBX_IDS - 1);
+    int i;
+
+    for (i = 0; i < METRICS_UBX_IDS; i++) {
+        Metrics_UBX_Count* c = &(m->ubx[slot]);
+        if (c->key == key && c->count > 0) {
+            c->count++;
+            return;
+        }
+        if (c->count == 0) {
+            c->key = key;
+            c->count = 1;
+            return;
+        }
+        slot = (slot + 1) & (METRICS_UBX_IDS - 1);
+    }
+    m->ubx_other++;
+}
+
+void metrics_init(Metrics* m, uint64_t now);
+void metrics_write(FILE* out, const Metrics* m);
+
+#endif /* METRICS_H */
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdint.h>
@@ -9,11 +10,38 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <assert.h>
-
-#define RATE_FAST   (1)
-#define RATE_NORMAL (2)
-#define RATE_SLOW   (3)
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "capture.h"
+#include "binlog.h"
+#include "fix.h"
+#include "nmea.h"
+#include "scan.h"
+#include "ring.h"
+#include "queue.h"
+#include "logwriter.h"
+#include "config.h"
+#include "link.h"
+#include "merge.h"
+#include "stats.h"
+#include "metrics.h"
+#include "shmfix.h"
+#include "server.h"
+#include "columns.h"
+#include "satellites.h"
+#include "ubx.h"
+#include "util.h"
+#include "schedule.h"
 
 char* rate_string[4] = {
     "none",
@@ -68,19 +96,68 @@ NMEA_Info nmea_lookup_table[LOOKUP_TABLE_SIZE] = {
 #define BAUDRATE B230400
 /* #define MODEMDEVICE "/dev/usbch1" */
 #define MODEMDEVICE "/dev/ttyACM0"
+/* Receiver port of MODEMDEVICE: 1 UART, 3 USB */
+#define GNSS_PORT (3)
+/* With -L: the UART of the receiver, on the serial port of the Pi */
+#define UART_DEVICE "/dev/serial0"
+#define UART_PORT (1)
+#define UART_BAUDRATE B9600
+/* Receivers monitored at once, -D */
+#define MAX_RECEIVERS MERGE_MAX_RECEIVERS
 #define _POSIX_SOURCE 1 /* POSIX compliant source */
 #define FALSE 0
 #define TRUE 1
 
-// Buffer big enough for about half an hour's worth of data
-// This way we write only every half hour to disk, and
-// can use an SD card (raspberrypi) to store the data
-#define LOG_BUFFER_SIZE (80*8*1800)
+/* Default loss window of the log, see logwriter.h */
+#define LOG_WINDOW_SECONDS (10)
+/* Default interval of the time index of the log, see logwriter.h */
+#define LOG_MARK_SECONDS (1)
+
+#define MON_VERSION "V0.1.0"
 
+/* Largest read() from the receiver */
 #define INPUT_BUFFER_SIZE (1024)
+/* Longest frame */
 #define SENTENCE_BUFFER_SIZE (1024)
 
-FILE* g_log_file = NULL;
+/* Globals marked _Thread_local belong to one receiver: with several
+ * receivers each has a thread of its own, see Receiver. The writer
+ * thread of a Pipeline takes them over from its reader. */
+_Thread_local FILE* g_log_file = NULL;
+/* Writes g_log_file to disk in blocks, NULL for /dev/null */
+_Thread_local Log_Writer* g_log_writer = NULL;
+/* Print communication errors to the console. Switched off while
+ * benchmarking so we measure the parser and not the terminal. */
+int g_verbose = TRUE;
+/* Write the compact binary log format (binlog.h) instead of text */
+int g_binary_log = FALSE;
+/* Let parse() skip and copy runs of bytes in bulk, see bulk_scan() */
+int g_bulk_scan = TRUE;
+/* Receive time of the frame that is being logged and decoded */
+_Thread_local uint64_t g_receive_time = 0;
+/* Read and parse on one thread, log and decode on another, see
+ * Pipeline */
+int g_threads = FALSE;
+/* Where QUEUE_CAPTURE entries go */
+_Thread_local Capture_Writer* g_capture = NULL;
+/* Merged fixes of all receivers, NULL when not wanted */
+Merge* g_merge = NULL;
+/* The latest fix of every receiver for other processes, NULL when not
+ * wanted */
+Shm_Fix* g_shm_fix = NULL;
+/* Streams the input to TCP clients, NULL when not wanted */
+Server* g_server = NULL;
+/* The phases of the experiment, NULL for a single one, see schedule.h */
+Schedule* g_schedule = NULL;
+/* Export the fixes in columns next to the log, see columns.h */
+int g_write_columns = FALSE;
+_Thread_local Column_Writer* g_columns = NULL;
+/* Write the satellites in view next to the log, see satellites.h */
+int g_write_satellites = FALSE;
+_Thread_local Sat_Writer* g_satellites = NULL;
+/* Readable once the receiver threads have to stop, -1 with a single
+ * receiver, which reads the signals itself */
+int g_stop_fd = -1;
 enum MessageKind {
     NMEA = 1,
     UBX =  2,
@@ -93,609 +170,2457 @@ enum MessageState {
     complete = 3,
 };
 
-#define MAX_UBX_DATA_LENGTH (1024)
-
-typedef struct UBX_Message {
-    uint8_t sync_char1;
-    uint8_t sync_char2;
-    uint8_t class;
-    uint8_t id;
-    uint16_t length;
-    uint8_t body[MAX_UBX_DATA_LENGTH];
-} UBX_Message;
-
+/* The longest UBX body taken, NAV-SAT with SATELLITES_MAX satellites */
+#define MAX_UBX_DATA_LENGTH (UBX_NAV_SAT_LENGTH + SATELLITES_MAX * UBX_NAV_SAT_SV_LENGTH)
+#define MAX_UBX_FRAME_LENGTH (MAX_UBX_DATA_LENGTH + 8)
+
+/* Communication errors, logged as Err1: .. Err5: */
+#define ERR_INTERRUPTED   (1) /* '$' in the middle of a sentence */
+#define ERR_SYNC          (2) /* 0xB5 not followed by 'b' */
+#define ERR_TOO_LONG      (3)
+#define ERR_NMEA_CHECKSUM (4)
+#define ERR_UBX_CHECKSUM  (5)
+#define NUMBER_OF_ERRORS  (6)
+
+typedef struct Parser_Stats {
+    uint64_t nmea_frames;
+    uint64_t ubx_frames;
+    uint64_t errors[NUMBER_OF_ERRORS]; /* Indexed by ERR_..., 0 unused */
+    uint64_t bytes_skipped; /* Bytes that are not part of a good frame */
+} Parser_Stats;
+
+/* Parser state. The bytes of the frame are not copied, they stay in
+ * the ring from start up to scan. */
 typedef struct Message {
     enum MessageKind kind;
     enum MessageState state;
-    char buffer[SENTENCE_BUFFER_SIZE];
-    uint16_t current_position;
+    uint64_t start;     /* Ring offset of the first byte of the frame */
+    uint64_t scan;      /* Ring offset of the next byte to look at */
     uint16_t expected_length;
+    uint64_t receive_time;  /* Of the bytes being parsed */
+    Parser_Stats stats;
 } Message;
 
-typedef struct CFG_MSG_Body {
-    uint8_t msgClass;
-    uint8_t msgID;
-    uint8_t rate;
-} CFG_MSG_Body;
-
-typedef struct CFG_RATE_Body {
-    uint16_t measRate;
-    uint16_t navRate;
-    uint16_t timeRef;
-} CFG_RATE_Body;
-
-typedef struct CFG_PRT_Poll_Body {
-    uint8_t PortID;
-} CFG_PRT_Poll_Body;
-
-typedef struct CFG_PRT_Body {
-    uint8_t portID;
-    uint8_t reserved0;
-    uint16_t txReady;
-    uint32_t mode;
-    uint32_t baudRate;
-    uint16_t inProtoMask;
-    uint16_t outProtoMask;
-    uint16_t flags;
-    uint16_t reserved5;
-} CFG_PRT_Body;
-
+/* A received UBX message, pointing into the ring or a scratch copy */
+typedef struct UBX_Frame {
+    uint8_t class;
+    uint8_t id;
+    uint16_t length;
+    const uint8_t* body;
+} UBX_Frame;
 
 /* --------------------------------------------------------------------*/
 
-typedef struct Stack_Element {
-    UBX_Message message;
-    int size;
-} Stack_Element;
+/* Configuration in progress, NULL when there is nothing to configure.
+ * Only used by the reader. */
+_Thread_local Config_Engine* g_config = NULL;
 
-#define MAX_UBX_STACK_SIZE (100)
-typedef struct UBX_Message_Stack {
-    uint16_t n;
-    Stack_Element elements[MAX_UBX_STACK_SIZE];
-} UBX_Message_Stack;
+/* Counters of the reader; NULL when benchmarking without them */
+_Thread_local Metrics* g_metrics = NULL;
+/* Bumped on SIGUSR1 when the receivers share the stop fd, each
+ * receiver then writes its metrics */
+atomic_uint g_metrics_requests = 0;
 
 /* --------------------------------------------------------------------*/
 
-volatile int STOP=FALSE;
-void signal_handler(int dummy) {
-    STOP=TRUE;
+/* The signals mon handles: SIGINT and SIGTERM stop it, SIGUSR1 writes
+ * the metrics. They are blocked in every thread and read from a
+ * signalfd by communcation_loop(), or by run_receivers(). */
+void handled_signals(sigset_t* signals)
+{
+    sigemptyset(signals);
+    sigaddset(signals, SIGINT);
+    sigaddset(signals, SIGTERM);
+    sigaddset(signals, SIGUSR1);
 }
 
 
 /* --------------------------------------------------------------------*/
 
-void log_nmea_string(char* nmea_string)
+/* The last decoded fix, see handle_fix() */
+_Thread_local GNSS_Fix g_last_fix;
+
+void log_nmea_string(const Frame_View* sentence)
+{
+    log_writer_mark(g_log_writer, g_receive_time, &g_last_fix);
+    if (g_binary_log) {
+        binlog_write_view(g_log_file, LOG_NMEA, g_receive_time, sentence);
+    } else {
+        fwrite(sentence->part1, sentence->length1, 1, g_log_file);
+        if (sentence->length2 > 0) {
+            fwrite(sentence->part2, sentence->length2, 1, g_log_file);
+        }
+    }
+}
+
+/* Hex dump as "xx xx xx ", formatted in one go instead of one
+ * fprintf() per byte. Returns the number of characters written;
+ * text must have room for 3 * n. */
+int format_hex(char* text, const uint8_t* bytes, int n)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+    for (i = 0; i < n; ++i) {
+        text[3*i]     = digits[bytes[i] >> 4];
+        text[3*i + 1] = digits[bytes[i] & 0x0F];
+        text[3*i + 2] = ' ';
+    }
+    return 3 * n;
+}
+
+/* Hex dump of both parts of a view */
+int format_hex_view(char* text, const Frame_View* view)
+{
+    int length = format_hex(text, view->part1, view->length1);
+    return length + format_hex(&(text[length]), view->part2, view->length2);
+}
+
+/* code is one of ERR_... For Err1, bytes holds the interrupted
+ * sentence, otherwise it is NULL. */
+void log_error(int code, const Frame_View* bytes)
+{
+    static const uint8_t record_types[NUMBER_OF_ERRORS] = {
+        0, LOG_ERR1, LOG_ERR2, LOG_ERR3, LOG_ERR4, LOG_ERR5
+    };
+    static _Thread_local char text[3 * SENTENCE_BUFFER_SIZE + 1];
+    int length;
+
+    if (g_verbose) {
+        printf("Communication error %d\n", code);
+    }
+    log_writer_mark(g_log_writer, g_receive_time, &g_last_fix);
+    if (g_binary_log) {
+        if (bytes != NULL) {
+            binlog_write_view(g_log_file, record_types[code], g_receive_time, bytes);
+        } else {
+            binlog_write_record(g_log_file, record_types[code], g_receive_time, NULL, 0);
+        }
+    } else {
+        fprintf(g_log_file, "Err%d:", code);
+        if (bytes != NULL) {
+            length = format_hex_view(text, bytes);
+            text[length++] = '\n';
+            fwrite(text, length, 1, g_log_file);
+        }
+    }
+}
+
+/* message holds class, id, length and body, without the sync chars
+ * and the checksum */
+void log_ubx_message(uint8_t class, uint8_t id, const Frame_View* message)
 {
-    fprintf(g_log_file, "%s", nmea_string);
+    static _Thread_local char text[3 * MAX_UBX_DATA_LENGTH + 1];
+    Frame_View body;
+    int length;
+
+    log_writer_mark(g_log_writer, g_receive_time, &g_last_fix);
+    if (g_binary_log) {
+        binlog_write_view(g_log_file, LOG_UBX, g_receive_time, message);
+    } else {
+        /* Skip class, id and length, these can be split over the parts */
+        body = *message;
+        if (body.length1 >= 4) {
+            body.part1 += 4;
+            body.length1 -= 4;
+        } else {
+            body.part2 += 4 - body.length1;
+            body.length2 -= 4 - body.length1;
+            body.length1 = 0;
+        }
+        fprintf(g_log_file, "%d %d ", class, id);
+        fprintf(g_log_file, "%d: ", (int)(body.length1 + body.length2));
+        length = format_hex_view(text, &body);
+        text[length++] = '\n';
+        fwrite(text, length, 1, g_log_file);
+    }
 }
 
-void dump_prt_config(CFG_PRT_Body* prt)
+/* Fixes so far, read by the reader thread for -n; NULL when benchmarking */
+_Thread_local atomic_uint_fast64_t* g_fix_count = NULL;
+/* Accuracy statistics of the fixes; NULL when benchmarking */
+_Thread_local Fix_Stats* g_fix_stats = NULL;
+/* Of the receiver, in the merged fixes */
+_Thread_local int g_receiver_index = 0;
+
+void handle_fix(GNSS_Fix* fix)
 {
-    printf("Port %d ", prt->portID);
-    printf("txReady %d ", prt->txReady);
-    printf("Mode %x ", prt->mode);
-    printf("Baud %d ", prt->baudRate);
-    if (prt->inProtoMask & 0x01) {
-        printf("inUBX ");
+    g_last_fix = *fix;
+    if (g_shm_fix != NULL) {
+        /* First, this is the one in a hurry */
+        shm_fix_publish(g_shm_fix, g_receiver_index, fix, monotonic_ns());
     }
-    if (prt->inProtoMask & 0x02) {
-        printf("inNmea ");
+    if (g_fix_count != NULL) {
+        atomic_fetch_add_explicit(g_fix_count, 1, memory_order_relaxed);
     }
-    if (prt->inProtoMask & 0x03) {
-        printf("inRtcm ");
+    if (g_fix_stats != NULL) {
+        stats_add(g_fix_stats, fix);
     }
-    if (prt->outProtoMask & 0x01) {
-        printf("outUBX ");
+    if (g_merge != NULL) {
+        merge_fix(g_merge, g_receiver_index, fix);
     }
-    if (prt->outProtoMask & 0x02) {
-        printf("outNmea ");
+    if (g_columns != NULL) {
+        column_writer_add(g_columns, fix);
+    }
+    if (g_binary_log) {
+        log_writer_mark(g_log_writer, g_receive_time, &g_last_fix);
+        binlog_write_fix(g_log_file, fix);
     }
-    printf("Flags %x ", prt->mode);
-    printf("\n");
 }
 
-void log_ubx_message(UBX_Message* m)
+/* The summary of the accuracy statistics at the end of the log */
+void log_stats(const Fix_Stats* stats)
 {
-    int i;
-    fprintf(g_log_file, "%d %d ", m->class, m->id);
-    fprintf(g_log_file, "%d: ", m->length);
-    for (i = 0; i < m->length; ++i) {
-        fprintf(g_log_file, "%02x ", m->body[i]);
-    }
-    fprintf(g_log_file, "\n");
-}
-
-void parse_ubx(UBX_Message* m)
-{
-    log_ubx_message(m);
-    switch (m->class) {
-        case 0x05:
-            {
-                switch(m->id) {
-                    case 0x00:
-                        printf("ack nak\n");
-                        break;
-                    case 0x01:
-                        printf("ack ack\n");
-                        break;
-                    default:
-                        break;
-                }
-            }
-        case 0x06:
-            {
-                switch(m->id) {
-                    case 0x00:
-                        printf("CFG-PRT\n");
-                        dump_prt_config((void*)(&(m->body[0])));
-                    case 0x3E:
-                        printf("CFG-GNSS\n");
-                        break;
-                    case 0x24:
-                        printf("Navigation engine settings\n");
-                        break;
-                    case 0x23:
-                        printf("Navigation engine expert settings\n");
-                        printf("ppp %d\n", m->body[26]);
-                        break;
-                    case 0x06:
-                        printf("DAT Settings\n");
-                        break;
-                    case 0x08:
-                        printf("Rate Settings\n");
-                        break;
-                    default:
-                        break;
-                }
-            }
-        default:
-            break;
+    char* text = NULL;
+    size_t length = 0;
+    FILE* out;
+
+    if (!g_binary_log) {
+        stats_print(stats, g_log_file);
+        return;
+    }
+    out = open_memstream(&text, &length);
+    if (out == NULL) {
+        perror("open_memstream");
+        return;
+    }
+    stats_print(stats, out);
+    fclose(out);
+    binlog_write_record(g_log_file, LOG_STATS, monotonic_ns(), text,
+            (length < UINT16_MAX) ? length : UINT16_MAX);
+    free(text);
+}
+
+/* The start of phase k of g_schedule */
+void log_phase(int k, uint64_t time)
+{
+    const Phase* p = &(g_schedule->phases[k]);
+    char text[128];
+    int length;
+
+    length = snprintf(text, sizeof(text), "Phase: %d %s, rate %s, output %s, %d s\n",
+            k + 1, p->name, rate_string[p->rate], schedule_output_name(p->nav_mode),
+            p->seconds);
+    if (g_binary_log) {
+        binlog_write_record(g_log_file, LOG_PHASE, time, text, (uint16_t)length);
+    } else {
+        fwrite(text, length, 1, g_log_file);
+    }
+}
+
+/* The satellites in view of an epoch, after its fix */
+void handle_satellites(const Sat_Epoch* satellites)
+{
+    if (g_satellites != NULL) {
+        sat_writer_add(g_satellites, satellites, g_last_fix.time_of_day);
     }
 }
 
+_Thread_local NMEA_Decoder g_nmea_decoder;
 
-void compute_checksum(const uint8_t* buffer, uint16_t n, uint8_t *ck_a, uint8_t* ck_b)
+void decode_nmea_string(const char* nmea_string, uint16_t length)
 {
-    uint16_t i;
-    uint8_t CK_A = 0;
-    uint8_t CK_B = 0;
-    for (i = 0; i < n; i++)
-    {
-        CK_A = CK_A + buffer[i];
-        CK_B = CK_B + CK_A;
+    GNSS_Fix fix;
+    int done = nmea_decode(&g_nmea_decoder, nmea_string, length, &fix);
+
+    /* The satellites are of the epoch before a fix that comes with them */
+    if (done & NMEA_SATELLITES) {
+        handle_satellites(&(g_nmea_decoder.satellites));
+    }
+    if (done & NMEA_FIX) {
+        fix.receive_time = g_receive_time;
+        handle_fix(&fix);
+    }
+}
+
+/* NAV-DOP comes before NAV-PVT in an epoch, keep it until then */
+_Thread_local UBX_NAV_DOP g_last_dop;
+
+void decode_nav_dop(UBX_Frame* m)
+{
+    ubx_decode_NAV_DOP(m->body, m->length, &g_last_dop);
+}
+
+void decode_nav_pvt(UBX_Frame* m)
+{
+    UBX_NAV_PVT pvt;
+    GNSS_Fix fix;
+    int32_t time_of_day;
+
+    if (!ubx_decode_NAV_PVT(m->body, m->length, &pvt)) {
+        return;
+    }
+
+    bzero(&fix, sizeof(GNSS_Fix));
+    fix.receive_time = g_receive_time;
+    /* nano is -1e9..1e9 and corrects the rounded seconds */
+    time_of_day = ((pvt.hour * 60 + pvt.min) * 60 + pvt.sec) * 1000;
+    time_of_day += pvt.nano / 1000000;
+    if (time_of_day < 0) {
+        time_of_day += 24 * 3600 * 1000;
+    }
+    fix.time_of_day = (uint32_t)time_of_day;
+    fix.year = pvt.year;
+    fix.month = pvt.month;
+    fix.day = pvt.day;
+    fix.lat = pvt.lat;
+    fix.lon = pvt.lon;
+    fix.altitude = pvt.hMSL;
+    fix.speed = pvt.gSpeed;
+    fix.course = pvt.headMot;
+    fix.h_acc = pvt.hAcc;
+    fix.v_acc = pvt.vAcc;
+    fix.pdop = pvt.pDOP;
+    if (g_last_dop.iTOW == pvt.iTOW) {
+        fix.hdop = g_last_dop.hDOP;
+        fix.vdop = g_last_dop.vDOP;
+    }
+    fix.fix_type = pvt.fixType;
+    fix.num_sv = pvt.numSV;
+    fix.flags = pvt.valid & (FIX_VALID_DATE | FIX_VALID_TIME);
+    if (pvt.flags & 0x01) {
+        fix.flags |= FIX_OK;
+    }
+    if (pvt.flags & 0x02) {
+        fix.flags |= FIX_DIFF;
     }
-    *ck_a = CK_A;
-    *ck_b = CK_B;
+    fix.source = FIX_SOURCE_UBX;
+
+    handle_fix(&fix);
+}
+
+/* After NAV-PVT in an epoch */
+void decode_nav_sat(UBX_Frame* m)
+{
+    Sat_Epoch satellites;
+    UBX_NAV_SAT sat;
+    UBX_NAV_SAT_SV sv;
+    int i;
+
+    if (!ubx_decode_NAV_SAT(m->body, m->length, &sat) ||
+            m->length < UBX_NAV_SAT_LENGTH + UBX_NAV_SAT_SV_LENGTH * sat.numSvs) {
+        return;
+    }
+    satellites.n = 0;
+    for (i = 0; i < sat.numSvs; i++) {
+        ubx_decode_NAV_SAT_SV(&(m->body[UBX_NAV_SAT_LENGTH + UBX_NAV_SAT_SV_LENGTH * i]),
+                UBX_NAV_SAT_SV_LENGTH, &sv);
+        sat_epoch_add(&satellites, sv.gnssId, sv.svId, sv.elev, sv.cno,
+                (sv.azim >= 0 && sv.azim <= 359) ? (uint16_t)sv.azim : AZIMUTH_UNKNOWN);
+    }
+    handle_satellites(&satellites);
 }
 
-/* Return the number of bytes needed to send the full message */
-uint16_t create_ubx_message(
-        UBX_Message* m, uint8_t class, uint8_t id, char* body, uint16_t length)
+/* The answers to the CFG polls */
+void print_ubx(UBX_Frame* m)
 {
-    m->sync_char1 = 0xB5;
-    m->sync_char2 = 0x62;
-    m->class = class;
-    m->id = id;
-    m->length = length;
-    if (length > 0) {
-        memcpy(m->body, body, length);
+    ubx_dump(stdout, m->class, m->id, m->body, m->length);
+}
+
+/* What to do with each of ubx_messages. ACK-ACK and ACK-NAK are for
+ * config_receive(). */
+static void (*const ubx_handlers[NUMBER_OF_UBX_MESSAGES])(UBX_Frame* m) = {
+    [UBX_MSG_NAV_DOP] = decode_nav_dop,
+    [UBX_MSG_NAV_PVT] = decode_nav_pvt,
+    [UBX_MSG_NAV_SAT] = decode_nav_sat,
+    [UBX_MSG_CFG_PRT] = print_ubx,
+    [UBX_MSG_CFG_DAT] = print_ubx,
+    [UBX_MSG_CFG_RATE] = print_ubx,
+    [UBX_MSG_CFG_NAVX5] = print_ubx,
+    [UBX_MSG_CFG_NAV5] = print_ubx,
+    [UBX_MSG_CFG_GNSS] = print_ubx,
+};
+
+void parse_ubx(UBX_Frame* m)
+{
+    int k = ubx_lookup(m->class, m->id);
+
+    if (k >= 0 && ubx_handlers[k] != NULL) {
+        ubx_handlers[k](m);
     }
-    uint8_t* data = (uint8_t*)m;
-    /* Checksum is over body plus class, id and length */
-    compute_checksum(&(data[2]), length + 4, &(m->body[length]), &(m->body[length+1]));
-    /* total length = |Header| + |body| + |checksum| */
-    return (6U + length + 2U);
 }
 
 void init_message(Message* m)
 {
     m->kind = Undefined;
     m->state = empty;
-    m->buffer[0] = 0;
-    m->current_position = 0U;
+    m->start = m->scan;
     m->expected_length = 0U;
 }
 
+/* Start of the stream in ring, clears the statistics too */
+void init_parser(Message* m, Ring* ring)
+{
+    m->scan = ring->head;
+    init_message(m);
+    m->receive_time = 0;
+    bzero(&(m->stats), sizeof(Parser_Stats));
+}
 
-/* --------------------------------------------------------------------*/
-
-void init_ubx_message_stack(UBX_Message_Stack* ubx_messages)
+/* Ring offset of the first byte the parser still needs */
+uint64_t parser_keep(const Message* m)
 {
-    uint32_t i;
-    ubx_messages->n = 0;
-    for (i = 0; i < MAX_UBX_STACK_SIZE; i++) {
-        bzero(&(ubx_messages->elements[i]), sizeof(Stack_Element));
-    }
+    return (m->state == empty) ? m->scan : m->start;
 }
 
-void ubx_message_push(
-        UBX_Message_Stack* ubx_messages,
-        uint8_t class, uint8_t id, char* body, uint16_t length,
-        char* label)
+void print_parser_stats(FILE* out, const Parser_Stats* stats)
 {
-    assert(ubx_messages->n < MAX_UBX_STACK_SIZE);
-    uint16_t i;
-    uint16_t n = ubx_messages->n;
-    uint8_t* p;
+    fprintf(out, "Frames: nmea %llu ubx %llu\n",
+            (unsigned long long)stats->nmea_frames,
+            (unsigned long long)stats->ubx_frames);
+    fprintf(out, "Errors: interrupted %llu sync %llu too_long %llu "
+            "nmea_checksum %llu ubx_checksum %llu\n",
+            (unsigned long long)stats->errors[ERR_INTERRUPTED],
+            (unsigned long long)stats->errors[ERR_SYNC],
+            (unsigned long long)stats->errors[ERR_TOO_LONG],
+            (unsigned long long)stats->errors[ERR_NMEA_CHECKSUM],
+            (unsigned long long)stats->errors[ERR_UBX_CHECKSUM]);
+    fprintf(out, "Bytes skipped: %llu\n", (unsigned long long)stats->bytes_skipped);
+}
 
-    ubx_messages->elements[n].size = create_ubx_message(
-            &(ubx_messages->elements[n].message), class, id, body, length);
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
 
-    p = (uint8_t*)(&(ubx_messages->elements[n].message));
-    printf("%s ", label);
-    for (i = 0; i < ubx_messages->elements[n].size; i++) {
-        printf("%02x ", p[i]);
+/* The n bytes at start in the ring run from the '$' up to and including
+ * the '\n' and should end in "*hh\r\n", the XOR of the bytes between
+ * '$' and '*' */
+int nmea_checksum_ok(const Ring* ring, uint64_t start, uint16_t n)
+{
+    uint64_t end = start + n - 1;
+    uint64_t i;
+    uint8_t checksum = 0;
+    int high;
+    int low;
+
+    if (n > 1 && ring_byte(ring, end - 1) == '\r') {
+        end--;
+    }
+    if (end < start + 4 || ring_byte(ring, end - 3) != '*') {
+        return 0;
     }
-    printf("\n");
+    for (i = start + 1; i < end - 3; i++) {
+        checksum ^= ring_byte(ring, i);
+    }
+    high = hex_value(ring_byte(ring, end - 2));
+    low = hex_value(ring_byte(ring, end - 1));
+    return (high >= 0) && (low >= 0) && (checksum == (uint8_t)((high << 4) | low));
+}
 
-    ubx_messages->n = n + 1;
+/* frame holds sync chars, class, id, length, body and CK_A CK_B */
+int ubx_checksum_ok(const uint8_t* frame, uint16_t n)
+{
+    uint8_t ck_a;
+    uint8_t ck_b;
+    ubx_checksum(&(frame[2]), n - 4, &ck_a, &ck_b);
+    return (frame[n - 2] == ck_a) && (frame[n - 1] == ck_b);
 }
 
-Stack_Element* ubx_message_pop(UBX_Message_Stack* ubx_messages)
+/* The frame in message turned out to be bad. Its bytes after the first
+ * may hold the start of the next good frame, they are still in the
+ * ring, so scan them again. */
+void resync(Message* message)
 {
-    Stack_Element* result = NULL;
-    if (ubx_messages->n > 0) {
-        uint16_t n = ubx_messages->n;
-        n--;
-        result = &(ubx_messages->elements[n]);
-        ubx_messages->n = n;
-    }
-    return result;
+    message->stats.bytes_skipped++;
+    message->scan = message->start + 1;
+    init_message(message);
 }
 
-void queue_messages(UBX_Message_Stack* messages, int rate)
+
+/* --------------------------------------------------------------------*/
+
+/* The messages the receiver is asked to send, in the order they are
+ * set */
+enum Output_Message {
+    OUTPUT_NAV_SAT,
+    OUTPUT_NAV_DOP,
+    OUTPUT_NAV_PVT,
+    OUTPUT_GLL,
+    OUTPUT_VTG,
+    OUTPUT_GSA,
+    OUTPUT_GGA,
+    OUTPUT_GSV,
+    OUTPUT_RMC,
+    NUMBER_OF_OUTPUT_MESSAGES
+};
+
+#define OUTPUT_UNSET (0xFF)     /* Left as the receiver has it */
+
+typedef struct Output_Info {
+    const char* label;
+    uint8_t class;      /* UBX messages */
+    uint8_t id;
+    int nmea;           /* Index in nmea_lookup_table, -1 for UBX */
+} Output_Info;
+
+static const Output_Info output_info[NUMBER_OF_OUTPUT_MESSAGES] = {
+    [OUTPUT_NAV_SAT] = { "set_nav_sat_rate", UBX_NAV_SAT_CLASS, UBX_NAV_SAT_ID, -1 },
+    [OUTPUT_NAV_DOP] = { "set_nav_dop_rate", UBX_NAV_DOP_CLASS, UBX_NAV_DOP_ID, -1 },
+    [OUTPUT_NAV_PVT] = { "set_nav_pvt_rate", UBX_NAV_PVT_CLASS, UBX_NAV_PVT_ID, -1 },
+    [OUTPUT_GLL] = { "set_gll_rate", 0, 0, GLL },
+    [OUTPUT_VTG] = { "set_vtg_rate", 0, 0, VTG },
+    [OUTPUT_GSA] = { "set_gsa_rate", 0, 0, GSA },
+    [OUTPUT_GGA] = { "set_gga_rate", 0, 0, GGA },
+    [OUTPUT_GSV] = { "set_gsv_rate", 0, 0, GSV },
+    [OUTPUT_RMC] = { "set_rmc_rate", 0, 0, RMC }
+};
+
+/* What the receiver sends for a rate and navigation mode */
+typedef struct Output_Profile {
+    uint16_t measurement_ms;
+    uint8_t rates[NUMBER_OF_OUTPUT_MESSAGES];  /* Per epoch, or OUTPUT_UNSET */
+} Output_Profile;
+
+/* In NAV_MODE_PVT the NMEA output is switched off and NAV-PVT and
+ * NAV-DOP are sent every epoch instead. NAV_MODE_PVT_SAT adds NAV-SAT. */
+void output_profile(int rate, int nav_mode, Output_Profile* p)
 {
-    CFG_RATE_Body cfg_rate;
-    CFG_MSG_Body  msg;
-    CFG_PRT_Poll_Body prt;
-    CFG_PRT_Body prt_config;
     uint8_t rmc_rate = 1;
     uint8_t gsv_rate = 1;
     uint8_t other_rate = 1;
 
-    ubx_message_push(messages, 0x06, 0x08, NULL, 0, "poll_rate"); /* CFG-RATE */
-
     switch(rate) {
         case RATE_NORMAL:
-            cfg_rate.measRate = 1000; /* ms */
+            p->measurement_ms = 1000;
             other_rate = 1;
             gsv_rate = 1;
             break;
         case RATE_FAST:
-            cfg_rate.measRate = 200; /* ms */
-            gsv_rate = 0;
+            p->measurement_ms = 200;
+            /* Too much for the text log, not for -V */
+            gsv_rate = g_write_satellites ? 1 : 0;
             other_rate = 0;
             break;
         case RATE_SLOW:
-            cfg_rate.measRate = 5000; /* ms */
+            p->measurement_ms = 5000;
             other_rate = 1;
             gsv_rate = 1;
             break;
         default:
             assert(0);
     }
+    if (nav_mode != NAV_MODE_NMEA) {
+        /* All of it comes from NAV-PVT */
+        rmc_rate = 0;
+        gsv_rate = 0;
+        other_rate = 0;
+
+        p->rates[OUTPUT_NAV_SAT] = (nav_mode == NAV_MODE_PVT_SAT) ? 1 : 0;
+        p->rates[OUTPUT_NAV_DOP] = 1;
+        p->rates[OUTPUT_NAV_PVT] = 1;
+    } else {
+        p->rates[OUTPUT_NAV_SAT] = OUTPUT_UNSET;
+        p->rates[OUTPUT_NAV_DOP] = OUTPUT_UNSET;
+        p->rates[OUTPUT_NAV_PVT] = OUTPUT_UNSET;
+    }
+    p->rates[OUTPUT_GLL] = other_rate;
+    p->rates[OUTPUT_VTG] = other_rate;
+    p->rates[OUTPUT_GSA] = other_rate;
+    p->rates[OUTPUT_GGA] = rmc_rate;
+    p->rates[OUTPUT_GSV] = gsv_rate;
+    p->rates[OUTPUT_RMC] = rmc_rate;
+}
+
+/* Queue the settings of profile p. With previous only the ones that
+ * differ from it, sent as they are; what previous set and p leaves
+ * unset is switched off. */
+void queue_profile(Config_Engine* messages, const Output_Profile* p,
+        const Output_Profile* previous)
+{
+    void (*queue)(Config_Engine* c, uint8_t class, uint8_t id,
+            const void* body, uint16_t length, const char* label);
+    UBX_CFG_RATE cfg_rate;
+    UBX_CFG_MSG msg;
+    uint8_t body[CONFIG_MAX_BODY];
+    int i;
+
+    queue = (previous == NULL) ? config_set : config_add;
+
+    for (i = 0; i < NUMBER_OF_OUTPUT_MESSAGES; i++) {
+        const Output_Info* info = &(output_info[i]);
+        uint8_t rate = p->rates[i];
+
+        if (previous != NULL && rate == OUTPUT_UNSET &&
+                previous->rates[i] != OUTPUT_UNSET && previous->rates[i] != 0) {
+            rate = 0;
+        }
+        if (rate == OUTPUT_UNSET || (previous != NULL && rate == previous->rates[i])) {
+            continue;
+        }
+        if (info->nmea >= 0) {
+            msg.msgClass = nmea_lookup_table[info->nmea].class;
+            msg.msgID    = nmea_lookup_table[info->nmea].id;
+        } else {
+            msg.msgClass = info->class;
+            msg.msgID    = info->id;
+        }
+        msg.rate     = rate;
+        queue(messages, UBX_CFG_MSG_CLASS, UBX_CFG_MSG_ID, body,
+                ubx_encode_CFG_MSG(&msg, body), info->label);
+    }
+
+    /* Last, so the rates for the chosen mode are the ones that stick */
+    if (previous != NULL && p->measurement_ms == previous->measurement_ms) {
+        return;
+    }
+    cfg_rate.measRate = p->measurement_ms;
     cfg_rate.navRate  = 1; /* Always 1 */
     cfg_rate.timeRef  = 0; /* UTC */
-    ubx_message_push(messages, 0x06, 0x08, (char*)(&cfg_rate), sizeof(CFG_RATE_Body), "set_rate");
-
-    msg.msgClass = nmea_lookup_table[RMC].class;
-    msg.msgID    = nmea_lookup_table[RMC].id;
-    msg.rate     = rmc_rate;
-    ubx_message_push(messages, 0x06, 0x01, (char*)(&msg), sizeof(CFG_MSG_Body), "set_rmc_rate");
-    msg.msgClass = nmea_lookup_table[GSV].class;
-    msg.msgID    = nmea_lookup_table[GSV].id;
-    msg.rate     = gsv_rate;
-    ubx_message_push(messages, 0x06, 0x01, (char*)(&msg), sizeof(CFG_MSG_Body), "set_gsv_rate");
-    msg.msgClass = nmea_lookup_table[GGA].class;
-    msg.msgID    = nmea_lookup_table[GGA].id;
-    msg.rate     = rmc_rate;
-    ubx_message_push(messages, 0x06, 0x01, (char*)(&msg), sizeof(CFG_MSG_Body), "set_gga_rate");
-    msg.msgClass = nmea_lookup_table[GSA].class;
-    msg.msgID    = nmea_lookup_table[GSA].id;
-    msg.rate     = other_rate;
-    ubx_message_push(messages, 0x06, 0x01, (char*)(&msg), sizeof(CFG_MSG_Body), "set_gsa_rate");
-    msg.msgClass = nmea_lookup_table[VTG].class;
-    msg.msgID    = nmea_lookup_table[VTG].id;
-    msg.rate     = other_rate;
-    ubx_message_push(messages, 0x06, 0x01, (char*)(&msg), sizeof(CFG_MSG_Body), "set_vtg_rate");
-    msg.msgClass = nmea_lookup_table[GLL].class;
-    msg.msgID    = nmea_lookup_table[GLL].id;
-    msg.rate     = other_rate;
-    ubx_message_push(messages, 0x06, 0x01, (char*)(&msg), sizeof(CFG_MSG_Body), "set_gll_rate");
-
-    ubx_message_push(messages, 0x06, 0x24, NULL, 0, "poll_nav5"); /* CFG-NAV5 */
-    ubx_message_push(messages, 0x06, 0x23, NULL, 0, "poll_navx5"); /* CFG-NAVX5 */
-    ubx_message_push(messages, 0x06, 0x3E, NULL, 0, "poll_gnss"); /* CFG-GNSS */
-    ubx_message_push(messages, 0x06, 0x06, NULL, 0, "poll_dat"); /* CFG-DAT */
-
-    prt.PortID = 0;
-    ubx_message_push(messages, 0x06, 0x00, (char*)(&prt), sizeof(CFG_PRT_Poll_Body), "poll_port_0");
-    prt.PortID = 1;
-    ubx_message_push(messages, 0x06, 0x00, (char*)(&prt), sizeof(CFG_PRT_Poll_Body), "poll_port_1");
-    prt.PortID = 3;
-    ubx_message_push(messages, 0x06, 0x00, (char*)(&prt), sizeof(CFG_PRT_Poll_Body), "poll_port_3");
-    prt.PortID = 4;
-    ubx_message_push(messages, 0x06, 0x00, (char*)(&prt), sizeof(CFG_PRT_Poll_Body), "poll_port_4");
-
-    prt_config.portID = 1;
-    prt_config.txReady = 0;
-    prt_config.mode = 0x8c0;
-    prt_config.baudRate = 9600;
-    prt_config.inProtoMask = 0;
-    prt_config.outProtoMask = 0;
-    prt_config.flags = 0x8c0;
-    ubx_message_push(messages, 0x06, 0x00, (char*)(&prt_config), sizeof(CFG_PRT_Body), "config_port_1");
+    queue(messages, UBX_CFG_RATE_CLASS, UBX_CFG_RATE_ID, body,
+            ubx_encode_CFG_RATE(&cfg_rate, body), "set_rate");
+}
 
-    prt_config.portID = 0;
+/* In diff mode only the settings are checked, and sent where needed.
+ * When mon is on the UART, that port is left as link_setup() set it. */
+void queue_messages(Config_Engine* messages, int rate, int nav_mode, int on_uart)
+{
+    UBX_CFG_RATE cfg_rate;
+    UBX_CFG_MSG msg;
+    UBX_CFG_PRT_POLL prt;
+    UBX_CFG_PRT prt_config;
+    Output_Profile profile;
+    uint8_t body[CONFIG_MAX_BODY];
+
+    if (!messages->diff) {
+        msg.msgClass = nmea_lookup_table[RMC].class;
+        msg.msgID    = nmea_lookup_table[RMC].id;
+        msg.rate     = 1;
+        config_add(messages, UBX_CFG_MSG_CLASS, UBX_CFG_MSG_ID, body,
+                ubx_encode_CFG_MSG(&msg, body), "set_rmc_rate_to_1");
+
+        cfg_rate.measRate = 1000; /* Every 1 seconds */
+        cfg_rate.navRate  = 1;
+        cfg_rate.timeRef  = 0; /* UTC */
+        config_add(messages, UBX_CFG_RATE_CLASS, UBX_CFG_RATE_ID, body,
+                ubx_encode_CFG_RATE(&cfg_rate, body), "set_rate_to_1");
+    }
+
+    memset(&prt_config, 0, sizeof(UBX_CFG_PRT));
+    prt_config.portID = 4;
     prt_config.txReady = 0;
     prt_config.mode = 0x0;
     prt_config.baudRate = 0;
     prt_config.inProtoMask = 0;
     prt_config.outProtoMask = 0;
     prt_config.flags = 0x0;
-    ubx_message_push(messages, 0x06, 0x00, (char*)(&prt_config), sizeof(CFG_PRT_Body), "config_port_0");
+    config_set(messages, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+            ubx_encode_CFG_PRT(&prt_config, body), "config_port_4");
 
-    prt_config.portID = 4;
+    prt_config.portID = 0;
     prt_config.txReady = 0;
     prt_config.mode = 0x0;
     prt_config.baudRate = 0;
     prt_config.inProtoMask = 0;
     prt_config.outProtoMask = 0;
     prt_config.flags = 0x0;
-    ubx_message_push(messages, 0x06, 0x00, (char*)(&prt_config), sizeof(CFG_PRT_Body), "config_port_4");
+    config_set(messages, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+            ubx_encode_CFG_PRT(&prt_config, body), "config_port_0");
+
+    if (!on_uart) {
+        prt_config.portID = 1;
+        prt_config.txReady = 0;
+        prt_config.mode = 0x8c0;
+        prt_config.baudRate = 9600;
+        prt_config.inProtoMask = 0;
+        prt_config.outProtoMask = 0;
+        prt_config.flags = 0x8c0;
+        config_set(messages, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+                ubx_encode_CFG_PRT(&prt_config, body), "config_port_1");
+    }
 
-    cfg_rate.measRate = 1000; /* Every 1 seconds */
-    cfg_rate.navRate  = 1;
-    cfg_rate.timeRef  = 0; /* UTC */
-    ubx_message_push(messages, 0x06, 0x08, (char*)(&cfg_rate), sizeof(CFG_RATE_Body), "set_rate_to_1");
+    if (!messages->diff) {
+        prt.portID = 4;
+        config_add(messages, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+                ubx_encode_CFG_PRT_POLL(&prt, body), "poll_port_4");
+        prt.portID = 3;
+        config_add(messages, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+                ubx_encode_CFG_PRT_POLL(&prt, body), "poll_port_3");
+        prt.portID = 1;
+        config_add(messages, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+                ubx_encode_CFG_PRT_POLL(&prt, body), "poll_port_1");
+        prt.portID = 0;
+        config_add(messages, UBX_CFG_PRT_CLASS, UBX_CFG_PRT_ID, body,
+                ubx_encode_CFG_PRT_POLL(&prt, body), "poll_port_0");
+
+        config_add(messages, UBX_CFG_DAT_CLASS, UBX_CFG_DAT_ID, NULL, 0, "poll_dat");
+        config_add(messages, UBX_CFG_GNSS_CLASS, UBX_CFG_GNSS_ID, NULL, 0, "poll_gnss");
+        config_add(messages, UBX_CFG_NAVX5_CLASS, UBX_CFG_NAVX5_ID, NULL, 0, "poll_navx5");
+        config_add(messages, UBX_CFG_NAV5_CLASS, UBX_CFG_NAV5_ID, NULL, 0, "poll_nav5");
+    }
 
-    msg.msgClass = nmea_lookup_table[RMC].class;
-    msg.msgID    = nmea_lookup_table[RMC].id;
-    msg.rate     = 1;
-    ubx_message_push(messages, 0x06, 0x01, (char*)(&msg), sizeof(CFG_MSG_Body), "set_rmc_rate_to_1");
+    output_profile(rate, nav_mode, &profile);
+    queue_profile(messages, &profile, NULL);
+
+    if (!messages->diff) {
+        config_add(messages, UBX_CFG_RATE_CLASS, UBX_CFG_RATE_ID, NULL, 0, "poll_rate");
+    }
 }
 
 /* --------------------------------------------------------------------*/
 
-void parse(uint8_t* input_buffer, int n, Message* message)
+/* Fast path of parse(). Skips the bytes between frames, and moves over
+ * the bytes of a sentence up to its '\n' or '$' and the body of a UBX
+ * message up to its last byte, in one go. Everything that needs a
+ * decision is left to the byte at a time path, so the result is the
+ * same. Works on the part of the ring up to its end, the rest is done
+ * on the next call. */
+static void bulk_scan(Ring* ring, Message* message)
 {
-    int i;
+    size_t index = (size_t)(message->scan & (RING_SIZE - 1));
+    size_t m = (size_t)(ring->head - message->scan);
+    const uint8_t* p = &(ring->data[index]);
+    size_t k = 0;
 
-    for (i = 0; i < n; ++i) {
-        uint8_t c = input_buffer[i];
-        if (message->current_position > SENTENCE_BUFFER_SIZE - 10) {
-            printf("Communication error 3\n");
-            fprintf(g_log_file, "Err3:");
-            init_message(message);
+    if (m > RING_SIZE - index) {
+        m = RING_SIZE - index;
+    }
+    if (message->state == empty) {
+        k = scan_for_either(p, m, '$', 0xB5U);
+        message->stats.bytes_skipped += k;
+    } else if (message->kind == NMEA) {
+        /* Stop where the byte path reports a too long sentence */
+        size_t room = (SENTENCE_BUFFER_SIZE - 10) - (size_t)(message->scan - message->start);
+        if (m > room) {
+            m = room;
         }
-        if (message->state == waiting_for_more) {
-            if (message->kind == NMEA) {
-                if (c == 0x0A) {
-                    message->buffer[message->current_position] = c;
-                    (message->current_position)++;
-                    message->buffer[message->current_position] = 0;
-
-                    /* Deal with full message */
-                    log_nmea_string(message->buffer);
-
-                    /* Now we are ready for the next one */
-                    init_message(message);
-                } else if (c == (uint8_t)'$') {
-                    uint32_t i;
-                    printf("Communication error 1\n");
-                    fprintf(g_log_file, "Err1:");
-                    for (i = 0; i < message->current_position; ++i) {
-                        fprintf(g_log_file, "%02x ", message->buffer[i]);
-                    }
-                    fprintf(g_log_file, "\n");
-                    /* Reset */
-                    init_message(message);
-                } else {
-                    message->buffer[message->current_position] = c;
-                    (message->current_position)++;
-                }
-            } else if (message->kind == UBX) {
-                message->buffer[message->current_position] = c;
-                (message->current_position)++;
-                if (message->current_position == 2) {
-                    if (message->buffer[1] != 'b') {
-                        printf("Communication error 2\n");
-                        fprintf(g_log_file, "Err2:");
-                        init_message(message);
-                    }
-                } else if (message->current_position == 6) {
-                    uint16_t* length;
-                    /* Bytes 4 and 5 contain the length in little endian
-                     * format */
-                    length = (uint16_t*)(&(message->buffer[4]));
-                    message->expected_length = (*length) + 8U;
-                    // printf("UBX Length %d\n", message->expected_length);
-                }
-                if (message->current_position == message->expected_length) {
-                    // printf("Got a full UBX message\n");
-                    UBX_Message* ubx_message = (UBX_Message*)(&(message->buffer[0]));
-                    parse_ubx(ubx_message);
-                    /* Reset for the next message */
-                    init_message(message);
-                }
-            } else {
-                assert(message->state == empty);
-            }
-        } else if (message->state == empty) {
-            if (c == 0xB5U) {
-                // printf("Got start of an UBX message %d\n", i);
-                message->kind = UBX;
-                message->buffer[message->current_position] = c;
-                (message->current_position)++;
-                message->state = waiting_for_more;
-            } else if (c == (uint8_t)'$') {
-                message->kind = NMEA;
-                message->buffer[message->current_position] = c;
-                (message->current_position)++;
-                message->state = waiting_for_more;
-            } else {
-                /* Skip the bytes of a message for which we missed the begining */
-            }
+        k = scan_for_either(p, m, 0x0A, '$');
+    } else if (message->kind == UBX && message->scan - message->start >= 6) {
+        /* Length is known, the last byte completes the message */
+        k = message->expected_length - (size_t)(message->scan - message->start) - 1U;
+        if (k > m) {
+            k = m;
         }
     }
+    message->scan += k;
 }
 
-void communcation_loop(
-        int fd, int number_of_samples, int do_flush,
-        UBX_Message_Stack* ubx_messages)
+/* What parse() finds is handed on as a Queue_Entry. Single threaded
+ * it is handled right away. With -T the reader thread puts it in the
+ * queue and the writer thread handles it, so a slow log write never
+ * keeps the reader from draining the port.
+ *
+ * The writer reports in released how far it is done with the ring, the
+ * reader does not reuse bytes after that. When the ring or the queue is
+ * full a live reader drops and counts, a replay waits.
+ *
+ * Neither side spins. A writer with nothing to do sleeps on data_fd,
+ * the reader wakes it once per batch of input, not per entry; a replay
+ * waiting for room sleeps on space_fd until the writer has handled
+ * more. Each flags in an atomic that it is about to sleep and then
+ * looks again, so no wakeup is lost; PIPELINE_WAIT_MS only bounds a
+ * sleep in case one is. */
+#define PIPELINE_WAIT_MS (100)
+
+typedef struct Pipeline {
+    Frame_Queue queue;
+    const Ring* ring;
+    atomic_uint_fast64_t released;
+    atomic_int done;            /* The reader has stopped */
+    int lossless;
+    pthread_t writer;
+    int data_fd;                /* eventfd, wakes the writer */
+    int space_fd;               /* eventfd, wakes a waiting reader */
+    atomic_int writer_idle;
+    atomic_int reader_waiting;
+    int pending;                /* Pushed since the writer was woken */
+    uint64_t writer_sleeps;
+    /* The reader's globals, for the writer */
+    FILE* log_file;
+    Log_Writer* log_writer;
+    Capture_Writer* capture;
+    atomic_uint_fast64_t* fix_count;
+    Fix_Stats* fix_stats;
+    Column_Writer* columns;
+    Sat_Writer* satellites;
+    int receiver_index;
+    /* Reader side statistics */
+    uint64_t ring_high_water;
+    uint64_t dropped_bytes;
+} Pipeline;
+
+_Thread_local Pipeline* g_pipeline = NULL;
+
+/* Free the ring up to what the parser still needs, but with -T not
+ * past what the writer has released */
+static void release_input(Ring* ring, const Message* message)
 {
-    int n;
-    static uint8_t input_buffer[INPUT_BUFFER_SIZE];
-    Message message;
-    init_message(&message);
-    int k = 0;
-    int x = 2;
-
-    while (STOP==FALSE) {       /* loop for input */
-        /* returns after at least 5 chars have been input */
-        n = read(fd, input_buffer, INPUT_BUFFER_SIZE);
-        input_buffer[n] = 0;               /* so we can printf... */
-
-        parse(input_buffer, n, &message);
-        if (k == number_of_samples) {
-            STOP=TRUE;
-        }
-        if (x == 0) {
-            Stack_Element* e = ubx_message_pop(ubx_messages);
-            if (e != NULL) {
-                write(fd, (char*)(&(e->message)), e->size);
-            }
-            x = 2;
+    ring->tail = parser_keep(message);
+    if (g_pipeline != NULL) {
+        uint64_t released =
+            atomic_load_explicit(&(g_pipeline->released), memory_order_acquire);
+        if (released < ring->tail) {
+            ring->tail = released;
+        }
+        if (ring->head - ring->tail > g_pipeline->ring_high_water) {
+            g_pipeline->ring_high_water = ring->head - ring->tail;
         }
-        k++;
-        x--;
     }
 }
 
-void self_test(void)
+static void pipeline_signal(int fd)
 {
-    static uint8_t bytes[4] = { 0xEF, 0xBE, 0xAD, 0xDE };
-    void *p = bytes;
-    uint32_t test_integer = *((uint32_t*)p);
-    assert(test_integer == 0xDEADBEEF);
+    uint64_t one = 1;
+    /* EAGAIN only when the count is huge, the wakeup is then pending */
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        perror("pipeline eventfd");
+    }
 }
 
-int get_index(void)
+/* Until fd is signalled, at most PIPELINE_WAIT_MS */
+static void pipeline_sleep(int fd)
 {
-    FILE* f;
-    int next_index = 0;
-    int index = 0;
-
-    f = fopen("current_index.txt", "r");
-    if (f == NULL) {
-        next_index = 1;
-    } else {
-        int n = 0;
-        n = fscanf(f, "%d", &index);
-        assert(n > 0);
-        next_index = index + 1;
-        fclose(f);
+    struct pollfd p;
+    uint64_t count;
+
+    p.fd = fd;
+    p.events = POLLIN;
+    p.revents = 0;
+    if (poll(&p, 1, PIPELINE_WAIT_MS) > 0 && read(fd, &count, sizeof(count)) < 0 &&
+            errno != EAGAIN) {
+        perror("pipeline eventfd");
     }
-
-    f = fopen("current_index.txt", "w");
-    assert(f != NULL);
-    fprintf(f, "%d", next_index);
-    fclose(f);
-
-    return index;
 }
 
-int create_log_file(char* buffer)
+/* Reader: wake the writer if it sleeps and entries were pushed */
+static void pipeline_wake_writer(Pipeline* p)
 {
-    int ok = 0;
-    char   namestr[130];
-    int index;
-
-    index = get_index();
-
-    sprintf(namestr, "./experiment_%05d.txt", index);
-    g_log_file = fopen( namestr, "w" );
-    if (g_log_file) {
-        if (setvbuf(g_log_file, buffer, _IOFBF, LOG_BUFFER_SIZE) == 0) {
-            ok = 1;
-        } else {
-            perror( "setvbuf()" );
+    if (p->pending) {
+        p->pending = FALSE;
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load(&(p->writer_idle))) {
+            pipeline_signal(p->data_fd);
         }
-    } else {
-        perror( "fopen()" );
     }
-
-    return ok;
 }
 
-int open_gnss(
-        struct termios* oldtio,
-        struct termios* newtio)
+/* Reader: announce a wait for the writer, then check whether it is
+ * still needed and call pipeline_end_wait() */
+static void pipeline_begin_wait(Pipeline* p)
 {
-    int fd;
-
-    fd = open(MODEMDEVICE, O_RDWR | O_NOCTTY );
-    if (fd < 0) {
-        perror(MODEMDEVICE);
-    } else {
-        tcgetattr(fd, oldtio); /* save current port settings */
-
-        bzero(newtio, sizeof(struct termios));
-        /* CS8 - 8 bit characters
-         * CLOCAL - Ignore modem control lines
-         * CREAD -  Enable receiver
-         */
-        newtio->c_cflag = BAUDRATE | CS8 | CLOCAL | CREAD;
-        newtio->c_iflag = IGNPAR;
-        newtio->c_oflag = 0;
-
-        /* set input mode (non-canonical, no echo,...) */
-        newtio->c_lflag = 0;
-        newtio->c_cc[VTIME] = 0;   /* inter-character timer unused */
-        newtio->c_cc[VMIN]  = 5;   /* blocking read until 5 chars received */
+    pipeline_wake_writer(p);
+    atomic_store(&(p->reader_waiting), TRUE);
+    atomic_thread_fence(memory_order_seq_cst);
+}
 
-        tcflush(fd, TCIFLUSH);
-        tcsetattr(fd, TCSANOW, newtio);
+static void pipeline_end_wait(Pipeline* p, int sleep)
+{
+    if (sleep) {
+        pipeline_sleep(p->space_fd);
     }
-
-    return fd;
+    atomic_store(&(p->reader_waiting), FALSE);
 }
 
-void usage(void)
+/* Log and decode a good NMEA sentence */
+static void handle_nmea(const Ring* ring, const Queue_Entry* e)
 {
-    printf( "mon:  gnss monitor\n" );
-    printf( "Usage:\n");
-    printf( "./mon [-f] [-n NUM]\n" );
-    printf( "\n");
-    printf( "-n NUM  -- minimum number of samples to get.\n" );
-    printf( "-f      -- immediately flush a message to the logfile.\n" );
-    printf( "-x      -- navigation rate 5Hz.\n" );
-    printf( "-z      -- navigation rate 0.2Hz.\n" );
+    static _Thread_local uint8_t scratch[SENTENCE_BUFFER_SIZE];
+    Frame_View view;
+
+    ring_view(ring, e->start, e->length, &view);
+    log_nmea_string(&view);
+    decode_nmea_string((const char*)frame_linear(&view, scratch), e->length);
 }
 
-int main(int argc, char** argv)
+/* Log and decode a good UBX message */
+static void handle_ubx(const Ring* ring, const Queue_Entry* e)
+{
+    static _Thread_local uint8_t scratch[MAX_UBX_FRAME_LENGTH];
+    Frame_View view;
+    const uint8_t* frame;
+    UBX_Frame ubx;
+
+    ring_view(ring, e->start, e->length, &view);
+    frame = frame_linear(&view, scratch);
+    ubx.class = frame[2];
+    ubx.id = frame[3];
+    ubx.length = (uint16_t)(e->length - 8U);
+    ubx.body = &(frame[6]);
+
+    /* Log class, id, length and body straight from the ring */
+    ring_view(ring, e->start + 2, e->length - 4U, &view);
+    log_ubx_message(ubx.class, ubx.id, &view);
+    parse_ubx(&ubx);
+}
+
+static void handle_entry(const Ring* ring, const Queue_Entry* e)
+{
+    Frame_View view;
+
+    g_receive_time = e->time;
+    switch (e->type) {
+        case QUEUE_NMEA:
+            handle_nmea(ring, e);
+            break;
+        case QUEUE_UBX:
+            handle_ubx(ring, e);
+            break;
+        case QUEUE_ERROR:
+            if (e->length > 0) {
+                ring_view(ring, e->start, e->length, &view);
+                log_error(e->code, &view);
+            } else {
+                log_error(e->code, NULL);
+            }
+            break;
+        case QUEUE_CAPTURE:
+            ring_view(ring, e->start, e->length, &view);
+            capture_append_view(g_capture, e->time, &view);
+            break;
+        case QUEUE_PHASE:
+            log_phase(e->code, e->time);
+            break;
+        default:
+            assert(0);
+    }
+}
+
+static void deliver(const Ring* ring, const Queue_Entry* e)
+{
+    if (g_pipeline == NULL) {
+        handle_entry(ring, e);
+    } else {
+        while (!queue_push(&(g_pipeline->queue), e)) {
+            if (!g_pipeline->lossless) {
+                g_pipeline->queue.dropped++;
+                return;
+            }
+            pipeline_begin_wait(g_pipeline);
+            pipeline_end_wait(g_pipeline, queue_full(&(g_pipeline->queue)));
+        }
+        g_pipeline->pending = TRUE;
+    }
+}
+
+/* The length bytes at the start of the current frame, release is the
+ * first ring offset still needed after this entry */
+static void emit(const Ring* ring, const Message* message,
+        uint8_t type, uint8_t code, uint16_t length, uint64_t release)
+{
+    Queue_Entry e;
+
+    e.type = type;
+    e.code = code;
+    e.length = length;
+    e.start = message->start;
+    e.release = release;
+    e.time = message->receive_time;
+    if (g_server != NULL && (type == QUEUE_NMEA || type == QUEUE_UBX)) {
+        Frame_View view;
+        ring_view(ring, message->start, length, &view);
+        server_frame(g_server, g_receiver_index,
+                (type == QUEUE_NMEA) ? SERVER_NMEA : SERVER_UBX, &view);
+    }
+    deliver(ring, &e);
+}
+
+static void emit_error(const Ring* ring, const Message* message, int code)
+{
+    emit(ring, message, QUEUE_ERROR, code, 0, message->start);
+}
+
+static void* writer_thread(void* arg)
+{
+    Pipeline* p = arg;
+    Queue_Entry e;
+    uint64_t released = 0;
+
+    g_log_file = p->log_file;
+    g_log_writer = p->log_writer;
+    g_capture = p->capture;
+    g_fix_count = p->fix_count;
+    g_fix_stats = p->fix_stats;
+    g_columns = p->columns;
+    g_satellites = p->satellites;
+    g_receiver_index = p->receiver_index;
+
+    for (;;) {
+        int done = atomic_load(&(p->done));
+        if (queue_pop(&(p->queue), &e)) {
+            handle_entry(p->ring, &e);
+            if (e.release > released) {
+                released = e.release;
+                atomic_store_explicit(&(p->released), released, memory_order_release);
+            }
+            atomic_thread_fence(memory_order_seq_cst);
+            if (atomic_load(&(p->reader_waiting))) {
+                pipeline_signal(p->space_fd);
+            }
+        } else if (done) {
+            break;
+        } else {
+            log_writer_tick(g_log_writer);
+            atomic_store(&(p->writer_idle), TRUE);
+            atomic_thread_fence(memory_order_seq_cst);
+            if (queue_empty(&(p->queue)) && !atomic_load(&(p->done))) {
+                pipeline_sleep(p->data_fd);
+                p->writer_sleeps++;
+            }
+            atomic_store(&(p->writer_idle), FALSE);
+        }
+    }
+    return NULL;
+}
+
+/* Start the writer thread. A live reader also asks for real-time
+ * priority, if we are allowed to. */
+int pipeline_start(Pipeline* p, const Ring* ring, int lossless)
+{
+    int error;
+
+    queue_init(&(p->queue));
+    p->data_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    p->space_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (p->data_fd < 0 || p->space_fd < 0) {
+        perror("eventfd");
+        if (p->data_fd >= 0) {
+            close(p->data_fd);
+        }
+        if (p->space_fd >= 0) {
+            close(p->space_fd);
+        }
+        return FALSE;
+    }
+    atomic_init(&(p->writer_idle), FALSE);
+    atomic_init(&(p->reader_waiting), FALSE);
+    p->pending = FALSE;
+    p->writer_sleeps = 0;
+    p->ring = ring;
+    atomic_init(&(p->released), ring->head);
+    atomic_init(&(p->done), FALSE);
+    p->lossless = lossless;
+    p->ring_high_water = 0;
+    p->dropped_bytes = 0;
+    p->log_file = g_log_file;
+    p->log_writer = g_log_writer;
+    p->capture = g_capture;
+    p->fix_count = g_fix_count;
+    p->fix_stats = g_fix_stats;
+    p->columns = g_columns;
+    p->satellites = g_satellites;
+    p->receiver_index = g_receiver_index;
+
+    error = pthread_create(&(p->writer), NULL, writer_thread, p);
+    if (error != 0) {
+        errno = error;
+        perror("pthread_create");
+        close(p->data_fd);
+        close(p->space_fd);
+        return FALSE;
+    }
+    if (!lossless) {
+        /* After pthread_create(), the writer keeps the normal policy */
+        struct sched_param param;
+        param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+        error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error != 0) {
+            printf("Reader runs at normal priority: %s\n", strerror(error));
+        }
+    }
+    g_pipeline = p;
+    return TRUE;
+}
+
+/* Let the writer handle what is left and wait for it */
+void pipeline_stop(Pipeline* p)
+{
+    atomic_store(&(p->done), TRUE);
+    pipeline_signal(p->data_fd);
+    pthread_join(p->writer, NULL);
+    close(p->data_fd);
+    close(p->space_fd);
+    g_pipeline = NULL;
+}
+
+void pipeline_report(const Pipeline* p)
+{
+    printf("Queue: high water %llu of %d entries, dropped %llu\n",
+            (unsigned long long)p->queue.high_water, QUEUE_SIZE,
+            (unsigned long long)p->queue.dropped);
+    printf("Ring: high water %llu of %d bytes, dropped %llu\n",
+            (unsigned long long)p->ring_high_water, RING_SIZE,
+            (unsigned long long)p->dropped_bytes);
+    printf("Writer: slept %llu times\n", (unsigned long long)p->writer_sleeps);
+}
+
+/* Parses the bytes in the ring that were not seen yet, and frees the
+ * ones no longer needed. Returns the number of complete messages found.
+ *
+ * Both checksums are verified. After an error the bytes of the bad
+ * frame, except its first, are scanned again for the start of the next
+ * frame, so a single bit error costs only the frame it hits. */
+int parse(Ring* ring, Message* message)
+{
+    int frames = 0;
+
+    while (message->scan < ring->head) {
+        uint8_t c;
+        uint16_t length;
+
+        if (g_bulk_scan) {
+            bulk_scan(ring, message);
+            if (message->scan == ring->head) {
+                break;
+            }
+        }
+        c = ring_byte(ring, message->scan);
+        (message->scan)++;
+        length = (uint16_t)(message->scan - message->start);
+
+        if (message->state == waiting_for_more) {
+            if (message->kind == NMEA) {
+                if (c == 0x0A) {
+                    if (nmea_checksum_ok(ring, message->start, length)) {
+                        /* Deal with full message */
+                        emit(ring, message, QUEUE_NMEA, 0, length, message->start + length);
+                        message->stats.nmea_frames++;
+                        frames++;
+
+                        /* Now we are ready for the next one */
+                        init_message(message);
+                    } else {
+                        message->stats.errors[ERR_NMEA_CHECKSUM]++;
+                        emit_error(ring, message, ERR_NMEA_CHECKSUM);
+                        resync(message);
+                    }
+                } else if (c == (uint8_t)'$') {
+                    message->stats.errors[ERR_INTERRUPTED]++;
+                    message->stats.bytes_skipped += length - 1U;
+                    emit(ring, message, QUEUE_ERROR, ERR_INTERRUPTED, length - 1U,
+                            message->start + length - 1U);
+                    /* Reset, this '$' starts the next sentence */
+                    message->start = message->scan - 1;
+                } else if (length > SENTENCE_BUFFER_SIZE - 10) {
+                    message->stats.errors[ERR_TOO_LONG]++;
+                    emit_error(ring, message, ERR_TOO_LONG);
+                    resync(message);
+                }
+            } else if (message->kind == UBX) {
+                if (length == 2) {
+                    if (c != 'b') {
+                        message->stats.errors[ERR_SYNC]++;
+                        emit_error(ring, message, ERR_SYNC);
+                        /* The second byte could be the start of a frame */
+                        resync(message);
+                    }
+                } else if (length == 6) {
+                    /* Bytes 4 and 5 contain the length in little endian
+                     * format */
+                    uint16_t body_length = (uint16_t)(ring_byte(ring, message->start + 4) |
+                            (ring_byte(ring, message->start + 5) << 8));
+                    if (body_length > MAX_UBX_DATA_LENGTH) {
+                        /* Corrupted length, it would not fit, and
+                         * length + 8 could even wrap around */
+                        message->stats.errors[ERR_TOO_LONG]++;
+                        emit_error(ring, message, ERR_TOO_LONG);
+                        resync(message);
+                    } else {
+                        message->expected_length = body_length + 8U;
+                    }
+                } else if (length == message->expected_length) {
+                    static _Thread_local uint8_t scratch[MAX_UBX_FRAME_LENGTH];
+                    Frame_View view;
+                    ring_view(ring, message->start, length, &view);
+                    const uint8_t* frame = frame_linear(&view, scratch);
+                    if (ubx_checksum_ok(frame, length)) {
+                        if (g_config != NULL && (frame[2] == 0x05 || frame[2] == 0x06)) {
+                            config_receive(g_config, frame[2], frame[3], &(frame[6]),
+                                    length - 8U, message->receive_time);
+                        }
+                        emit(ring, message, QUEUE_UBX, 0, length, message->start + length);
+                        message->stats.ubx_frames++;
+                        if (g_metrics != NULL) {
+                            metrics_ubx(g_metrics, frame[2], frame[3]);
+                        }
+                        frames++;
+                        /* Reset for the next message */
+                        init_message(message);
+                    } else {
+                        message->stats.errors[ERR_UBX_CHECKSUM]++;
+                        emit_error(ring, message, ERR_UBX_CHECKSUM);
+                        resync(message);
+                    }
+                }
+            } else {
+                assert(message->state == empty);
+            }
+        } else if (message->state == empty) {
+            if (c == 0xB5U) {
+                message->kind = UBX;
+                message->start = message->scan - 1;
+                message->state = waiting_for_more;
+            } else if (c == (uint8_t)'$') {
+                message->kind = NMEA;
+                message->start = message->scan - 1;
+                message->state = waiting_for_more;
+            } else {
+                /* Skip the bytes of a message for which we missed the begining */
+                message->stats.bytes_skipped++;
+            }
+        }
+    }
+    /* Keep the frame that is still coming in */
+    release_input(ring, message);
+
+    return frames;
+}
+
+/* Longest wait in poll(), so the log still reaches the disk when the
+ * input stops */
+#define HOUSEKEEPING_MS (500)
+/* A phase that ends while the receiver is still being configured waits
+ * for that, checking this often */
+#define PHASE_RETRY_MS (100)
+
+static int timer_open(void)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        perror("timerfd_create");
+    }
+    return fd;
+}
+
+/* First expiry after first_ns, then every interval_ns; 0, 0 disarms */
+static void timer_set(int fd, uint64_t first_ns, uint64_t interval_ns)
+{
+    struct itimerspec t;
+
+    t.it_value.tv_sec = first_ns / 1000000000ULL;
+    t.it_value.tv_nsec = first_ns % 1000000000ULL;
+    t.it_interval.tv_sec = interval_ns / 1000000000ULL;
+    t.it_interval.tv_nsec = interval_ns % 1000000000ULL;
+    timerfd_settime(fd, 0, &t, NULL);
+}
+
+/* Returns the number of expiries since the last call */
+static uint64_t timer_expired(int fd)
+{
+    uint64_t expirations = 0;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        expirations = 0;
+    }
+    return expirations;
+}
+
+/* Send what the configuration engine has to send, and wake up at its
+ * next timeout. Reports when the configuration is done. */
+static void configure(int fd, int timer_fd)
+{
+    uint64_t now;
+    uint64_t deadline;
+
+    if (g_config == NULL) {
+        return;
+    }
+    now = monotonic_ns();
+    config_send(g_config, fd, now);
+    if (config_done(g_config)) {
+        config_report(g_config, stdout);
+        g_config = NULL;
+        timer_set(timer_fd, 0, 0);
+    } else {
+        deadline = config_deadline(g_config);
+        if (deadline > now) {
+            timer_set(timer_fd, deadline - now, 0);
+        } else {
+            timer_set(timer_fd, 1, 0);
+        }
+    }
+}
+
+enum Loop_Fds {
+    FD_SIGNAL,
+    FD_DURATION,
+    FD_CONFIG,
+    FD_BATCH,
+    FD_PHASE,
+    FD_INPUT,
+    NUMBER_OF_FDS
+};
+
+/* Read what is available into the ring and parse it. A live port is
+ * drained until it has nothing more, a replay gets one chunk. Returns
+ * the bytes read, 0 at the end of a replay, -1 on an error. */
+static int read_input(
+        int fd, Ring* ring, Message* message, Pipeline* pipeline,
+        Capture_Reader* replay, Capture_Writer* capture)
+{
+    static _Thread_local uint8_t discard[INPUT_BUFFER_SIZE];
+    int total = 0;
+    int n;
+
+    do {
+        uint64_t head = ring->head;
+        uint64_t receive_time;
+
+        /* The writer may have released more since the last read */
+        release_input(ring, message);
+        if (replay != NULL) {
+            size_t room;
+            uint8_t* space = ring_space(ring, &room);
+            if (room > INPUT_BUFFER_SIZE) {
+                room = INPUT_BUFFER_SIZE;
+            }
+            n = capture_read(replay, space, room, &receive_time);
+            ring_commit(ring, n);
+        } else if (ring_free(ring) > 0) {
+            n = ring_read(ring, fd, INPUT_BUFFER_SIZE);
+            receive_time = monotonic_ns();
+        } else {
+            /* The writer is behind, keep the port drained */
+            n = read(fd, discard, INPUT_BUFFER_SIZE);
+            if (n > 0) {
+                metrics_read(g_metrics, n, monotonic_ns());
+                pipeline->dropped_bytes += n;
+                total += n;
+                continue;
+            }
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            perror("read");
+            return -1;
+        }
+        if (n > 0) {
+            metrics_read(g_metrics, n, receive_time);
+            message->receive_time = receive_time;
+            if (g_server != NULL) {
+                Frame_View view;
+                ring_view(ring, head, n, &view);
+                server_frame(g_server, g_receiver_index, SERVER_RAW, &view);
+            }
+            if (capture != NULL) {
+                Queue_Entry e;
+                e.type = QUEUE_CAPTURE;
+                e.code = 0;
+                e.length = n;
+                e.start = head;
+                e.release = parser_keep(message);
+                e.time = receive_time;
+                deliver(ring, &e);
+            }
+            parse(ring, message);
+            total += n;
+        }
+    } while (replay == NULL && n == INPUT_BUFFER_SIZE);
+
+    return total;
+}
+
+/* One receiver, with its own port, parser, configuration and log. With
+ * more than one, each runs on a thread of its own, pinned to a core. */
+typedef struct Receiver {
+    int index;
+    const char* device;
+    char log_name[256];
+    Ring ring;
+    Message message;
+    Pipeline pipeline;
+    Config_Engine config;
+    Config_Engine phase_config;     /* Switches to the next phase */
+    atomic_uint_fast64_t fix_count;
+    Fix_Stats stats;
+    Metrics metrics;
+    unsigned metrics_requests;  /* Of g_metrics_requests, handled */
+    pthread_t thread;
+    int result;
+} Receiver;
+
+/* Append the metrics of rx to NAME.metrics. Only from the reader. */
+static void write_metrics(Receiver* rx, int fd, int live)
+{
+    char name[sizeof(rx->log_name) + sizeof(METRICS_SUFFIX)];
+    const Config_Engine* c = &(rx->config);
+    struct serial_icounter_struct icount;
+    uint64_t sent = 0;
+    uint64_t answered[CONFIG_FAILED + 1];
+    FILE* out;
+    int i;
+
+    snprintf(name, sizeof(name), "%s%s", rx->log_name, METRICS_SUFFIX);
+    out = fopen(name, "a");
+    if (out == NULL) {
+        perror(name);
+        return;
+    }
+    rx->metrics.dumps++;
+    fprintf(out, "Metrics: dump %llu, receiver %d, %s, after %.3f s\n",
+            (unsigned long long)rx->metrics.dumps, rx->index, rx->device,
+            (double)(monotonic_ns() - rx->metrics.started) / 1.0e9);
+    print_parser_stats(out, &(rx->message.stats));
+
+    memset(answered, 0, sizeof(answered));
+    for (i = 0; i < c->n; i++) {
+        sent += c->messages[i].tries;
+        answered[c->messages[i].state]++;
+    }
+    fprintf(out, "Config: %d messages, %llu sent, %llu acked, %llu naked, %llu failed\n",
+            c->n, (unsigned long long)sent, (unsigned long long)answered[CONFIG_ACKED],
+            (unsigned long long)answered[CONFIG_NAKED],
+            (unsigned long long)answered[CONFIG_FAILED]);
+
+    /* Only serial drivers keep these */
+    if (live && ioctl(fd, TIOCGICOUNT, &icount) == 0) {
+        fprintf(out, "Serial: rx %d overrun %d buffer overrun %d frame %d parity %d break %d\n",
+                icount.rx, icount.overrun, icount.buf_overrun, icount.frame,
+                icount.parity, icount.brk);
+    }
+    metrics_write(out, &(rx->metrics));
+    fprintf(out, "\n");
+    if (fclose(out) != 0) {
+        perror(name);
+    }
+}
+
+/* Mark the start of phase k in the log, in order with the frames */
+static void mark_phase(const Ring* ring, const Message* message, int k)
+{
+    Queue_Entry e;
+
+    e.type = QUEUE_PHASE;
+    e.code = (uint8_t)k;
+    e.length = 0;
+    e.start = message->start;
+    e.release = parser_keep(message);
+    e.time = monotonic_ns();
+    deliver(ring, &e);
+}
+
+/* Start phase k of g_schedule. The settings that differ from the phase
+ * before are all sent at once, so the switch takes one round trip. */
+static void start_phase(Receiver* rx, int k, int fd, int timer_fd)
+{
+    const Phase* p = &(g_schedule->phases[k]);
+    Config_Engine* c = &(rx->phase_config);
+    Output_Profile from;
+    Output_Profile to;
+
+    printf("Phase %d %s: rate %s, output %s, %d s\n", k + 1, p->name,
+            rate_string[p->rate], schedule_output_name(p->nav_mode), p->seconds);
+    mark_phase(&(rx->ring), &(rx->message), k);
+    if (k == 0) {
+        /* Set by queue_messages() */
+        return;
+    }
+    output_profile(g_schedule->phases[k - 1].rate, g_schedule->phases[k - 1].nav_mode, &from);
+    output_profile(p->rate, p->nav_mode, &to);
+    config_init(c, CONFIG_MAX_MESSAGES);
+    c->port = rx->config.port;
+    queue_profile(c, &to, &from);
+    if (c->n > 0) {
+        g_config = c;
+        configure(fd, timer_fd);
+    }
+}
+
+/* Reads from fd until the run is over: number_of_fixes fixes (0 for
+ * no limit), duration_seconds (0 for no limit), the end of a replay, or
+ * SIGINT/SIGTERM. Meanwhile the receiver is configured with config, see
+ * config.h; NULL when there is nothing to configure.
+ *
+ * With g_schedule the run ends after the last phase. At the end of a
+ * phase the receiver is switched to the rates of the next, on the same
+ * port, and the log gets a "Phase:" line.
+ *
+ * With batch_ms the port is read at most once every batch_ms, so the
+ * Pi wakes up less often; a frame then waits at most batch_ms.
+ *
+ * When replaying, the input comes from the capture reader at full speed
+ * until the end of the capture and no configuration messages are sent.
+ * When capture is not NULL every chunk read is also recorded there.
+ *
+ * Input is read straight into the ring of rx, the parser and the log
+ * work on the bytes where they are. With g_threads this is the reader
+ * thread.
+ */
+void communcation_loop(
+        Receiver* rx, int fd, int number_of_fixes, int duration_seconds, int batch_ms,
+        Config_Engine* config,
+        Capture_Reader* replay, Capture_Writer* capture)
+{
+    Ring* ring = &(rx->ring);
+    Message* message = &(rx->message);
+    Pipeline* pipeline = &(rx->pipeline);
+    struct pollfd fds[NUMBER_OF_FDS];
+    sigset_t signals;
+    int stop = FALSE;
+    int input_wanted = TRUE;
+    int phase = 0;
+    int threaded;
+    int i;
+
+    for (i = 0; i < NUMBER_OF_FDS; i++) {
+        fds[i].fd = -1;
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    if (g_stop_fd >= 0) {
+        fds[FD_SIGNAL].fd = g_stop_fd;
+    } else {
+        handled_signals(&signals);
+        fds[FD_SIGNAL].fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    }
+    fds[FD_DURATION].fd = timer_open();
+    fds[FD_CONFIG].fd = timer_open();
+    fds[FD_BATCH].fd = timer_open();
+    fds[FD_PHASE].fd = timer_open();
+    fds[FD_INPUT].fd = fd;
+    if (fds[FD_SIGNAL].fd < 0) {
+        perror("signalfd");
+        stop = TRUE;
+    }
+    for (i = FD_DURATION; i <= FD_PHASE; i++) {
+        if (fds[i].fd < 0) {
+            stop = TRUE;
+        }
+    }
+
+    ring_init(ring);
+    init_parser(message, ring);
+    atomic_store(&(rx->fix_count), 0);
+    g_fix_count = &(rx->fix_count);
+    stats_init(&(rx->stats));
+    g_fix_stats = &(rx->stats);
+    metrics_init(&(rx->metrics), monotonic_ns());
+    rx->metrics_requests = atomic_load(&g_metrics_requests);
+    g_metrics = &(rx->metrics);
+    g_receiver_index = rx->index;
+    g_capture = capture;
+    if (!stop && g_threads && !pipeline_start(pipeline, ring, replay != NULL)) {
+        stop = TRUE;
+    }
+    if (!stop) {
+        if (duration_seconds > 0) {
+            timer_set(fds[FD_DURATION].fd, duration_seconds * 1000000000ULL, 0);
+        }
+        g_config = config;
+        configure(fd, fds[FD_CONFIG].fd);
+        if (g_schedule != NULL && replay == NULL) {
+            start_phase(rx, 0, fd, fds[FD_CONFIG].fd);
+            timer_set(fds[FD_PHASE].fd, g_schedule->phases[0].seconds * 1000000000ULL, 0);
+        }
+    }
+
+    while (!stop) {
+        int timeout = HOUSEKEEPING_MS;
+        int ready;
+
+        if (g_pipeline != NULL) {
+            /* The input of the last round, in one go */
+            pipeline_wake_writer(pipeline);
+        }
+        /* Bytes the writer has not handled yet are still in use */
+        release_input(ring, message);
+        if (replay != NULL && ring_free(ring) == 0 && g_pipeline != NULL) {
+            /* Only with the writer behind, wait for it */
+            pipeline_begin_wait(pipeline);
+            release_input(ring, message);
+            pipeline_end_wait(pipeline, ring_free(ring) == 0);
+            continue;
+        }
+        fds[FD_INPUT].events = input_wanted ? POLLIN : 0;
+        if (replay != NULL && ring_free(ring) == 0) {
+            fds[FD_INPUT].events = 0;
+            timeout = 1;
+        }
+
+        ready = poll(fds, NUMBER_OF_FDS, timeout);
+        if (ready < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+                stop = TRUE;
+            }
+            continue;
+        }
+
+        if (fds[FD_SIGNAL].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (g_stop_fd >= 0) {
+                /* The stop fd is left readable, for the other receivers */
+                stop = TRUE;
+            } else if (read(fds[FD_SIGNAL].fd, &info, sizeof(info)) == sizeof(info)) {
+                if (info.ssi_signo == SIGUSR1) {
+                    write_metrics(rx, fd, replay == NULL);
+                } else {
+                    printf("Got signal %u\n", info.ssi_signo);
+                    stop = TRUE;
+                }
+            }
+        }
+        if (atomic_load_explicit(&g_metrics_requests, memory_order_relaxed) !=
+                rx->metrics_requests) {
+            rx->metrics_requests = atomic_load(&g_metrics_requests);
+            write_metrics(rx, fd, replay == NULL);
+        }
+        if (fds[FD_DURATION].revents & POLLIN) {
+            timer_expired(fds[FD_DURATION].fd);
+            stop = TRUE;
+        }
+        if (fds[FD_CONFIG].revents & POLLIN) {
+            timer_expired(fds[FD_CONFIG].fd);
+            configure(fd, fds[FD_CONFIG].fd);
+        }
+        if (fds[FD_BATCH].revents & POLLIN) {
+            timer_expired(fds[FD_BATCH].fd);
+            input_wanted = TRUE;
+        }
+        if (fds[FD_PHASE].revents & POLLIN) {
+            timer_expired(fds[FD_PHASE].fd);
+            if (phase + 1 == g_schedule->n) {
+                printf("End of the schedule\n");
+                stop = TRUE;
+            } else if (g_config != NULL) {
+                timer_set(fds[FD_PHASE].fd, PHASE_RETRY_MS * 1000000ULL, 0);
+            } else {
+                phase++;
+                start_phase(rx, phase, fd, fds[FD_CONFIG].fd);
+                timer_set(fds[FD_PHASE].fd, g_schedule->phases[phase].seconds * 1000000000ULL, 0);
+            }
+        }
+        if (fds[FD_INPUT].revents & (POLLIN | POLLERR | POLLHUP)) {
+            int n = read_input(fd, ring, message, pipeline, replay, capture);
+            if (n < 0) {
+                stop = TRUE;
+            } else if (n == 0 && replay != NULL) {
+                /* End of the capture */
+                stop = TRUE;
+            } else if (n == 0 && (fds[FD_INPUT].revents & (POLLERR | POLLHUP))) {
+                printf("Lost the receiver\n");
+                stop = TRUE;
+            } else if (batch_ms > 0 && replay == NULL) {
+                /* Let the input gather for a while */
+                input_wanted = FALSE;
+                timer_set(fds[FD_BATCH].fd, batch_ms * 1000000ULL, 0);
+            }
+            /* Answers make room in the window */
+            configure(fd, fds[FD_CONFIG].fd);
+        }
+        if (number_of_fixes > 0 &&
+                atomic_load_explicit(g_fix_count, memory_order_relaxed) >= (uint64_t)number_of_fixes) {
+            stop = TRUE;
+        }
+        if (g_pipeline == NULL) {
+            log_writer_tick(g_log_writer);
+        }
+    }
+
+    threaded = (g_pipeline != NULL);
+    if (threaded) {
+        pipeline_stop(pipeline);
+    }
+    /* The summary in one piece, run_receiver() unlocks after the log
+     * is closed. Not before the writer is done, it prints too. */
+    flockfile(stdout);
+    if (g_stop_fd >= 0) {
+        printf("Receiver %d, %s\n", rx->index, rx->device);
+    }
+    if (threaded) {
+        pipeline_report(pipeline);
+    }
+    if (g_config != NULL) {
+        /* Stopped before the configuration was done */
+        config_report(g_config, stdout);
+        g_config = NULL;
+    }
+    for (i = 0; i < FD_INPUT; i++) {
+        if (fds[i].fd >= 0 && fds[i].fd != g_stop_fd) {
+            close(fds[i].fd);
+        }
+    }
+    print_parser_stats(stdout, &(message->stats));
+    write_metrics(rx, fd, replay == NULL);
+    g_metrics = NULL;
+    stats_print(&(rx->stats), stdout);
+    log_stats(&(rx->stats));
+}
+
+/* --------------------------------------------------------------------*/
+/* Parser benchmark
+ *
+ * Synthetic streams are built in memory and copied into the ring in
+ * INPUT_BUFFER_SIZE chunks, the way read() fills it in
+ * communcation_loop(), and parsed after each chunk.
+ * The log goes to /dev/null, so the numbers include the cost of
+ * formatting the log but not of the disk.
+ */
+
+#define BENCH_STREAM_SIZE (8*1024*1024)
+#define BENCH_MIN_TIME_NS (500000000ULL)
+/* 921600 baud, 8N1 */
+#define BENCH_LINK_BYTES_PER_SECOND (92160.0)
+
+typedef struct Bench_Stream {
+    uint8_t* data;
+    size_t n;
+    size_t size;
+} Bench_Stream;
+
+static uint32_t g_bench_seed = 0x12345678U;
+
+/* xorshift32, deterministic so runs can be compared */
+static uint32_t bench_random(void)
+{
+    uint32_t x = g_bench_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_bench_seed = x;
+    return x;
+}
+
+static void bench_append(Bench_Stream* s, const void* data, size_t n)
+{
+    if (s->n + n <= s->size) {
+        memcpy(&(s->data[s->n]), data, n);
+        s->n += n;
+    }
+}
+
+static void bench_append_nmea(Bench_Stream* s, const char* body)
+{
+    char sentence[128];
+    uint8_t checksum = 0;
+    const char* p;
+
+    for (p = body; *p != 0; p++) {
+        checksum ^= (uint8_t)(*p);
+    }
+    snprintf(sentence, sizeof(sentence), "$%s*%02X\r\n", body, checksum);
+    bench_append(s, sentence, strlen(sentence));
+}
+
+static void bench_append_ubx(Bench_Stream* s, uint8_t class, uint8_t id, uint16_t length)
+{
+    uint8_t body[MAX_UBX_DATA_LENGTH];
+    uint8_t frame[MAX_UBX_FRAME_LENGTH];
+    uint16_t i;
+
+    assert(length <= MAX_UBX_DATA_LENGTH);
+    for (i = 0; i < length; i++) {
+        body[i] = (uint8_t)bench_random();
+    }
+    bench_append(s, frame, config_frame(frame, class, id, body, length));
+}
+
+/* One epoch as the receiver sends it with all NMEA output enabled */
+static void bench_nmea_epoch(Bench_Stream* s)
+{
+    bench_append_nmea(s, "GPRMC,083559.00,A,4717.11437,N,00833.91522,E,0.004,77.52,091202,,,A");
+    bench_append_nmea(s, "GPVTG,77.52,T,,M,0.004,N,0.008,K,A");
+    bench_append_nmea(s, "GPGGA,092725.00,4717.11399,N,00833.91590,E,1,08,1.01,499.6,M,48.0,M,,");
+    bench_append_nmea(s, "GPGSA,A,3,23,29,07,08,09,18,26,28,,,,,1.94,1.18,1.54");
+    bench_append_nmea(s, "GPGSV,3,1,10,23,38,230,44,29,71,156,47,07,29,116,41,08,09,081,36");
+    bench_append_nmea(s, "GPGSV,3,2,10,10,07,189,,05,05,220,,09,34,274,42,18,25,309,44");
+    bench_append_nmea(s, "GPGSV,3,3,10,26,82,187,47,28,43,056,46");
+    bench_append_nmea(s, "GPGLL,4717.11364,N,00833.91565,E,092321.00,A,A");
+}
+
+/* One epoch of binary navigation output (NAV-PVT, NAV-DOP, NAV-SOL) */
+static void bench_ubx_epoch(Bench_Stream* s)
+{
+    bench_append_ubx(s, 0x01, 0x07, 92);
+    bench_append_ubx(s, 0x01, 0x04, 18);
+    bench_append_ubx(s, 0x01, 0x06, 52);
+}
+
+static void bench_fill(Bench_Stream* s, int with_nmea, int with_ubx)
+{
+    while (s->n + 1024 < s->size) {
+        if (with_nmea) {
+            bench_nmea_epoch(s);
+        }
+        if (with_ubx) {
+            bench_ubx_epoch(s);
+        }
+    }
+}
+
+/* Flip, drop and insert bytes at random, about one error every
+ * mask + 1 bytes (mask is 2^n - 1) */
+static void bench_corrupt(Bench_Stream* s, uint32_t mask)
+{
+    size_t i;
+    size_t j = 0;
+    for (i = 0; i < s->n; i++) {
+        uint32_t r = bench_random();
+        if ((r & mask) == 0) {
+            switch ((r >> 11) & 0x3) {
+                case 0:
+                    /* dropped byte */
+                    break;
+                case 1:
+                    /* inserted garbage */
+                    s->data[j++] = (uint8_t)(r >> 16);
+                    if (j <= i) {
+                        s->data[j++] = s->data[i];
+                    }
+                    break;
+                default:
+                    /* bit error */
+                    s->data[j++] = s->data[i] ^ (uint8_t)(1U << ((r >> 16) & 0x7));
+                    break;
+            }
+        } else {
+            s->data[j++] = s->data[i];
+        }
+    }
+    s->n = j;
+}
+
+static void bench_run_once(const char* name, Bench_Stream* s)
+{
+    static Ring ring;
+    static Message message;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t bytes = 0;
+    uint64_t frames = 0;
+    double mb_per_second;
+    double frames_per_second;
+
+    ring_init(&ring);
+    init_parser(&message, &ring);
+    start = monotonic_ns();
+    do {
+        size_t i;
+        for (i = 0; i < s->n; i += INPUT_BUFFER_SIZE) {
+            size_t n = s->n - i;
+            if (n > INPUT_BUFFER_SIZE) {
+                n = INPUT_BUFFER_SIZE;
+            }
+            ring_write(&ring, &(s->data[i]), n);
+            if (g_metrics != NULL) {
+                metrics_read(g_metrics, n, monotonic_ns());
+            }
+            frames += parse(&ring, &message);
+        }
+        bytes += s->n;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < BENCH_MIN_TIME_NS);
+
+    mb_per_second = ((double)bytes / 1.0e6) / ((double)elapsed / 1.0e9);
+    frames_per_second = (double)frames / ((double)elapsed / 1.0e9);
+    printf("%-26s %8.1f MB/s %10.0f msg/s %8.1f ns/msg  %6.0fx 921600 baud\n",
+            name, mb_per_second, frames_per_second,
+            frames > 0 ? (double)elapsed / (double)frames : 0.0,
+            (mb_per_second * 1.0e6) / BENCH_LINK_BYTES_PER_SECOND);
+    if (message.stats.bytes_skipped > 0) {
+        Parser_Stats* stats = &(message.stats);
+        printf("%-26s checksum errors nmea %llu ubx %llu, other errors %llu, "
+                "%.2f%% of the bytes skipped\n", "",
+                (unsigned long long)stats->errors[ERR_NMEA_CHECKSUM],
+                (unsigned long long)stats->errors[ERR_UBX_CHECKSUM],
+                (unsigned long long)(stats->errors[ERR_INTERRUPTED] +
+                    stats->errors[ERR_SYNC] + stats->errors[ERR_TOO_LONG]),
+                100.0 * (double)stats->bytes_skipped / (double)bytes);
+    }
+}
+
+/* The NMEA field decoder on its own, without framing and logging */
+static void bench_nmea_decoder(void)
+{
+    static const char* sentences[] = {
+        "$GPRMC,083559.00,A,4717.11437,N,00833.91522,E,0.004,77.52,091202,,,A*57\r\n",
+        "$GPVTG,77.52,T,,M,0.004,N,0.008,K,A*06\r\n",
+        "$GPGGA,083559.00,4717.11399,N,00833.91590,E,1,08,1.01,499.6,M,48.0,M,,*5B\r\n",
+        "$GPGSA,A,3,23,29,07,08,09,18,26,28,,,,,1.94,1.18,1.54*0D\r\n",
+        "$GPGSV,3,1,10,23,38,230,44,29,71,156,47,07,29,116,41,08,09,081,36*7F\r\n",
+        "$GPGLL,4717.11364,N,00833.91565,E,083559.00,A,A*60\r\n",
+    };
+    int lengths[6];
+    NMEA_Decoder decoder;
+    GNSS_Fix fix;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t count = 0;
+    uint64_t fixes = 0;
+    int i;
+
+    for (i = 0; i < 6; i++) {
+        lengths[i] = strlen(sentences[i]);
+    }
+    nmea_init(&decoder);
+    start = monotonic_ns();
+    do {
+        int k;
+        for (k = 0; k < 10000; k++) {
+            for (i = 0; i < 6; i++) {
+                fixes += (nmea_decode(&decoder, sentences[i], lengths[i], &fix) & NMEA_FIX);
+            }
+        }
+        count += 6 * 10000;
+        elapsed = monotonic_ns() - start;
+    } while (elapsed < BENCH_MIN_TIME_NS);
+
+    printf("%-26s %8.1f ns/sentence %10.0f fix/s (lat %d lon %d alt %d mm)\n",
+            "nmea decoder", (double)elapsed / (double)count,
+            (double)fixes / ((double)elapsed / 1.0e9),
+            fix.lat, fix.lon, fix.altitude);
+}
+
+/* With the text and with the binary log, with the binary log and the
+ * metrics, and with the binary log without the bulk scan of parse() */
+static void bench_run(const char* name, Bench_Stream* s)
+{
+    static Metrics metrics;
+    char label[32];
+
+    g_binary_log = FALSE;
+    snprintf(label, sizeof(label), "%s/text", name);
+    bench_run_once(label, s);
+    g_binary_log = TRUE;
+    snprintf(label, sizeof(label), "%s/bin", name);
+    bench_run_once(label, s);
+    metrics_init(&metrics, monotonic_ns());
+    g_metrics = &metrics;
+    snprintf(label, sizeof(label), "%s/bin/metrics", name);
+    bench_run_once(label, s);
+    g_metrics = NULL;
+    g_bulk_scan = FALSE;
+    snprintf(label, sizeof(label), "%s/bin/bytewise", name);
+    bench_run_once(label, s);
+    g_bulk_scan = TRUE;
+    g_binary_log = FALSE;
+}
+
+int run_benchmark(void)
+{
+    Bench_Stream s;
+    int result = EXIT_FAILURE;
+
+    s.size = BENCH_STREAM_SIZE;
+    s.data = malloc(s.size);
+    g_log_file = fopen("/dev/null", "w");
+    if (s.data == NULL) {
+        perror("malloc");
+    } else if (g_log_file == NULL) {
+        perror("/dev/null");
+    } else {
+        g_verbose = FALSE;
+
+        s.n = 0;
+        bench_fill(&s, TRUE, FALSE);
+        bench_run("nmea", &s);
+
+        s.n = 0;
+        bench_fill(&s, FALSE, TRUE);
+        bench_run("ubx", &s);
+
+        s.n = 0;
+        bench_fill(&s, TRUE, TRUE);
+        bench_run("mixed", &s);
+
+        bench_corrupt(&s, 0x7FF);
+        bench_run("corrupted", &s);
+
+        s.n = 0;
+        bench_fill(&s, TRUE, TRUE);
+        bench_corrupt(&s, 0x3F);
+        bench_run("corrupted-64", &s);
+
+        bench_nmea_decoder();
+
+        g_verbose = TRUE;
+        fclose(g_log_file);
+        g_log_file = NULL;
+        result = EXIT_SUCCESS;
+    }
+    free(s.data);
+
+    return result;
+}
+
+int get_index(void)
+{
+    FILE* f;
+    int next_index = 0;
+    int index = 0;
+
+    f = fopen("current_index.txt", "r");
+    if (f == NULL) {
+        next_index = 1;
+    } else {
+        int n = 0;
+        n = fscanf(f, "%d", &index);
+        assert(n > 0);
+        next_index = index + 1;
+        fclose(f);
+    }
+
+    f = fopen("current_index.txt", "w");
+    assert(f != NULL);
+    fprintf(f, "%d", next_index);
+    fclose(f);
+
+    return index;
+}
+
+/* The log of receiver number receiver: log_name, or when that is NULL
+ * experiment_NNNNN.txt (.bin for a binary log) with NNNNN index. With
+ * several receivers the number of the receiver is added. */
+void log_file_name(char* name, size_t size, const char* log_name, int index,
+        int receiver, int receivers)
+{
+    const char* extension = g_binary_log ? "bin" : "txt";
+
+    if (log_name != NULL && receivers == 1) {
+        snprintf(name, size, "%s", log_name);
+    } else if (log_name != NULL) {
+        snprintf(name, size, "%s.%d", log_name, receiver);
+    } else if (receivers == 1) {
+        snprintf(name, size, "./experiment_%05d.%s", index, extension);
+    } else {
+        snprintf(name, size, "./experiment_%05d_%d.%s", index, receiver, extension);
+    }
+}
+
+/* At most window_seconds or window_bytes of the log are lost when the
+ * power fails. The time index gets a mark every mark_seconds. */
+int create_log_file(const char* name, int window_seconds, size_t window_bytes, int mark_seconds)
+{
+    int ok = 0;
+
+    g_log_writer = log_writer_open(name, window_seconds * 1000000000ULL, window_bytes,
+            mark_seconds * 1000000000ULL);
+    if (g_log_writer) {
+        g_log_file = g_log_writer->file;
+        ok = 1;
+    }
+
+    return ok;
+}
+
+int open_replay(char* replay_name)
+{
+    int fd;
+
+    fd = open(replay_name, O_RDONLY);
+    if (fd < 0) {
+        perror(replay_name);
+    }
+
+    return fd;
+}
+
+int open_gnss(
+        const char* device,
+        speed_t baudrate,
+        struct termios* oldtio,
+        struct termios* newtio)
+{
+    int fd;
+
+    /* Non-blocking, communcation_loop() waits in poll() */
+    fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK );
+    if (fd < 0) {
+        perror(device);
+    } else {
+        tcgetattr(fd, oldtio); /* save current port settings */
+
+        bzero(newtio, sizeof(struct termios));
+        /* CS8 - 8 bit characters
+         * CLOCAL - Ignore modem control lines
+         * CREAD -  Enable receiver
+         */
+        newtio->c_cflag = baudrate | CS8 | CLOCAL | CREAD;
+        newtio->c_iflag = IGNPAR;
+        newtio->c_oflag = 0;
+
+        /* set input mode (non-canonical, no echo,...) */
+        newtio->c_lflag = 0;
+        newtio->c_cc[VTIME] = 0;   /* inter-character timer unused */
+        newtio->c_cc[VMIN]  = 1;   /* unused, the port is non-blocking */
+
+        tcflush(fd, TCIFLUSH);
+        tcsetattr(fd, TCSANOW, newtio);
+    }
+
+    return fd;
+}
+
+void usage(void)
+{
+    printf( "mon:  gnss monitor\n" );
+    printf( "Usage:\n");
+    printf( "./mon [-f] [-b] [-T] [-p|-s] [-d] [-S] [-P] [-n NUM] [-t SECONDS] [-l MS] [-k NUM]\n" );
+    printf( "      [-L BAUD] [-D DEVICE]... [-M FILE] [-N [ADDRESS:]PORT] [-r FILE] [-o FILE]\n" );
+    printf( "      [-c FILE] [-e FILE]" );
+    printf( " [-w SECONDS] [-W BYTES] [-i SECONDS] [-C] [-V]\n" );
+    printf( "./mon -B\n" );
+    printf( "\n");
+    printf( "-n NUM  -- stop after NUM fixes.\n" );
+    printf( "-t SEC  -- stop after SEC seconds.\n" );
+    printf( "-l MS   -- read the receiver at most every MS milliseconds.\n" );
+    printf( "-k NUM  -- configuration messages waiting for an answer at a time (4).\n" );
+    printf( "-f      -- immediately flush a message to the logfile.\n" );
+    printf( "-b      -- write a binary log, see logtool to decode it.\n" );
+    printf( "-x      -- navigation rate 5Hz.\n" );
+    printf( "-z      -- navigation rate 0.2Hz.\n" );
+    printf( "-p      -- binary navigation: NAV-PVT and NAV-DOP instead of NMEA.\n" );
+    printf( "-s      -- as -p, plus NAV-SAT.\n" );
+    printf( "-d      -- only send the settings the receiver does not have yet.\n" );
+    printf( "-S      -- store changed settings in the receiver (CFG-CFG).\n" );
+    printf( "-L BAUD -- use the UART (%s), switched to BAUD.\n", UART_DEVICE );
+    printf( "-D DEV  -- monitor the receiver on DEV, repeat for more receivers.\n" );
+    printf( "-M FILE -- write the fixes of all receivers, merged by epoch, as CSV.\n" );
+    printf( "-N PORT -- stream the input to TCP clients on PORT (localhost, or ADDRESS:PORT),\n" );
+    printf( "           PORT+1 for the second receiver and so on.\n" );
+    printf( "-C      -- also write the fixes in columns, to the log name plus %s.\n",
+            COLUMNS_SUFFIX );
+    printf( "-V      -- also write the satellites in view, to the log name plus %s;\n",
+            SATELLITES_SUFFIX );
+    printf( "           keeps GSV on at 5Hz.\n" );
+    printf( "-P      -- publish the latest fix in shared memory (%s), see fixreader.\n",
+            SHM_FIX_NAME );
+    printf( "-r FILE -- replay a recorded capture instead of reading the receiver.\n" );
+    printf( "-o FILE -- log to FILE instead of the next experiment_NNNNN.txt.\n" );
+    printf( "-c FILE -- record the raw byte stream to the capture FILE.\n" );
+    printf( "-w SEC  -- lose at most SEC seconds of log on a crash, 0 is no limit (10).\n" );
+    printf( "-W NUM  -- lose at most NUM bytes of log on a crash, 0 is no limit (0).\n" );
+    printf( "-i SEC  -- mark the time index of the log every SEC seconds, 0 for none (%d).\n",
+            LOG_MARK_SECONDS );
+    printf( "-e FILE -- run the phases of the schedule FILE, with their own rates, then stop.\n" );
+    printf( "-T      -- read and log on separate threads.\n" );
+    printf( "-B      -- benchmark the parser and exit.\n" );
+}
+
+/* How to run, the same for every receiver */
+typedef struct Run_Options {
+    int number_of_samples;
+    int duration_seconds;
+    int batch_ms;
+    int config_window;
+    int config_diff;
+    int config_save;
+    uint32_t link_baud;
+    int rate;
+    int nav_mode;
+    int window_seconds;
+    size_t window_bytes;
+    int mark_seconds;
+    char* replay_name;      /* Only with a single receiver */
+    char* capture_name;
+} Run_Options;
+
+/* Open, configure and log the receiver until the run is over. Returns
+ * EXIT_SUCCESS or EXIT_FAILURE. */
+int run_receiver(Receiver* rx, const Run_Options* run)
 {
     int fd;
     struct termios oldtio, newtio;
+    int result = EXIT_FAILURE;
+    Config_Engine* config = &(rx->config);
+    Capture_Reader replay;
+    Capture_Writer* capture = NULL;
+
+    config_init(config, run->config_window);
+    config->diff = run->config_diff;
+    config->save = run->config_save;
+    config->port = (run->link_baud != 0) ? UART_PORT : GNSS_PORT;
+    if (run->replay_name == NULL) {
+        queue_messages(config, run->rate, run->nav_mode, run->link_baud != 0);
+        fd = open_gnss(rx->device, (run->link_baud != 0) ? UART_BAUDRATE : BAUDRATE,
+                &oldtio, &newtio);
+    } else {
+        fd = open_replay(run->replay_name);
+    }
+    if (fd >= 0) {
+        if (run->capture_name != NULL) {
+            capture = capture_open(run->capture_name);
+        }
+        if (run->capture_name != NULL && capture == NULL) {
+            /* Already reported */
+        } else if (run->replay_name != NULL && !capture_open_reader(&replay, fd)) {
+            /* Already reported */
+        } else if (run->link_baud != 0 && link_setup(fd, UART_PORT, run->link_baud) == 0) {
+            /* Already reported */
+        } else {
+            int ok;
+            ok = create_log_file(rx->log_name, run->window_seconds, run->window_bytes,
+                    run->mark_seconds);
+            if (ok && g_write_columns) {
+                char name[sizeof(rx->log_name) + sizeof(COLUMNS_SUFFIX)];
+                snprintf(name, sizeof(name), "%s%s", rx->log_name, COLUMNS_SUFFIX);
+                /* Without it if it fails, the log matters more */
+                g_columns = column_writer_open(name);
+            }
+            if (ok && g_write_satellites) {
+                char name[sizeof(rx->log_name) + sizeof(SATELLITES_SUFFIX)];
+                snprintf(name, sizeof(name), "%s%s", rx->log_name, SATELLITES_SUFFIX);
+                g_satellites = sat_writer_open(name);
+            }
+            if (ok) {
+                if (g_binary_log) {
+                    binlog_write_header(g_log_file, rate_string[run->rate], MON_VERSION);
+                } else {
+                    fprintf(g_log_file, "mon: rate %s version: %s\n", rate_string[run->rate], MON_VERSION);
+                }
+                communcation_loop(rx, fd, run->number_of_samples, run->duration_seconds,
+                        run->batch_ms,
+                        (run->replay_name == NULL) ? config : NULL,
+                        (run->replay_name != NULL) ? &replay : NULL, capture);
+                if (g_columns != NULL) {
+                    ok = column_writer_close(g_columns);
+                    g_columns = NULL;
+                }
+                if (g_satellites != NULL) {
+                    ok = sat_writer_close(g_satellites) && ok;
+                    g_satellites = NULL;
+                }
+                // Flush any unsaved logging to disk
+                fflush(g_log_file);
+                if (fclose(g_log_file) == 0 && ok) {
+                    result = EXIT_SUCCESS;
+                }
+                g_log_file = NULL;
+                g_log_writer = NULL;
+                printf("Stopped\n");
+                funlockfile(stdout);
+            }
+        }
+        if (capture != NULL) {
+            printf("Captured %llu bytes in %llu reads\n",
+                    (unsigned long long)capture->bytes,
+                    (unsigned long long)capture->records);
+            if (!capture_close(capture)) {
+                result = EXIT_FAILURE;
+            }
+        }
+        if (run->replay_name == NULL) {
+            /* Restore old terminal settings */
+            tcsetattr(fd, TCSANOW, &oldtio);
+        }
+        close(fd);
+    }
+
+    return result;
+}
+
+typedef struct Receiver_Thread_Args {
+    Receiver* rx;
+    const Run_Options* run;
+} Receiver_Thread_Args;
+
+static void* receiver_thread(void* arg)
+{
+    Receiver_Thread_Args* args = arg;
+    Receiver* rx = args->rx;
+
+    rx->result = run_receiver(rx, args->run);
+    return NULL;
+}
+
+/* Run every receiver on a thread of its own, each pinned to a core,
+ * until all are done or SIGINT/SIGTERM, which stops them all. */
+int run_receivers(Receiver* receivers, int n, const Run_Options* run)
+{
+    static Receiver_Thread_Args args[MAX_RECEIVERS];
+    int joined[MAX_RECEIVERS];
+    struct pollfd fds[1];
+    sigset_t signals;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t one = 1;
+    int result = EXIT_SUCCESS;
+    int started = 0;
+    int i;
+
+    handled_signals(&signals);
+    fds[0].fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    fds[0].events = POLLIN;
+    g_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fds[0].fd < 0 || g_stop_fd < 0) {
+        perror("signalfd/eventfd");
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < n; i++) {
+        int error;
+        args[i].rx = &(receivers[i]);
+        args[i].run = run;
+        error = pthread_create(&(receivers[i].thread), NULL, receiver_thread, &(args[i]));
+        if (error != 0) {
+            errno = error;
+            perror("pthread_create");
+            result = EXIT_FAILURE;
+            break;
+        }
+        if (cores > 1) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cores, &cpus);
+            pthread_setaffinity_np(receivers[i].thread, sizeof(cpus), &cpus);
+        }
+        joined[i] = FALSE;
+        started++;
+    }
+
+    /* Wait for a signal, or until every receiver is done */
+    for (;;) {
+        struct signalfd_siginfo info;
+        int running = 0;
+
+        for (i = 0; i < started; i++) {
+            if (!joined[i] && pthread_tryjoin_np(receivers[i].thread, NULL) == 0) {
+                joined[i] = TRUE;
+            }
+            if (!joined[i]) {
+                running++;
+            }
+        }
+        if (running == 0 || started < n) {
+            break;
+        }
+        if (poll(fds, 1, HOUSEKEEPING_MS) > 0 &&
+                read(fds[0].fd, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo == SIGUSR1) {
+                /* Picked up by the receivers */
+                atomic_fetch_add(&g_metrics_requests, 1);
+                continue;
+            }
+            printf("Got signal %u\n", info.ssi_signo);
+            break;
+        }
+    }
+
+    if (write(g_stop_fd, &one, sizeof(one)) != sizeof(one)) {
+        perror("eventfd");
+    }
+    for (i = 0; i < started; i++) {
+        if (!joined[i]) {
+            pthread_join(receivers[i].thread, NULL);
+        }
+        if (receivers[i].result != EXIT_SUCCESS) {
+            result = EXIT_FAILURE;
+        }
+    }
+    close(fds[0].fd);
+    close(g_stop_fd);
+    g_stop_fd = -1;
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    static Receiver receivers[MAX_RECEIVERS];
+    const char* devices[MAX_RECEIVERS];
+    int number_of_devices = 0;
+    Run_Options run;
     int opt;
     int do_flush = 0;
-    int number_of_samples = 0;
     int result = EXIT_FAILURE;
-    int rate = RATE_NORMAL;
-
-    while ((opt = getopt(argc,argv, "n:hfxz" )) != -1) {
+    int do_benchmark = 0;
+    int do_publish = 0;
+    char* log_name = NULL;
+    char* merge_name = NULL;
+    char* server_address = NULL;
+    char* schedule_name = NULL;
+    static Schedule schedule;
+
+    memset(&run, 0, sizeof(run));
+    run.window_seconds = LOG_WINDOW_SECONDS;
+    run.mark_seconds = LOG_MARK_SECONDS;
+    run.config_window = CONFIG_WINDOW;
+    run.rate = RATE_NORMAL;
+    run.nav_mode = NAV_MODE_NMEA;
+
+    while ((opt = getopt(argc,argv, "n:t:l:k:L:D:M:N:hfbxzpsdSPCVr:o:c:e:w:W:i:TB" )) != -1) {
         switch( opt ) {
             case 'n':
-                number_of_samples = atoi(optarg);
+                run.number_of_samples = atoi(optarg);
                 break;
             case 'f':
                 do_flush = 1;
                 break;
+            case 'b':
+                g_binary_log = TRUE;
+                break;
             case 'x':
-                rate = RATE_FAST;
+                run.rate = RATE_FAST;
                 break;
             case 'z':
-                rate = RATE_SLOW;
+                run.rate = RATE_SLOW;
+                break;
+            case 'p':
+                run.nav_mode = NAV_MODE_PVT;
+                break;
+            case 's':
+                run.nav_mode = NAV_MODE_PVT_SAT;
+                break;
+            case 'd':
+                run.config_diff = 1;
+                break;
+            case 'S':
+                run.config_save = 1;
+                break;
+            case 'r':
+                run.replay_name = optarg;
+                break;
+            case 'o':
+                log_name = optarg;
+                break;
+            case 'c':
+                run.capture_name = optarg;
+                break;
+            case 'e':
+                schedule_name = optarg;
+                break;
+            case 't':
+                run.duration_seconds = atoi(optarg);
+                break;
+            case 'l':
+                run.batch_ms = atoi(optarg);
+                break;
+            case 'k':
+                run.config_window = atoi(optarg);
+                break;
+            case 'L':
+                run.link_baud = (uint32_t)atol(optarg);
+                break;
+            case 'D':
+                if (number_of_devices < MAX_RECEIVERS) {
+                    devices[number_of_devices++] = optarg;
+                } else {
+                    printf("At most %d receivers\n", MAX_RECEIVERS);
+                }
+                break;
+            case 'M':
+                merge_name = optarg;
+                break;
+            case 'P':
+                do_publish = 1;
+                break;
+            case 'C':
+                g_write_columns = TRUE;
+                break;
+            case 'V':
+                g_write_satellites = TRUE;
+                break;
+            case 'N':
+                server_address = optarg;
+                break;
+            case 'w':
+                run.window_seconds = atoi(optarg);
+                break;
+            case 'W':
+                run.window_bytes = (size_t)atol(optarg);
+                break;
+            case 'i':
+                run.mark_seconds = atoi(optarg);
+                break;
+            case 'T':
+                g_threads = TRUE;
+                break;
+            case 'B':
+                do_benchmark = 1;
                 break;
             case 'h':
                 usage();
@@ -704,41 +2629,87 @@ int main(int argc, char** argv)
                 printf( "unknown option %c\n", opt );
         }
     }
+    if (number_of_devices == 0) {
+        devices[number_of_devices++] = (run.link_baud != 0) ? UART_DEVICE : MODEMDEVICE;
+    }
 
-    if (number_of_samples == 0) {
+    if (do_benchmark) {
+        result = run_benchmark();
+    } else if (run.link_baud != 0 && !link_supported(run.link_baud)) {
+        printf("-L %u is not supported, use 9600, 38400, 115200, 230400, 460800 or 921600\n",
+                run.link_baud);
+    } else if (schedule_name != NULL && run.replay_name != NULL) {
+        printf("-e does not work with -r, a replay has no receiver to switch\n");
+    } else if (schedule_name != NULL && !schedule_read(schedule_name, &schedule)) {
+        /* Already reported */
+    } else if (run.number_of_samples == 0 && run.duration_seconds == 0 && run.replay_name == NULL &&
+            schedule_name == NULL) {
         /* Nothing to do */
+    } else if (number_of_devices > 1 && (run.replay_name != NULL || run.capture_name != NULL)) {
+        printf("-r and -c work with a single receiver only\n");
     } else {
-        UBX_Message_Stack ubx_messages;
-
-        signal(SIGINT, signal_handler);
-        self_test();
-        init_ubx_message_stack(&ubx_messages);
-        queue_messages(&ubx_messages, rate);
-
-        fd = open_gnss(&oldtio, &newtio);
-        if (fd >= 0) {
-            char* log_buffer = malloc(LOG_BUFFER_SIZE + 10);
-            if (log_buffer == NULL) {
-                perror("malloc");
-            } else {
-                int ok;
-                ok = create_log_file(log_buffer);
-                if (ok) {
-                    fprintf(g_log_file, "mon: rate %s version: %s\n", rate_string[rate], "V0.1.0");
-                    communcation_loop(fd, number_of_samples, do_flush, &ubx_messages);
-                    // Flush any unsaved logging to disk
-                    fflush(g_log_file);
-                    fclose(g_log_file);
-                    printf("Stopped\n");
-                    result = EXIT_SUCCESS;
-                }
+        sigset_t signals;
+        int index = 0;
+        int i;
+
+        if (schedule_name != NULL) {
+            g_schedule = &schedule;
+            /* The first phase is configured at the start */
+            run.rate = schedule.phases[0].rate;
+            run.nav_mode = schedule.phases[0].nav_mode;
+        }
+
+        /* Before any thread is started, they all inherit this */
+        handled_signals(&signals);
+        sigprocmask(SIG_BLOCK, &signals, NULL);
+        if (do_flush) {
+            /* Commit every bit of the log right away */
+            run.window_bytes = 1;
+        }
+        if (log_name == NULL) {
+            index = get_index();
+        }
+        for (i = 0; i < number_of_devices; i++) {
+            receivers[i].index = i;
+            receivers[i].device = devices[i];
+            log_file_name(receivers[i].log_name, sizeof(receivers[i].log_name),
+                    log_name, index, i, number_of_devices);
+        }
+        if (merge_name != NULL) {
+            g_merge = merge_open(merge_name, number_of_devices);
+        }
+        if (do_publish) {
+            g_shm_fix = shm_fix_create(SHM_FIX_NAME, number_of_devices);
+        }
+        if (server_address != NULL) {
+            g_server = server_open(server_address, number_of_devices);
+        }
+        if (merge_name != NULL && g_merge == NULL) {
+            /* Already reported */
+        } else if (do_publish && g_shm_fix == NULL) {
+            /* Already reported */
+        } else if (server_address != NULL && g_server == NULL) {
+            /* Already reported */
+        } else if (number_of_devices == 1) {
+            result = run_receiver(&(receivers[0]), &run);
+        } else {
+            result = run_receivers(receivers, number_of_devices, &run);
+        }
+        if (g_merge != NULL) {
+            if (!merge_close(g_merge)) {
+                result = EXIT_FAILURE;
             }
-            /* Restore old terminal settings */
-            tcsetattr(fd, TCSANOW, &oldtio);
-            close(fd);
+            g_merge = NULL;
+        }
+        if (g_shm_fix != NULL) {
+            shm_fix_destroy(g_shm_fix, SHM_FIX_NAME);
+            g_shm_fix = NULL;
+        }
+        if (g_server != NULL) {
+            server_close(g_server);
+            g_server = NULL;
         }
     }
 
     return result;
 }
-
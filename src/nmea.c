@@ -0,0 +1,428 @@
+#include <string.h>
+
+#include "nmea.h"
+
+#define NMEA_MAX_FIELDS (24)
+
+typedef struct Fields {
+    int n;
+    const char* start[NMEA_MAX_FIELDS];
+    uint16_t length[NMEA_MAX_FIELDS];   /* A sentence may be longer than 255 */
+} Fields;
+
+/* Field 0 is the address, e.g. "GPGGA". Stops at the checksum. */
+static void split_fields(const char* sentence, int length, Fields* f)
+{
+    const char* p = sentence + 1;
+    const char* end = sentence + length;
+    const char* field = p;
+
+    f->n = 0;
+    for (; p < end; p++) {
+        char c = *p;
+        if (c == ',' || c == '*' || c == '\r' || c == '\n') {
+            if (f->n < NMEA_MAX_FIELDS) {
+                f->start[f->n] = field;
+                f->length[f->n] = (uint16_t)(p - field);
+                f->n++;
+            }
+            field = p + 1;
+            if (c != ',') {
+                break;
+            }
+        }
+    }
+}
+
+static int is_digit(char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+/* Unsigned integer. Returns 0 when empty, on anything else but digits,
+ * and when it does not fit in a uint32_t. */
+static int get_uint(const Fields* f, int i, uint32_t* value)
+{
+    const char* p;
+    int k;
+    uint32_t v = 0;
+
+    if (i >= f->n || f->length[i] == 0) {
+        return 0;
+    }
+    p = f->start[i];
+    for (k = 0; k < f->length[i]; k++) {
+        uint32_t digit;
+        if (!is_digit(p[k])) {
+            return 0;
+        }
+        digit = (uint32_t)(p[k] - '0');
+        if (v > (UINT32_MAX - digit) / 10U) {
+            return 0;
+        }
+        v = v * 10U + digit;
+    }
+    *value = v;
+    return 1;
+}
+
+/* Decimal number scaled by 10^decimals, e.g. "499.6" with 3 decimals
+ * gives 499600. Extra decimals are truncated. Returns 0 when the
+ * scaled number does not fit in an int32_t. */
+static int get_fixed(const Fields* f, int i, int decimals, int32_t* value)
+{
+    const char* p;
+    int k = 0;
+    int n;
+    int negative = 0;
+    int seen_digit = 0;
+    int64_t v = 0;
+
+    if (i >= f->n || f->length[i] == 0) {
+        return 0;
+    }
+    p = f->start[i];
+    n = f->length[i];
+    if (p[0] == '-') {
+        negative = 1;
+        k = 1;
+    }
+    for (; k < n && p[k] != '.'; k++) {
+        if (!is_digit(p[k])) {
+            return 0;
+        }
+        v = v * 10 + (p[k] - '0');
+        if (v > INT32_MAX) {
+            return 0;
+        }
+        seen_digit = 1;
+    }
+    if (k < n) {
+        /* Skip the '.' */
+        k++;
+    }
+    for (; decimals > 0; decimals--) {
+        v = v * 10;
+        if (k < n) {
+            if (!is_digit(p[k])) {
+                return 0;
+            }
+            v += p[k] - '0';
+            k++;
+            seen_digit = 1;
+        }
+        if (v > INT32_MAX) {
+            return 0;
+        }
+    }
+    if (!seen_digit) {
+        return 0;
+    }
+    *value = (int32_t)(negative ? -v : v);
+    return 1;
+}
+
+/* hhmmss.sss to ms since midnight */
+static int get_time(const Fields* f, int i, uint32_t* time_of_day)
+{
+    int32_t t;
+    uint32_t hhmmss;
+    uint32_t ms;
+
+    if (!get_fixed(f, i, 3, &t) || t < 0) {
+        return 0;
+    }
+    hhmmss = (uint32_t)t / 1000U;
+    ms = (uint32_t)t % 1000U;
+    *time_of_day = ((hhmmss / 10000U) * 3600U + ((hhmmss / 100U) % 100U) * 60U +
+            hhmmss % 100U) * 1000U + ms;
+    return 1;
+}
+
+/* ddmmyy */
+static int get_date(const Fields* f, int i, GNSS_Fix* fix)
+{
+    uint32_t ddmmyy;
+
+    if (i >= f->n || f->length[i] != 6 || !get_uint(f, i, &ddmmyy)) {
+        return 0;
+    }
+    fix->day = (uint8_t)(ddmmyy / 10000U);
+    fix->month = (uint8_t)((ddmmyy / 100U) % 100U);
+    fix->year = (uint16_t)(2000U + ddmmyy % 100U);
+    return 1;
+}
+
+/* (d)ddmm.mmmmm plus the hemisphere in field i + 1, to 1e-7 deg.
+ * Minutes are rounded to 7 decimals. */
+static int get_coordinate(const Fields* f, int i, int32_t* value)
+{
+    const char* p;
+    int k = 0;
+    int n;
+    int digits = 0;
+    int64_t whole = 0;      /* dddmm */
+    int64_t fraction = 0;   /* .mmmmm in units of 1e-7 minute */
+    int64_t v;
+    char hemisphere;
+
+    if (i + 1 >= f->n || f->length[i] == 0 || f->length[i + 1] != 1) {
+        return 0;
+    }
+    p = f->start[i];
+    n = f->length[i];
+    for (; k < n && p[k] != '.'; k++) {
+        if (!is_digit(p[k])) {
+            return 0;
+        }
+        whole = whole * 10 + (p[k] - '0');
+        if (whole > 18000) {
+            /* More than 180 degrees */
+            return 0;
+        }
+    }
+    for (k++; k < n && digits < 7; k++, digits++) {
+        if (!is_digit(p[k])) {
+            return 0;
+        }
+        fraction = fraction * 10 + (p[k] - '0');
+    }
+    for (; digits < 7; digits++) {
+        fraction = fraction * 10;
+    }
+    v = (whole / 100) * 10000000 + ((whole % 100) * 10000000 + fraction + 30) / 60;
+
+    hemisphere = f->start[i + 1][0];
+    if (hemisphere == 'S' || hemisphere == 'W') {
+        v = -v;
+    }
+    *value = (int32_t)v;
+    return 1;
+}
+
+/* --------------------------------------------------------------------*/
+
+static void decode_rmc(NMEA_Decoder* d, const Fields* f)
+{
+    GNSS_Fix* fix = &(d->fix);
+    int32_t v;
+
+    /* A new epoch starts with its RMC */
+    memset(fix, 0, sizeof(GNSS_Fix));
+    d->have_rmc = 0;
+    if (!get_time(f, 1, &(d->rmc_time))) {
+        return;
+    }
+    d->have_rmc = 1;
+    if (get_date(f, 9, fix)) {
+        fix->flags |= FIX_VALID_DATE;
+    }
+    get_coordinate(f, 3, &(fix->lat));
+    get_coordinate(f, 5, &(fix->lon));
+    if (get_fixed(f, 7, 3, &v)) {
+        /* knots to mm/s */
+        fix->speed = (int32_t)(((int64_t)v * 1852 + 1800) / 3600);
+    }
+    get_fixed(f, 8, 5, &(fix->course));
+}
+
+static void decode_vtg(NMEA_Decoder* d, const Fields* f)
+{
+    GNSS_Fix* fix = &(d->fix);
+    int32_t v;
+
+    get_fixed(f, 1, 5, &(fix->course));
+    if (get_fixed(f, 7, 3, &v)) {
+        /* km/h to mm/s */
+        fix->speed = (int32_t)(((int64_t)v * 1000 + 1800) / 3600);
+    }
+}
+
+static void decode_gsa(NMEA_Decoder* d, const Fields* f)
+{
+    uint32_t mode;
+    int32_t v;
+
+    if (get_uint(f, 2, &mode) && mode >= 1 && mode <= 3) {
+        d->gsa_fix_type = (mode == 1) ? FIX_TYPE_NONE : (uint8_t)mode;
+    }
+    d->pdop = get_fixed(f, 15, 2, &v) ? (uint16_t)v : 0;
+    d->vdop = get_fixed(f, 17, 2, &v) ? (uint16_t)v : 0;
+}
+
+/* gnss of a talker, GNSS_UNKNOWN for GN and others */
+static uint8_t talker_gnss(const char* talker)
+{
+    if (talker[0] == 'G') {
+        switch (talker[1]) {
+            case 'P':
+                return GNSS_GPS;
+            case 'L':
+                return GNSS_GLONASS;
+            case 'A':
+                return GNSS_GALILEO;
+            case 'B':
+                return GNSS_BEIDOU;
+            case 'Q':
+                return GNSS_QZSS;
+            default:
+                break;
+        }
+    } else if (talker[0] == 'B' && talker[1] == 'D') {
+        return GNSS_BEIDOU;
+    }
+    return GNSS_UNKNOWN;
+}
+
+/* Hand the gathered satellites out */
+static void finish_gsv(NMEA_Decoder* d)
+{
+    d->satellites = d->gsv;
+    d->gsv.n = 0;
+    d->gsv_talkers = 0;
+    d->gsv_open = 0;
+}
+
+/* Up to four satellites of svid, elevation, azimuth and C/N0 each,
+ * starting at field 4. NMEA 4.10 adds a signal id at the end. */
+static int decode_gsv(NMEA_Decoder* d, const Fields* f)
+{
+    uint8_t gnss = talker_gnss(f->start[0]);
+    uint16_t talker = (uint16_t)(1U << gnss);
+    uint32_t number = 0;
+    uint32_t n;
+    int done = 0;
+    int i;
+
+    if (get_uint(f, 3, &n)) {
+        d->num_sv_view = (uint8_t)n;
+    }
+    if (get_uint(f, 2, &number) && number == 1 && (d->gsv_talkers & talker)) {
+        /* The next epoch */
+        finish_gsv(d);
+        done = NMEA_SATELLITES;
+    }
+    for (i = 4; i + 3 < f->n; i += 4) {
+        uint32_t svid;
+        uint32_t azimuth;
+        uint32_t cno = 0;
+        int32_t elevation;
+        if (!get_uint(f, i, &svid) || svid > 255) {
+            continue;
+        }
+        if (!get_fixed(f, i + 1, 0, &elevation) || elevation < -90 || elevation > 90) {
+            elevation = ELEVATION_UNKNOWN;
+        }
+        if (!get_uint(f, i + 2, &azimuth) || azimuth > 359) {
+            azimuth = AZIMUTH_UNKNOWN;
+        }
+        get_uint(f, i + 3, &cno);
+        sat_epoch_add(&(d->gsv), gnss, (uint8_t)svid, (int8_t)elevation,
+                (uint8_t)((cno < 255) ? cno : 255), (uint16_t)azimuth);
+    }
+    d->gsv_talkers |= talker;
+    d->gsv_open = 1;
+    return done;
+}
+
+static int decode_gga(NMEA_Decoder* d, const Fields* f, GNSS_Fix* result)
+{
+    GNSS_Fix* fix = &(d->fix);
+    uint32_t time_of_day;
+    uint32_t quality = 0;
+    uint32_t num_sv = 0;
+    int32_t v;
+
+    if (!get_time(f, 1, &time_of_day)) {
+        return 0;
+    }
+    if (!d->have_rmc || d->rmc_time != time_of_day) {
+        /* No RMC for this epoch, start from scratch */
+        memset(fix, 0, sizeof(GNSS_Fix));
+    }
+    fix->time_of_day = time_of_day;
+    fix->flags |= FIX_VALID_TIME;
+    get_coordinate(f, 2, &(fix->lat));
+    get_coordinate(f, 4, &(fix->lon));
+    get_uint(f, 6, &quality);
+    if (get_uint(f, 7, &num_sv)) {
+        fix->num_sv = (uint8_t)num_sv;
+    }
+    if (get_fixed(f, 8, 2, &v)) {
+        fix->hdop = (uint16_t)v;
+    }
+    get_fixed(f, 9, 3, &(fix->altitude));
+
+    switch (quality) {
+        case 0:
+            fix->fix_type = FIX_TYPE_NONE;
+            break;
+        case 6:
+            fix->fix_type = FIX_TYPE_DR;
+            break;
+        default:
+            fix->fix_type = d->gsa_fix_type ? d->gsa_fix_type : FIX_TYPE_3D;
+            fix->flags |= FIX_OK;
+            if (quality == 2) {
+                fix->flags |= FIX_DIFF;
+            }
+            break;
+    }
+    fix->pdop = d->pdop;
+    fix->vdop = d->vdop;
+    fix->num_sv_view = d->num_sv_view;
+    fix->source = FIX_SOURCE_NMEA;
+
+    *result = *fix;
+    d->have_rmc = 0;
+    return 1;
+}
+
+/* --------------------------------------------------------------------*/
+
+void nmea_init(NMEA_Decoder* d)
+{
+    memset(d, 0, sizeof(NMEA_Decoder));
+}
+
+int nmea_decode(NMEA_Decoder* d, const char* sentence, int length, GNSS_Fix* fix)
+{
+    Fields f;
+    const char* type;
+    int done = 0;
+
+    split_fields(sentence, length, &f);
+    /* Address is talker (GP, GL, GN, ...) plus the sentence type */
+    if (f.n < 2 || f.length[0] != 5) {
+        return 0;
+    }
+    type = f.start[0] + 2;
+    if (d->gsv_open && !(type[0] == 'G' && type[1] == 'S' && type[2] == 'V')) {
+        finish_gsv(d);
+        done = NMEA_SATELLITES;
+    }
+    switch (type[0]) {
+        case 'G':
+            if (type[1] == 'G' && type[2] == 'A') {
+                done |= decode_gga(d, &f, fix) ? NMEA_FIX : 0;
+            } else if (type[1] == 'S' && type[2] == 'A') {
+                decode_gsa(d, &f);
+            } else if (type[1] == 'S' && type[2] == 'V') {
+                done |= decode_gsv(d, &f);
+            }
+            break;
+        case 'R':
+            if (type[1] == 'M' && type[2] == 'C') {
+                decode_rmc(d, &f);
+            }
+            break;
+        case 'V':
+            if (type[1] == 'T' && type[2] == 'G') {
+                decode_vtg(d, &f);
+            }
+            break;
+        default:
+            break;
+    }
+    return done;
+}
@@ -0,0 +1,49 @@
+#ifndef NMEA_H
+#define NMEA_H
+
+#include <stdint.h>
+
+#include "fix.h"
+#include "satellites.h"
+
+/* Field decoder for the NMEA sentences of a position epoch.
+ *
+ * RMC, VTG, GGA, GSA and GSV are decoded with integer arithmetic into
+ * a GNSS_Fix, no floating point, no allocation.  The receiver sends
+ * RMC, VTG, GGA, GSA, GSV, GLL in that order, so a fix is complete at
+ * the GGA; it takes the RMC and VTG of the same epoch and the DOPs
+ * and satellite count of the latest GSA and GSV.
+ *
+ * The GSV sentences of all talkers of an epoch are gathered into one
+ * set of satellites. The set is complete at the first other sentence
+ * after them, or when the first GSV of a talker that is in it already
+ * comes again.
+ */
+
+/* What nmea_decode() completed */
+#define NMEA_FIX        (0x01)
+#define NMEA_SATELLITES (0x02)
+
+typedef struct NMEA_Decoder {
+    GNSS_Fix fix;           /* Epoch being assembled */
+    uint32_t rmc_time;      /* time_of_day of the RMC in fix */
+    uint8_t  have_rmc;
+    uint8_t  gsa_fix_type;  /* From the latest GSA, 0 when none */
+    uint16_t pdop;
+    uint16_t vdop;
+    uint8_t  num_sv_view;   /* From the latest GSV */
+    uint8_t  gsv_open;      /* gsv has satellites not handed out yet */
+    uint16_t gsv_talkers;   /* Bit per gnss in gsv */
+    Sat_Epoch gsv;          /* Being gathered */
+    Sat_Epoch satellites;   /* The last complete set */
+} NMEA_Decoder;
+
+void nmea_init(NMEA_Decoder* d);
+
+/* sentence runs from the '$' up to and including the "\r\n".
+ * Returns NMEA_FIX when this sentence completed a fix, which is then in
+ * fix, and NMEA_SATELLITES when it completed the satellites in view,
+ * which are then in d->satellites. */
+int nmea_decode(NMEA_Decoder* d, const char* sentence, int length, GNSS_Fix* fix);
+
+#endif /* NMEA_H */
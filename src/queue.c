@@ -0,0 +1,59 @@
+#include "queue.h"
+
+#define QUEUE_MASK (QUEUE_SIZE - 1)
+
+void queue_init(Frame_Queue* q)
+{
+    atomic_init(&(q->head), 0);
+    atomic_init(&(q->tail), 0);
+    q->high_water = 0;
+    q->dropped = 0;
+}
+
+/* Producer only. Returns 0 when the queue is full, the entry is then
+ * not added. */
+int queue_push(Frame_Queue* q, const Queue_Entry* e)
+{
+    uint64_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&(q->tail), memory_order_acquire);
+    uint64_t depth = head - tail;
+
+    if (depth == QUEUE_SIZE) {
+        return 0;
+    }
+    q->entries[head & QUEUE_MASK] = *e;
+    /* Publishes the entry, and the ring bytes it refers to */
+    atomic_store_explicit(&(q->head), head + 1, memory_order_release);
+    if (depth + 1 > q->high_water) {
+        q->high_water = depth + 1;
+    }
+    return 1;
+}
+
+/* Consumer only. Returns 0 when the queue is empty. */
+int queue_pop(Frame_Queue* q, Queue_Entry* e)
+{
+    uint64_t tail = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&(q->head), memory_order_acquire);
+
+    if (tail == head) {
+        return 0;
+    }
+    *e = q->entries[tail & QUEUE_MASK];
+    atomic_store_explicit(&(q->tail), tail + 1, memory_order_release);
+    return 1;
+}
+
+/* Consumer only */
+int queue_empty(Frame_Queue* q)
+{
+    uint64_t tail = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    return tail == atomic_load_explicit(&(q->head), memory_order_acquire);
+}
+
+/* Producer only */
+int queue_full(Frame_Queue* q)
+{
+    uint64_t head = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    return head - atomic_load_explicit(&(q->tail), memory_order_acquire) == QUEUE_SIZE;
+}
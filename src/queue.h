@@ -0,0 +1,50 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Lock-free single producer, single consumer queue of frame
+ * descriptors, from the reader thread to the writer thread.
+ *
+ * An entry does not hold the bytes of a frame, only where they are in
+ * the ring. The reader keeps those bytes until the writer reports, in
+ * released, that it is done with them.
+ */
+
+#define QUEUE_SIZE (8192) /* Power of 2 */
+
+#define QUEUE_NMEA    (1)  /* Good NMEA sentence */
+#define QUEUE_UBX     (2)  /* Good UBX message, sync chars to checksum */
+#define QUEUE_ERROR   (3)  /* Communication error, code is ERR_... */
+#define QUEUE_CAPTURE (4)  /* Chunk of raw input for the capture */
+#define QUEUE_PHASE   (5)  /* Start of a phase, code is its index */
+
+typedef struct Queue_Entry {
+    uint8_t type;
+    uint8_t code;
+    uint16_t length;    /* Bytes at start, 0 if none */
+    uint64_t start;     /* Ring offset */
+    uint64_t release;   /* Bytes before this are no longer needed once
+                           this and all earlier entries are handled */
+    uint64_t time;      /* Receive time */
+} Queue_Entry;
+
+typedef struct Frame_Queue {
+    Queue_Entry entries[QUEUE_SIZE];
+    /* head is only written by the producer, tail by the consumer, keep
+     * them on separate cache lines */
+    _Alignas(64) atomic_uint_fast64_t head;
+    _Alignas(64) atomic_uint_fast64_t tail;
+    /* Producer side statistics */
+    _Alignas(64) uint64_t high_water;
+    uint64_t dropped;   /* Entries that did not fit, kept by the caller */
+} Frame_Queue;
+
+void queue_init(Frame_Queue* q);
+int queue_push(Frame_Queue* q, const Queue_Entry* e);
+int queue_pop(Frame_Queue* q, Queue_Entry* e);
+int queue_empty(Frame_Queue* q);
+int queue_full(Frame_Queue* q);
+
+#endif /* QUEUE_H */
@@ -0,0 +1,111 @@
+#include <sys/uio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+#define RING_MASK (RING_SIZE - 1)
+
+void ring_init(Ring* r)
+{
+    r->head = 0;
+    r->tail = 0;
+}
+
+size_t ring_free(const Ring* r)
+{
+    return RING_SIZE - (size_t)(r->head - r->tail);
+}
+
+/* The free space that follows head without wrapping */
+uint8_t* ring_space(Ring* r, size_t* n)
+{
+    size_t index = (size_t)(r->head & RING_MASK);
+    size_t contiguous = RING_SIZE - index;
+    size_t free = ring_free(r);
+
+    *n = (free < contiguous) ? free : contiguous;
+    return &(r->data[index]);
+}
+
+void ring_commit(Ring* r, size_t n)
+{
+    r->head += n;
+}
+
+/* One readv() of at most max bytes into the free space, both parts
+ * when it wraps around. Returns what read() returns. */
+ssize_t ring_read(Ring* r, int fd, size_t max)
+{
+    struct iovec iov[2];
+    size_t index = (size_t)(r->head & RING_MASK);
+    size_t free = ring_free(r);
+    ssize_t n;
+    int count = 1;
+
+    if (free > max) {
+        free = max;
+    }
+    iov[0].iov_base = &(r->data[index]);
+    iov[0].iov_len = free;
+    if (index + free > RING_SIZE) {
+        iov[0].iov_len = RING_SIZE - index;
+        iov[1].iov_base = &(r->data[0]);
+        iov[1].iov_len = free - iov[0].iov_len;
+        count = 2;
+    }
+    n = readv(fd, iov, count);
+    if (n > 0) {
+        r->head += (uint64_t)n;
+    }
+    return n;
+}
+
+/* Copy data in, for when it does not come from a file descriptor.
+ * Returns the number of bytes that fitted. */
+size_t ring_write(Ring* r, const uint8_t* data, size_t n)
+{
+    size_t done = 0;
+    while (done < n) {
+        size_t room;
+        uint8_t* p = ring_space(r, &room);
+        if (room == 0) {
+            break;
+        }
+        if (room > n - done) {
+            room = n - done;
+        }
+        memcpy(p, &(data[done]), room);
+        ring_commit(r, room);
+        done += room;
+    }
+    return done;
+}
+
+void ring_view(const Ring* r, uint64_t start, size_t length, Frame_View* view)
+{
+    size_t index = (size_t)(start & RING_MASK);
+
+    view->part1 = &(r->data[index]);
+    if (index + length <= RING_SIZE) {
+        view->length1 = length;
+        view->part2 = NULL;
+        view->length2 = 0;
+    } else {
+        view->length1 = RING_SIZE - index;
+        view->part2 = &(r->data[0]);
+        view->length2 = length - view->length1;
+    }
+}
+
+/* The frame as contiguous bytes. Only a frame that wraps around is
+ * copied, into scratch, which must be large enough to hold it. */
+const uint8_t* frame_linear(const Frame_View* view, uint8_t* scratch)
+{
+    if (view->length2 == 0) {
+        return view->part1;
+    }
+    memcpy(scratch, view->part1, view->length1);
+    memcpy(&(scratch[view->length1]), view->part2, view->length2);
+    return scratch;
+}
@@ -0,0 +1,50 @@
+#ifndef RING_H
+#define RING_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Ring buffer between read() and the parser.
+ *
+ * read() fills the ring directly and the parser hands out complete
+ * frames as views into it, so every byte is copied once, by the
+ * kernel. Positions are 64 bit offsets in the stream, they do not
+ * wrap; only the index into data does.
+ */
+
+/* Power of 2. Big enough for a few seconds of input at 921600 baud,
+ * for when the writer thread (mon -T) is held up by the disk. */
+#define RING_SIZE (256*1024)
+
+typedef struct Ring {
+    uint8_t data[RING_SIZE];
+    uint64_t head;  /* Offset of the next byte to be written */
+    uint64_t tail;  /* Offset of the oldest byte still in use */
+} Ring;
+
+/* A frame in the ring. part2 is only used when the frame wraps around
+ * the end of data. */
+typedef struct Frame_View {
+    const uint8_t* part1;
+    size_t length1;
+    const uint8_t* part2;
+    size_t length2;
+} Frame_View;
+
+static inline uint8_t ring_byte(const Ring* r, uint64_t offset)
+{
+    return r->data[offset & (RING_SIZE - 1)];
+}
+
+void ring_init(Ring* r);
+size_t ring_free(const Ring* r);
+uint8_t* ring_space(Ring* r, size_t* n);
+void ring_commit(Ring* r, size_t n);
+ssize_t ring_read(Ring* r, int fd, size_t max);
+size_t ring_write(Ring* r, const uint8_t* data, size_t n);
+
+void ring_view(const Ring* r, uint64_t start, size_t length, Frame_View* view);
+const uint8_t* frame_linear(const Frame_View* view, uint8_t* scratch);
+
+#endif /* RING_H */
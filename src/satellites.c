@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "satellites.h"
+#include "util.h"
+
+int sat_epoch_add(Sat_Epoch* e, uint8_t gnss, uint8_t svid, int8_t elevation,
+        uint8_t cno, uint16_t azimuth)
+{
+    int i = e->n;
+
+    if (i == SATELLITES_MAX) {
+        return 0;
+    }
+    e->gnss[i] = gnss;
+    e->svid[i] = svid;
+    e->elevation[i] = elevation;
+    e->cno[i] = cno;
+    e->azimuth[i] = azimuth;
+    e->n++;
+    return 1;
+}
+
+/* Create name for the satellites. Returns NULL on failure. */
+Sat_Writer* sat_writer_open(const char* name)
+{
+    uint8_t header[SATELLITES_HEADER_SIZE];
+    Sat_Writer* w;
+
+    w = calloc(1, sizeof(Sat_Writer));
+    if (w == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    w->file = fopen(name, "w");
+    if (w->file == NULL) {
+        perror(name);
+        free(w);
+        return NULL;
+    }
+    memset(header, 0, sizeof(header));
+    memcpy(header, SATELLITES_MAGIC, sizeof(SATELLITES_MAGIC));
+    put_u32(&(header[8]), SATELLITES_VERSION);
+    if (fwrite(header, sizeof(header), 1, w->file) != 1) {
+        w->failed = 1;
+    }
+    w->bytes = sizeof(header);
+    return w;
+}
+
+/* Write the satellites of e that differ from the epoch before */
+void sat_writer_add(Sat_Writer* w, const Sat_Epoch* e, uint32_t time_of_day)
+{
+    uint8_t record[SATELLITES_EPOCH_SIZE + SATELLITES_MAX * SATELLITES_CHANGED_SIZE +
+        SATELLITES_MAX * SATELLITES_GONE_SIZE];
+    uint8_t gone[SATELLITES_MAX * SATELLITES_GONE_SIZE];
+    uint16_t keys[SATELLITES_MAX];
+    uint8_t* p = &(record[SATELLITES_EPOCH_SIZE]);
+    uint32_t epoch = ++(w->epoch);
+    int keyframe = (epoch % SATELLITES_KEYFRAME == 1);
+    int changed = 0;
+    int n_gone = 0;
+    int n = 0;
+    int i;
+
+    for (i = 0; i < e->n; i++) {
+        uint16_t key = satellite_key(e->gnss[i], e->svid[i]);
+        uint32_t value = ((uint32_t)(uint8_t)e->elevation[i] << 24) |
+            ((uint32_t)e->cno[i] << 16) | e->azimuth[i];
+        if (w->seen[key] == epoch) {
+            /* Twice in one epoch, keep the first */
+            continue;
+        }
+        if (keyframe || w->seen[key] != epoch - 1 || w->value[key] != value) {
+            p[0] = e->gnss[i];
+            p[1] = e->svid[i];
+            p[2] = (uint8_t)e->elevation[i];
+            p[3] = e->cno[i];
+            put_u16(&(p[4]), e->azimuth[i]);
+            p += SATELLITES_CHANGED_SIZE;
+            changed++;
+        }
+        w->seen[key] = epoch;
+        w->value[key] = value;
+        keys[n++] = key;
+    }
+    if (!keyframe) {
+        /* The keys of the previous epoch that are not in this one */
+        for (i = 0; i < w->previous_n; i++) {
+            uint16_t key = w->previous[i];
+            if (w->seen[key] != epoch) {
+                gone[n_gone * SATELLITES_GONE_SIZE] = (uint8_t)(key >> 8);
+                gone[n_gone * SATELLITES_GONE_SIZE + 1] = (uint8_t)key;
+                n_gone++;
+            }
+        }
+    }
+    memcpy(w->previous, keys, n * sizeof(uint16_t));
+    w->previous_n = n;
+
+    put_u32(&(record[0]), time_of_day);
+    record[4] = keyframe ? SATELLITES_FLAG_KEYFRAME : 0;
+    record[5] = (uint8_t)changed;
+    record[6] = (uint8_t)n_gone;
+    record[7] = 0;
+    memcpy(p, gone, n_gone * SATELLITES_GONE_SIZE);
+    p += n_gone * SATELLITES_GONE_SIZE;
+    if (fwrite(record, (size_t)(p - record), 1, w->file) != 1) {
+        w->failed = 1;
+    }
+    w->bytes += (uint64_t)(p - record);
+    w->satellites += (uint64_t)n;
+    w->written += (uint64_t)changed;
+}
+
+/* Close, returns 0 if anything failed */
+int sat_writer_close(Sat_Writer* w)
+{
+    int ok;
+
+    if (fclose(w->file) != 0) {
+        w->failed = 1;
+    }
+    if (w->failed) {
+        perror("satellites");
+    }
+    printf("Satellites: %lu epochs in %llu bytes, %llu of %llu satellites written\n",
+            (unsigned long)w->epoch, (unsigned long long)w->bytes,
+            (unsigned long long)w->written, (unsigned long long)w->satellites);
+    ok = !w->failed;
+    free(w);
+    return ok;
+}
+
+int satellites_read_header(const uint8_t* data, size_t n)
+{
+    return n >= SATELLITES_HEADER_SIZE &&
+        memcmp(data, SATELLITES_MAGIC, sizeof(SATELLITES_MAGIC)) == 0 &&
+        get_u32(&(data[8])) == SATELLITES_VERSION;
+}
+
+/* Apply the epoch at the start of data to e, which holds the epoch
+ * before it. Returns the bytes it takes, 0 at the end or if it is
+ * damaged. */
+size_t satellites_next_epoch(const uint8_t* data, size_t n, Sat_Epoch* e, uint32_t* time_of_day)
+{
+    const uint8_t* p;
+    size_t length;
+    int changed;
+    int gone;
+    int i;
+    int k;
+
+    if (n < SATELLITES_EPOCH_SIZE) {
+        return 0;
+    }
+    changed = data[5];
+    gone = data[6];
+    length = SATELLITES_EPOCH_SIZE + (size_t)changed * SATELLITES_CHANGED_SIZE +
+        (size_t)gone * SATELLITES_GONE_SIZE;
+    if (length > n) {
+        return 0;
+    }
+    *time_of_day = get_u32(data);
+    if (data[4] & SATELLITES_FLAG_KEYFRAME) {
+        e->n = 0;
+    }
+    p = &(data[SATELLITES_EPOCH_SIZE]);
+    for (i = 0; i < changed; i++, p += SATELLITES_CHANGED_SIZE) {
+        for (k = 0; k < e->n && (e->gnss[k] != p[0] || e->svid[k] != p[1]); k++) {
+        }
+        if (k == e->n && !sat_epoch_add(e, p[0], p[1], 0, 0, 0)) {
+            continue;
+        }
+        e->elevation[k] = (int8_t)p[2];
+        e->cno[k] = p[3];
+        e->azimuth[k] = get_u16(&(p[4]));
+    }
+    for (i = 0; i < gone; i++, p += SATELLITES_GONE_SIZE) {
+        for (k = 0; k < e->n; k++) {
+            if (e->gnss[k] == p[0] && e->svid[k] == p[1]) {
+                /* Keep the order, readers print them as received */
+                int rest = e->n - k - 1;
+                memmove(&(e->gnss[k]), &(e->gnss[k + 1]), rest);
+                memmove(&(e->svid[k]), &(e->svid[k + 1]), rest);
+                memmove(&(e->elevation[k]), &(e->elevation[k + 1]), rest);
+                memmove(&(e->cno[k]), &(e->cno[k + 1]), rest);
+                memmove(&(e->azimuth[k]), &(e->azimuth[k + 1]), rest * sizeof(uint16_t));
+                e->n--;
+                break;
+            }
+        }
+    }
+    return length;
+}
@@ -0,0 +1,99 @@
+#ifndef SATELLITES_H
+#define SATELLITES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/* The satellites in view of one epoch, from the GSV sentences of all
+ * talkers or from UBX-NAV-SAT, and the file mon -V writes them to.
+ *
+ * An epoch is kept as a struct of arrays, one array per field, so
+ * comparing and copying epochs runs over small dense arrays. The svid
+ * is as the source numbers it: NMEA numbers for GSV, the UBX svId for
+ * NAV-SAT.
+ *
+ * The file holds per epoch only the satellites that changed, came or
+ * went since the epoch before. Every SATELLITES_KEYFRAME epochs all of
+ * them are written, so a reader can start there.
+ *
+ * File layout (all numbers little endian):
+ *
+ *   header  "GNSSSAT" 0x00, uint32 version, uint32 reserved
+ *   epoch   uint32 UTC time of day (ms) of the fix of the epoch,
+ *           uint8 flags, uint8 changed, uint8 gone, uint8 reserved,
+ *           changed x (uint8 gnss, uint8 svid, int8 elevation,
+ *                      uint8 C/N0, uint16 azimuth),
+ *           gone x (uint8 gnss, uint8 svid)
+ *
+ * Flag SATELLITES_FLAG_KEYFRAME: the changed satellites are all there
+ * are, forget the ones before.
+ */
+
+#define SATELLITES_SUFFIX ".sats"
+#define SATELLITES_MAGIC "GNSSSAT"
+#define SATELLITES_VERSION (1U)
+#define SATELLITES_HEADER_SIZE (16U)
+#define SATELLITES_EPOCH_SIZE (8U)
+#define SATELLITES_CHANGED_SIZE (6U)
+#define SATELLITES_GONE_SIZE (2U)
+#define SATELLITES_FLAG_KEYFRAME (0x01)
+#define SATELLITES_KEYFRAME (60)        /* Epochs */
+#define SATELLITES_MAX (96)            /* Also sets the longest UBX body mon takes */
+#define SATELLITES_KEYS (16 * 256)      /* gnss (4 bits) and svid */
+
+/* gnss, as in UBX */
+#define GNSS_GPS     (0)
+#define GNSS_SBAS    (1)
+#define GNSS_GALILEO (2)
+#define GNSS_BEIDOU  (3)
+#define GNSS_QZSS    (5)
+#define GNSS_GLONASS (6)
+#define GNSS_UNKNOWN (15)
+
+#define ELEVATION_UNKNOWN (-128)
+#define AZIMUTH_UNKNOWN   (0xFFFF)
+
+typedef struct Sat_Epoch {
+    int n;
+    uint8_t gnss[SATELLITES_MAX];
+    uint8_t svid[SATELLITES_MAX];
+    int8_t elevation[SATELLITES_MAX];   /* deg */
+    uint8_t cno[SATELLITES_MAX];        /* dBHz, 0 when not tracked */
+    uint16_t azimuth[SATELLITES_MAX];   /* deg */
+} Sat_Epoch;
+
+typedef struct Sat_Writer {
+    FILE* file;
+    uint32_t epoch;                     /* Epochs written, from 1 */
+    int failed;
+    /* The previous epoch, by key */
+    uint32_t seen[SATELLITES_KEYS];     /* Epoch a key was last in */
+    uint32_t value[SATELLITES_KEYS];    /* Its elevation, C/N0, azimuth */
+    uint16_t previous[SATELLITES_MAX];  /* Keys of the previous epoch */
+    int previous_n;
+    /* Statistics */
+    uint64_t bytes;
+    uint64_t satellites;                /* In view, summed over the epochs */
+    uint64_t written;                   /* Of those, written */
+} Sat_Writer;
+
+static inline uint16_t satellite_key(uint8_t gnss, uint8_t svid)
+{
+    return (uint16_t)(((gnss & 0x0F) << 8) | svid);
+}
+
+/* Add a satellite, returns 0 when the epoch is full */
+int sat_epoch_add(Sat_Epoch* e, uint8_t gnss, uint8_t svid, int8_t elevation,
+        uint8_t cno, uint16_t azimuth);
+
+/* mon */
+Sat_Writer* sat_writer_open(const char* name);
+void sat_writer_add(Sat_Writer* w, const Sat_Epoch* e, uint32_t time_of_day);
+int sat_writer_close(Sat_Writer* w);
+
+/* Readers */
+int satellites_read_header(const uint8_t* data, size_t n);
+size_t satellites_next_epoch(const uint8_t* data, size_t n, Sat_Epoch* e, uint32_t* time_of_day);
+
+#endif /* SATELLITES_H */
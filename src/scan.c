@@ -0,0 +1,45 @@
+#include "scan.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCAN_NEON
+#endif
+
+size_t scan_for_either(const uint8_t* data, size_t n, uint8_t a, uint8_t b)
+{
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i va = _mm_set1_epi8((char)a);
+    const __m128i vb = _mm_set1_epi8((char)b);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&(data[i]));
+        int mask = _mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+#elif defined(SCAN_NEON)
+    const uint8x16_t va = vdupq_n_u8(a);
+    const uint8x16_t vb = vdupq_n_u8(b);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(&(data[i]));
+        uint8x16_t eq = vorrq_u8(vceqq_u8(v, va), vceqq_u8(v, vb));
+        /* Narrow to 4 bits per byte, so the result fits in 64 bits */
+        uint8x8_t nibbles = vshrn_n_u16(vreinterpretq_u16_u8(eq), 4);
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(nibbles), 0);
+        if (mask != 0) {
+            return i + (size_t)(__builtin_ctzll(mask) >> 2);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (data[i] == a || data[i] == b) {
+            break;
+        }
+    }
+    return i;
+}
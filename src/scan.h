@@ -0,0 +1,11 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Index of the first byte in data that is a or b, n when there is none.
+ * Uses SSE2 or NEON when the compiler targets them, 16 bytes per step. */
+size_t scan_for_either(const uint8_t* data, size_t n, uint8_t a, uint8_t b);
+
+#endif /* SCAN_H */
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "schedule.h"
+
+static const char* const rate_names[] = {
+    [RATE_FAST] = "fast",
+    [RATE_NORMAL] = "normal",
+    [RATE_SLOW] = "slow"
+};
+#define NUMBER_OF_RATES ((int)(sizeof(rate_names) / sizeof(rate_names[0])))
+
+static const char* const output_names[] = {
+    [NAV_MODE_NMEA] = "nmea",
+    [NAV_MODE_PVT] = "pvt",
+    [NAV_MODE_PVT_SAT] = "sat"
+};
+#define NUMBER_OF_OUTPUTS ((int)(sizeof(output_names) / sizeof(output_names[0])))
+
+/* Index of word in names, -1 if it is not there */
+static int find_name(const char* const* names, int n, const char* word)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        if (names[i] != NULL && strcmp(names[i], word) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* schedule_output_name(int nav_mode)
+{
+    return output_names[nav_mode];
+}
+
+int schedule_read(const char* name, Schedule* s)
+{
+    char line[256];
+    char rate[16];
+    char output[16];
+    FILE* f;
+    int number = 0;
+    int ok = 1;
+
+    f = fopen(name, "r");
+    if (f == NULL) {
+        perror(name);
+        return 0;
+    }
+    s->n = 0;
+    while (ok && fgets(line, sizeof(line), f) != NULL) {
+        Phase* p = &(s->phases[s->n]);
+        char* comment = strchr(line, '#');
+        char end[2];
+
+        number++;
+        if (comment != NULL) {
+            *comment = 0;
+        }
+        if (sscanf(line, " %1s", end) != 1) {
+            /* Empty */
+            continue;
+        }
+        if (s->n == SCHEDULE_MAX_PHASES) {
+            printf("%s:%d: more than %d phases\n", name, number, SCHEDULE_MAX_PHASES);
+            ok = 0;
+        } else if (sscanf(line, "%31s %d %15s %15s %1s", p->name, &(p->seconds), rate, output,
+                    end) != 4) {
+            printf("%s:%d: expected NAME SECONDS RATE OUTPUT\n", name, number);
+            ok = 0;
+        } else if (p->seconds <= 0) {
+            printf("%s:%d: %d seconds\n", name, number, p->seconds);
+            ok = 0;
+        } else if ((p->rate = find_name(rate_names, NUMBER_OF_RATES, rate)) < 0) {
+            printf("%s:%d: rate %s, not slow, normal or fast\n", name, number, rate);
+            ok = 0;
+        } else if ((p->nav_mode = find_name(output_names, NUMBER_OF_OUTPUTS, output)) < 0) {
+            printf("%s:%d: output %s, not nmea, pvt or sat\n", name, number, output);
+            ok = 0;
+        } else {
+            s->n++;
+        }
+    }
+    fclose(f);
+    if (ok && s->n == 0) {
+        printf("%s: no phases\n", name);
+        ok = 0;
+    }
+    return ok;
+}
@@ -0,0 +1,49 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+/* An experiment as a series of phases (mon -e FILE), each with its own
+ * navigation rate and output, so rates can be compared within one run
+ * of the receiver instead of one run per rate.
+ *
+ * The file has a phase per line, comments start with '#':
+ *
+ *   # name   seconds  rate     output
+ *   warmup   600      normal   nmea
+ *   slow     1800     slow     nmea
+ *   fast     1800     fast     pvt
+ *
+ * rate is one of slow (0.2 Hz), normal (1 Hz) or fast (5 Hz), as -z and
+ * -x; output one of nmea, pvt or sat, as -p and -s.
+ */
+
+#define SCHEDULE_MAX_PHASES (64)
+#define SCHEDULE_NAME_SIZE (32)
+
+/* Navigation rate */
+#define RATE_FAST   (1)
+#define RATE_NORMAL (2)
+#define RATE_SLOW   (3)
+
+/* Binary navigation mode: NAV-PVT instead of the NMEA sentences */
+#define NAV_MODE_NMEA (0)
+#define NAV_MODE_PVT  (1)
+#define NAV_MODE_PVT_SAT (2) /* NAV-PVT plus NAV-SAT */
+
+typedef struct Phase {
+    char name[SCHEDULE_NAME_SIZE];
+    int seconds;
+    int rate;           /* RATE_... */
+    int nav_mode;       /* NAV_MODE_... */
+} Phase;
+
+typedef struct Schedule {
+    Phase phases[SCHEDULE_MAX_PHASES];
+    int n;
+} Schedule;
+
+/* Read the phases from the file name. Returns 0, after reporting what
+ * is wrong, if it can not be read or has no phases. */
+int schedule_read(const char* name, Schedule* s);
+const char* schedule_output_name(int nav_mode);
+
+#endif /* SCHEDULE_H */
@@ -0,0 +1,509 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "server.h"
+#include "util.h"
+
+#define SERVER_POLL_MS (100)
+#define SERVER_BACKLOG (8)
+
+static const char* mode_names[] = { "raw", "nmea", "ubx" };
+
+static uint8_t view_byte(const Frame_View* view, size_t i)
+{
+    return (i < view->length1) ? view->part1[i] : view->part2[i - view->length1];
+}
+
+/* "PORT" or "ADDRESS:PORT", the address defaults to localhost */
+static int parse_address(const char* text, struct sockaddr_in* addr)
+{
+    char host[64];
+    const char* colon = strrchr(text, ':');
+    const char* port = text;
+
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (colon != NULL) {
+        size_t n = (size_t)(colon - text);
+        if (n >= sizeof(host)) {
+            return 0;
+        }
+        memcpy(host, text, n);
+        host[n] = 0;
+        if (inet_pton(AF_INET, host, &(addr->sin_addr)) != 1) {
+            return 0;
+        }
+        port = colon + 1;
+    }
+    if (atoi(port) <= 0 || atoi(port) > 65535) {
+        return 0;
+    }
+    addr->sin_port = htons((uint16_t)atoi(port));
+    return 1;
+}
+
+static int listen_on(const struct sockaddr_in* addr)
+{
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (const struct sockaddr*)addr, sizeof(struct sockaddr_in)) != 0 ||
+            listen(fd, SERVER_BACKLOG) != 0) {
+        perror("server bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void report(const Server_Client* c, uint64_t now)
+{
+    double seconds = (double)(now - c->connected) / 1.0e9;
+
+    printf("Server: client %s, receiver %d, %s: %llu bytes in %.1f s (%.0f bytes/s), "
+            "%llu frames (%llu bytes) dropped\n",
+            c->address, c->receiver, mode_names[c->mode],
+            (unsigned long long)c->bytes_sent, seconds,
+            (seconds > 0) ? (double)c->bytes_sent / seconds : 0.0,
+            (unsigned long long)c->frames_dropped, (unsigned long long)c->bytes_dropped);
+}
+
+static void drop_client(Server_Client* c, const char* why)
+{
+    uint64_t now = monotonic_ns();
+
+    pthread_mutex_lock(&(c->lock));
+    atomic_store(&(c->state), CLIENT_FREE);
+    pthread_mutex_unlock(&(c->lock));
+    close(c->fd);
+    c->fd = -1;
+    if (why != NULL) {
+        printf("Server: client %s %s\n", c->address, why);
+    }
+    report(c, now);
+}
+
+static void accept_client(Server* s, int receiver)
+{
+    struct sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    char host[INET_ADDRSTRLEN];
+    Server_Client* c = NULL;
+    int one = 1;
+    int send_buffer = SERVER_CLIENT_BUFFER;
+    int fd;
+    int i;
+
+    fd = accept4(s->listen_fds[receiver], (struct sockaddr*)&addr, &length,
+            SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        if (atomic_load(&(s->clients[i].state)) == CLIENT_FREE) {
+            c = &(s->clients[i]);
+            break;
+        }
+    }
+    if (c == NULL) {
+        printf("Server: more than %d clients\n", SERVER_MAX_CLIENTS);
+        close(fd);
+        return;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    /* Keep what a slow client has waiting in the kernel bounded too */
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &send_buffer, sizeof(send_buffer));
+
+    pthread_mutex_lock(&(c->lock));
+    c->fd = fd;
+    c->receiver = receiver;
+    c->mode = SERVER_RAW;
+    c->has_classes = 0;
+    inet_ntop(AF_INET, &(addr.sin_addr), host, sizeof(host));
+    snprintf(c->address, sizeof(c->address), "%s:%u", host, ntohs(addr.sin_port));
+    c->request_length = 0;
+    c->head = 0;
+    c->tail = 0;
+    c->stalled_since = 0;
+    c->connected = monotonic_ns();
+    c->bytes_sent = 0;
+    c->frames_dropped = 0;
+    c->bytes_dropped = 0;
+    atomic_store(&(c->state), CLIENT_ACTIVE);
+    pthread_mutex_unlock(&(c->lock));
+}
+
+/* The line with what the client wants */
+static void handle_request(Server_Client* c)
+{
+    char* save = NULL;
+    char* word;
+    int mode = -1;
+    int has_classes = 0;
+    uint8_t classes[32];
+
+    memset(classes, 0, sizeof(classes));
+    c->request[c->request_length] = 0;
+    c->request_length = 0;
+    for (word = strtok_r(c->request, " \t\r\n", &save); word != NULL;
+            word = strtok_r(NULL, " \t\r\n", &save)) {
+        if (mode < 0 && strcasecmp(word, "raw") == 0) {
+            mode = SERVER_RAW;
+        } else if (mode < 0 && strcasecmp(word, "nmea") == 0) {
+            mode = SERVER_NMEA;
+        } else if (mode < 0 && strcasecmp(word, "ubx") == 0) {
+            mode = SERVER_UBX;
+        } else if (mode == SERVER_UBX) {
+            long class = strtol(word, NULL, 0);
+            if (class >= 0 && class < 256) {
+                classes[class >> 3] |= (uint8_t)(1U << (class & 7));
+                has_classes = 1;
+            }
+        } else {
+            printf("Server: client %s, unknown request '%s'\n", c->address, word);
+            return;
+        }
+    }
+    if (mode < 0) {
+        return;
+    }
+    pthread_mutex_lock(&(c->lock));
+    c->mode = mode;
+    c->has_classes = has_classes;
+    memcpy(c->classes, classes, sizeof(classes));
+    /* Nothing of the old choice after the new one */
+    c->head = c->tail;
+    pthread_mutex_unlock(&(c->lock));
+}
+
+/* Returns 0 when the client is gone */
+static int receive(Server_Client* c)
+{
+    char data[256];
+    ssize_t n = recv(c->fd, data, sizeof(data), MSG_DONTWAIT);
+    ssize_t i;
+
+    if (n == 0) {
+        return 0;
+    }
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR;
+    }
+    for (i = 0; i < n; i++) {
+        if (data[i] == '\n') {
+            handle_request(c);
+        } else if (c->request_length < sizeof(c->request) - 1) {
+            c->request[c->request_length++] = data[i];
+        }
+    }
+    return 1;
+}
+
+/* Send what can be sent without waiting. Returns 0 when the client is
+ * gone. */
+static int send_pending(Server_Client* c)
+{
+    uint64_t head;
+    uint64_t tail;
+    uint64_t start;
+
+    pthread_mutex_lock(&(c->lock));
+    head = c->head;
+    tail = c->tail;
+    pthread_mutex_unlock(&(c->lock));
+    start = tail;
+
+    /* The readers only write after head, these bytes stay put */
+    while (tail < head) {
+        size_t offset = tail & (SERVER_CLIENT_BUFFER - 1);
+        size_t n = head - tail;
+        ssize_t k;
+        if (n > SERVER_CLIENT_BUFFER - offset) {
+            n = SERVER_CLIENT_BUFFER - offset;
+        }
+        k = send(c->fd, &(c->buffer[offset]), n, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (k < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                break;
+            }
+            return 0;
+        }
+        tail += (uint64_t)k;
+    }
+
+    if (tail != start) {
+        pthread_mutex_lock(&(c->lock));
+        /* Unless the client changed what it wants meanwhile */
+        if (c->tail == start) {
+            c->tail = tail;
+        }
+        c->stalled_since = 0;
+        pthread_mutex_unlock(&(c->lock));
+        c->bytes_sent += tail - start;
+    }
+    return 1;
+}
+
+static int has_pending(Server_Client* c)
+{
+    int pending;
+
+    pthread_mutex_lock(&(c->lock));
+    pending = c->head != c->tail;
+    pthread_mutex_unlock(&(c->lock));
+    return pending;
+}
+
+static int stalled(Server_Client* c, uint64_t now)
+{
+    int result;
+
+    pthread_mutex_lock(&(c->lock));
+    result = c->stalled_since != 0 &&
+        now - c->stalled_since > SERVER_STALL_MS * 1000000ULL;
+    pthread_mutex_unlock(&(c->lock));
+    return result;
+}
+
+static void* server_thread(void* arg)
+{
+    Server* s = arg;
+    struct pollfd fds[SERVER_MAX_RECEIVERS + 1 + SERVER_MAX_CLIENTS];
+    int clients[SERVER_MAX_CLIENTS];
+    int i;
+
+    while (!atomic_load(&(s->stop))) {
+        int n = 0;
+        int n_clients = 0;
+        uint64_t now;
+        uint64_t wakeups;
+
+        for (i = 0; i < s->receivers; i++) {
+            fds[n].fd = s->listen_fds[i];
+            fds[n++].events = POLLIN;
+        }
+        fds[n].fd = s->wake_fd;
+        fds[n++].events = POLLIN;
+        for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+            Server_Client* c = &(s->clients[i]);
+            if (atomic_load(&(c->state)) == CLIENT_ACTIVE) {
+                fds[n].fd = c->fd;
+                fds[n].events = POLLIN | (has_pending(c) ? POLLOUT : 0);
+                clients[n_clients++] = i;
+                n++;
+            }
+        }
+        if (poll(fds, n, SERVER_POLL_MS) < 0) {
+            if (errno != EINTR) {
+                perror("server poll");
+                break;
+            }
+            continue;
+        }
+
+        if (fds[s->receivers].revents & POLLIN) {
+            if (read(s->wake_fd, &wakeups, sizeof(wakeups)) < 0) {
+                /* Nothing to read after all */
+            }
+        }
+        now = monotonic_ns();
+        for (i = 0; i < n_clients; i++) {
+            Server_Client* c = &(s->clients[clients[i]]);
+            short revents = fds[s->receivers + 1 + i].revents;
+            if ((revents & (POLLIN | POLLHUP | POLLERR)) && !receive(c)) {
+                drop_client(c, "disconnected");
+            } else if (!send_pending(c)) {
+                drop_client(c, "disconnected");
+            } else if (stalled(c, now)) {
+                drop_client(c, "too slow, disconnected");
+            }
+        }
+        for (i = 0; i < s->receivers; i++) {
+            if (fds[i].revents & POLLIN) {
+                accept_client(s, i);
+            }
+        }
+    }
+
+    /* Last chance for what is still buffered, without waiting */
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Server_Client* c = &(s->clients[i]);
+        if (atomic_load(&(c->state)) == CLIENT_ACTIVE) {
+            send_pending(c);
+            drop_client(c, NULL);
+        }
+    }
+    return NULL;
+}
+
+/* Listen on address, see parse_address(), and the ports after it for
+ * the other receivers */
+Server* server_open(const char* address, int receivers)
+{
+    struct sockaddr_in addr;
+    char host[INET_ADDRSTRLEN];
+    Server* s;
+    int error;
+    int i;
+
+    if (receivers > SERVER_MAX_RECEIVERS) {
+        printf("Server: at most %d receivers\n", SERVER_MAX_RECEIVERS);
+        return NULL;
+    }
+    if (!parse_address(address, &addr)) {
+        printf("Server: bad address %s, PORT or ADDRESS:PORT\n", address);
+        return NULL;
+    }
+    s = calloc(1, sizeof(Server));
+    if (s == NULL) {
+        perror("calloc");
+        return NULL;
+    }
+    s->wake_fd = -1;
+    for (i = 0; i < SERVER_MAX_RECEIVERS; i++) {
+        s->listen_fds[i] = -1;
+    }
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Server_Client* c = &(s->clients[i]);
+        pthread_mutex_init(&(c->lock), NULL);
+        atomic_init(&(c->state), CLIENT_FREE);
+        c->fd = -1;
+        c->buffer = malloc(SERVER_CLIENT_BUFFER);
+        if (c->buffer == NULL) {
+            perror("malloc");
+            server_close(s);
+            return NULL;
+        }
+    }
+    atomic_init(&(s->stop), 0);
+    for (i = 0; i < receivers; i++) {
+        struct sockaddr_in a = addr;
+        a.sin_port = htons((uint16_t)(ntohs(addr.sin_port) + i));
+        s->listen_fds[i] = listen_on(&a);
+        if (s->listen_fds[i] < 0) {
+            server_close(s);
+            return NULL;
+        }
+        s->receivers++;
+    }
+    s->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (s->wake_fd < 0) {
+        perror("eventfd");
+        server_close(s);
+        return NULL;
+    }
+    error = pthread_create(&(s->thread), NULL, server_thread, s);
+    if (error != 0) {
+        errno = error;
+        perror("pthread_create");
+        close(s->wake_fd);
+        s->wake_fd = -1;
+        server_close(s);
+        return NULL;
+    }
+    inet_ntop(AF_INET, &(addr.sin_addr), host, sizeof(host));
+    printf("Server: listening on %s:%u", host, ntohs(addr.sin_port));
+    if (receivers > 1) {
+        printf(" to %u", ntohs(addr.sin_port) + receivers - 1);
+    }
+    printf("\n");
+    return s;
+}
+
+/* Add n bytes at head, there is room */
+static void copy_in(Server_Client* c, const uint8_t* data, size_t n)
+{
+    size_t offset = c->head & (SERVER_CLIENT_BUFFER - 1);
+    size_t first = (n < SERVER_CLIENT_BUFFER - offset) ? n : SERVER_CLIENT_BUFFER - offset;
+
+    memcpy(&(c->buffer[offset]), data, first);
+    memcpy(c->buffer, &(data[first]), n - first);
+    c->head += n;
+}
+
+/* From the reader thread of receiver: a chunk of raw input, or a good
+ * frame. Never waits for a client. */
+void server_frame(Server* s, int receiver, int kind, const Frame_View* view)
+{
+    size_t n = view->length1 + view->length2;
+    int wake = 0;
+    int i;
+
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        Server_Client* c = &(s->clients[i]);
+        if (atomic_load_explicit(&(c->state), memory_order_relaxed) != CLIENT_ACTIVE) {
+            continue;
+        }
+        pthread_mutex_lock(&(c->lock));
+        if (atomic_load(&(c->state)) == CLIENT_ACTIVE && c->receiver == receiver &&
+                c->mode == kind &&
+                (!c->has_classes ||
+                    (c->classes[view_byte(view, 2) >> 3] & (1U << (view_byte(view, 2) & 7))))) {
+            if (n > SERVER_CLIENT_BUFFER - (c->head - c->tail)) {
+                c->frames_dropped++;
+                c->bytes_dropped += n;
+                if (c->stalled_since == 0) {
+                    c->stalled_since = monotonic_ns();
+                }
+            } else {
+                if (c->head == c->tail) {
+                    wake = 1;
+                }
+                copy_in(c, view->part1, view->length1);
+                copy_in(c, view->part2, view->length2);
+            }
+        }
+        pthread_mutex_unlock(&(c->lock));
+    }
+    if (wake) {
+        uint64_t one = 1;
+        if (write(s->wake_fd, &one, sizeof(one)) < 0) {
+            /* Already awake, the counter is full */
+        }
+    }
+}
+
+/* After the readers are done */
+void server_close(Server* s)
+{
+    int i;
+
+    if (s->wake_fd >= 0) {
+        uint64_t one = 1;
+        atomic_store(&(s->stop), 1);
+        if (write(s->wake_fd, &one, sizeof(one)) < 0) {
+            perror("eventfd");
+        }
+        pthread_join(s->thread, NULL);
+        close(s->wake_fd);
+    }
+    for (i = 0; i < SERVER_MAX_RECEIVERS; i++) {
+        if (s->listen_fds[i] >= 0) {
+            close(s->listen_fds[i]);
+        }
+    }
+    for (i = 0; i < SERVER_MAX_CLIENTS; i++) {
+        pthread_mutex_destroy(&(s->clients[i].lock));
+        free(s->clients[i].buffer);
+    }
+    free(s);
+}
@@ -0,0 +1,78 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "ring.h"
+
+/* TCP server that streams what the receivers send to any number of
+ * clients (mon -N), so the data can be watched live while mon owns
+ * the port.
+ *
+ * Receiver K listens on port PORT + K. After connecting a client may
+ * send one line to choose what it gets:
+ *
+ *   raw              every byte read from the port, as is (default)
+ *   nmea             good NMEA sentences
+ *   ubx [CLASS...]   good UBX messages, of these classes only if given
+ *                    (decimal or 0x hex)
+ *
+ * The reader threads copy frames into a bounded buffer per client and
+ * never wait: a frame that does not fit is dropped, whole, so a client
+ * always gets complete frames. A client that keeps its buffer full for
+ * SERVER_STALL_MS is disconnected. The sending is done by a thread of
+ * the server's own. Per client the bytes sent and the frames dropped
+ * are reported when it goes.
+ */
+
+#define SERVER_MAX_CLIENTS (16)
+#define SERVER_CLIENT_BUFFER (64*1024)  /* Power of 2 */
+#define SERVER_STALL_MS (2000)
+#define SERVER_MAX_RECEIVERS (8)
+
+#define SERVER_RAW  (0)
+#define SERVER_NMEA (1)
+#define SERVER_UBX  (2)
+
+/* Client states */
+#define CLIENT_FREE      (0)
+#define CLIENT_ACTIVE    (1)    /* Readers may add to the buffer */
+
+typedef struct Server_Client {
+    pthread_mutex_t lock;       /* buffer, head, tail, stalled_since */
+    atomic_int state;
+    int fd;
+    int receiver;
+    int mode;                   /* SERVER_... */
+    int has_classes;            /* ubx: only the classes in classes */
+    uint8_t classes[32];        /* Bit per UBX class */
+    char address[64];
+    char request[64];           /* The line being received */
+    size_t request_length;
+    uint8_t* buffer;
+    uint64_t head;              /* Written by the readers */
+    uint64_t tail;              /* Sent up to here */
+    uint64_t stalled_since;     /* First drop with a full buffer, ns */
+    uint64_t connected;         /* ns */
+    uint64_t bytes_sent;
+    uint64_t frames_dropped;
+    uint64_t bytes_dropped;
+} Server_Client;
+
+typedef struct Server {
+    int listen_fds[SERVER_MAX_RECEIVERS];
+    int receivers;
+    int wake_fd;                /* eventfd, data to send or stop */
+    atomic_int stop;
+    pthread_t thread;
+    Server_Client clients[SERVER_MAX_CLIENTS];
+} Server;
+
+Server* server_open(const char* address, int receivers);
+void server_frame(Server* s, int receiver, int kind, const Frame_View* view);
+void server_close(Server* s);
+
+#endif /* SERVER_H */
@@ -0,0 +1,152 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shmfix.h"
+
+#define SHM_FIX_READ_TRIES (1000)
+
+_Static_assert(sizeof(Shm_Fix_Data) % 4 == 0, "Shm_Fix_Data is copied in 32 bit words");
+
+Shm_Fix* shm_fix_create(const char* name, int receivers)
+{
+    Shm_Fix* shm;
+    int fd;
+
+    if (receivers > SHM_FIX_SLOTS) {
+        printf("Shared memory: at most %d receivers\n", SHM_FIX_SLOTS);
+        return NULL;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(Shm_Fix)) != 0) {
+        perror(name);
+        close(fd);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(Shm_Fix), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    /* A reader that still has the segment of an earlier run sees it
+     * go inactive first */
+    atomic_store(&(shm->active), 0);
+    memset(shm->slot, 0, sizeof(shm->slot));
+    shm->magic = SHM_FIX_MAGIC;
+    shm->version = SHM_FIX_VERSION;
+    shm->slots = (uint32_t)receivers;
+    shm->pid = (int32_t)getpid();
+    atomic_store(&(shm->active), 1);
+    return shm;
+}
+
+/* Only from the thread that handles the fixes of receiver */
+void shm_fix_publish(Shm_Fix* shm, int receiver, const GNSS_Fix* fix, uint64_t now)
+{
+    Shm_Fix_Slot* slot = &(shm->slot[receiver]);
+    uint32_t words[SHM_FIX_WORDS];
+    Shm_Fix_Data data;
+    uint32_t sequence;
+    size_t i;
+
+    /* Nobody else writes the slot, what is there is ours */
+    for (i = 0; i < SHM_FIX_WORDS; i++) {
+        words[i] = atomic_load_explicit(&(slot->words[i]), memory_order_relaxed);
+    }
+    memcpy(&data, words, sizeof(data));
+    data.fix = *fix;
+    data.count++;
+    data.publish_time = now;
+    memcpy(words, &data, sizeof(words));
+
+    sequence = atomic_load_explicit(&(slot->sequence), memory_order_relaxed);
+    atomic_store_explicit(&(slot->sequence), sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (i = 0; i < SHM_FIX_WORDS; i++) {
+        atomic_store_explicit(&(slot->words[i]), words[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&(slot->sequence), sequence + 2, memory_order_release);
+}
+
+void shm_fix_destroy(Shm_Fix* shm, const char* name)
+{
+    atomic_store(&(shm->active), 0);
+    munmap(shm, sizeof(Shm_Fix));
+    shm_unlink(name);
+}
+
+const Shm_Fix* shm_fix_open(const char* name)
+{
+    const Shm_Fix* shm;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Shm_Fix)) {
+        printf("%s: not a fix segment of this version\n", name);
+        close(fd);
+        return NULL;
+    }
+    shm = mmap(NULL, sizeof(Shm_Fix), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shm == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    if (shm->magic != SHM_FIX_MAGIC || shm->version != SHM_FIX_VERSION) {
+        printf("%s: not a fix segment of this version\n", name);
+        munmap((void*)shm, sizeof(Shm_Fix));
+        return NULL;
+    }
+    return shm;
+}
+
+/* A consistent copy of the slot of receiver. Returns 0 when nothing
+ * was published yet, or when the writer kept getting in the way. */
+int shm_fix_read(const Shm_Fix* shm, int receiver, Shm_Fix_Data* data)
+{
+    const Shm_Fix_Slot* slot;
+    uint32_t words[SHM_FIX_WORDS];
+    int tries;
+    size_t i;
+
+    if (receiver < 0 || receiver >= SHM_FIX_SLOTS) {
+        return 0;
+    }
+    slot = &(shm->slot[receiver]);
+    for (tries = 0; tries < SHM_FIX_READ_TRIES; tries++) {
+        uint32_t before = atomic_load_explicit(&(slot->sequence), memory_order_acquire);
+        uint32_t after;
+        if (before & 1) {
+            continue;
+        }
+        for (i = 0; i < SHM_FIX_WORDS; i++) {
+            words[i] = atomic_load_explicit(&(slot->words[i]), memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&(slot->sequence), memory_order_relaxed);
+        if (before == after) {
+            memcpy(data, words, sizeof(Shm_Fix_Data));
+            return data->count > 0;
+        }
+    }
+    return 0;
+}
+
+void shm_fix_close(const Shm_Fix* shm)
+{
+    munmap((void*)shm, sizeof(Shm_Fix));
+}
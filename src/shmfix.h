@@ -0,0 +1,64 @@
+#ifndef SHMFIX_H
+#define SHMFIX_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "fix.h"
+
+/* The latest fix of each receiver, published in POSIX shared memory
+ * for other processes on the same machine (mon -P).
+ *
+ * Every receiver has a slot of its own, written by one thread only,
+ * right after the fix is decoded. A slot is guarded by a sequence
+ * lock: the writer makes sequence odd, stores the fix, and makes it
+ * even again. A reader copies the fix and keeps it if sequence was
+ * even and the same before and after, so it never waits for the
+ * writer and needs no system call. The fix is stored as 32 bit atomic
+ * words, lock free on the Pi too, so the copy is not a data race.
+ *
+ * When mon stops it clears active and removes the name; readers that
+ * still have the segment mapped keep the last fixes.
+ */
+
+#define SHM_FIX_NAME "/gnss_fix"
+#define SHM_FIX_MAGIC (0x58464E47U)     /* "GNFX" */
+#define SHM_FIX_VERSION (1U)
+#define SHM_FIX_SLOTS (8)
+
+/* What a slot holds */
+typedef struct Shm_Fix_Data {
+    GNSS_Fix fix;
+    uint64_t count;         /* Fixes published so far */
+    uint64_t publish_time;  /* CLOCK_MONOTONIC, ns */
+} Shm_Fix_Data;
+
+#define SHM_FIX_WORDS (sizeof(Shm_Fix_Data) / 4)
+
+/* A cache line or two of its own, receivers do not share lines */
+typedef struct Shm_Fix_Slot {
+    _Atomic uint32_t sequence;  /* Odd while the fix is written */
+    _Atomic uint32_t words[SHM_FIX_WORDS];  /* The Shm_Fix_Data */
+} __attribute__((aligned(64))) Shm_Fix_Slot;
+
+typedef struct Shm_Fix {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;             /* Receivers in use */
+    _Atomic uint32_t active;    /* mon is running */
+    int32_t pid;                /* Of mon */
+    uint32_t reserved;
+    Shm_Fix_Slot slot[SHM_FIX_SLOTS];
+} Shm_Fix;
+
+/* mon */
+Shm_Fix* shm_fix_create(const char* name, int receivers);
+void shm_fix_publish(Shm_Fix* shm, int receiver, const GNSS_Fix* fix, uint64_t now);
+void shm_fix_destroy(Shm_Fix* shm, const char* name);
+
+/* Readers */
+const Shm_Fix* shm_fix_open(const char* name);
+int shm_fix_read(const Shm_Fix* shm, int receiver, Shm_Fix_Data* data);
+void shm_fix_close(const Shm_Fix* shm);
+
+#endif /* SHMFIX_H */
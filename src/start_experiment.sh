@@ -5,7 +5,7 @@
 /bin/echo 1    > /sys/class/leds/led0/brightness
 
 cd /home/pi/GNSS/
-./mon -n 14480 -z
+./mon -t 3600 -z -d -S
 
 status=$?
 if test $status -eq 0
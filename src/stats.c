@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "stats.h"
+
+#define EARTH_RADIUS (6371000.0)
+/* Meters per 1e-7 degree of latitude */
+#define METERS_PER_LAT (EARTH_RADIUS * M_PI / 180.0e7)
+
+static void p2_init(P2_Quantile* q, double p)
+{
+    memset(q, 0, sizeof(P2_Quantile));
+    q->p = p;
+}
+
+static void sort5(double* h, int n)
+{
+    int i;
+    int j;
+    for (i = 1; i < n; i++) {
+        double x = h[i];
+        for (j = i; j > 0 && h[j - 1] > x; j--) {
+            h[j] = h[j - 1];
+        }
+        h[j] = x;
+    }
+}
+
+static void p2_add(P2_Quantile* q, double x)
+{
+    double* h = q->height;
+    double* n = q->position;
+    int i;
+    int k;
+
+    if (q->count < 5) {
+        h[q->count++] = x;
+        if (q->count == 5) {
+            sort5(h, 5);
+            for (i = 0; i < 5; i++) {
+                n[i] = i + 1;
+            }
+            q->desired[0] = 1;
+            q->desired[1] = 1 + 2 * q->p;
+            q->desired[2] = 1 + 4 * q->p;
+            q->desired[3] = 3 + 2 * q->p;
+            q->desired[4] = 5;
+            q->increment[0] = 0;
+            q->increment[1] = q->p / 2;
+            q->increment[2] = q->p;
+            q->increment[3] = (1 + q->p) / 2;
+            q->increment[4] = 1;
+        }
+        return;
+    }
+    q->count++;
+
+    /* The cell x falls in, stretching the ends if needed */
+    if (x < h[0]) {
+        h[0] = x;
+        k = 0;
+    } else if (x >= h[4]) {
+        h[4] = x;
+        k = 3;
+    } else {
+        for (k = 0; k < 3 && x >= h[k + 1]; k++) {
+        }
+    }
+    for (i = k + 1; i < 5; i++) {
+        n[i] += 1;
+    }
+    for (i = 0; i < 5; i++) {
+        q->desired[i] += q->increment[i];
+    }
+
+    /* Move the middle markers towards where they should be */
+    for (i = 1; i < 4; i++) {
+        double d = q->desired[i] - n[i];
+        if ((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)) {
+            int s = (d > 0) ? 1 : -1;
+            double parabolic = h[i] + s / (n[i + 1] - n[i - 1]) *
+                ((n[i] - n[i - 1] + s) * (h[i + 1] - h[i]) / (n[i + 1] - n[i]) +
+                 (n[i + 1] - n[i] - s) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+            if (h[i - 1] < parabolic && parabolic < h[i + 1]) {
+                h[i] = parabolic;
+            } else {
+                h[i] = h[i] + s * (h[i + s] - h[i]) / (n[i + s] - n[i]);
+            }
+            n[i] += s;
+        }
+    }
+}
+
+static double p2_value(const P2_Quantile* q)
+{
+    double h[5];
+    int i;
+
+    if (q->count >= 5) {
+        return q->height[2];
+    }
+    if (q->count == 0) {
+        return 0.0;
+    }
+    /* Too few for the markers, the plain quantile */
+    memcpy(h, q->height, sizeof(h));
+    sort5(h, q->count);
+    i = (int)(q->p * (q->count - 1) + 0.5);
+    return h[i];
+}
+
+void stats_init(Fix_Stats* s)
+{
+    memset(s, 0, sizeof(Fix_Stats));
+    p2_init(&(s->cep50), 0.50);
+    p2_init(&(s->cep95), 0.95);
+}
+
+static void group_add(Stats_Group* g, double h_acc, double offset2)
+{
+    g->count++;
+    g->h_acc_sum += h_acc;
+    g->offset2_sum += offset2;
+}
+
+/* Longitude difference in 1e-7 degree, wrapped into -180..180 degrees */
+static int64_t lon_difference(int32_t lon, int32_t lon0)
+{
+    int64_t d = (int64_t)lon - (int64_t)lon0;
+    if (d > 1800000000LL) {
+        d -= 3600000000LL;
+    } else if (d < -1800000000LL) {
+        d += 3600000000LL;
+    }
+    return d;
+}
+
+void stats_add(Fix_Stats* s, const GNSS_Fix* fix)
+{
+    double x[3];
+    double delta[3];
+    double offset2;
+    int i;
+    int j;
+
+    s->fixes++;
+    if ((fix->fix_type != FIX_TYPE_2D && fix->fix_type != FIX_TYPE_3D &&
+            fix->fix_type != FIX_TYPE_GNSS_DR) || !(fix->flags & FIX_OK)) {
+        if (fix->fix_type <= FIX_TYPE_TIME) {
+            s->by_type[fix->fix_type].count++;
+        }
+        return;
+    }
+    if (s->positions == 0) {
+        s->lat0 = fix->lat;
+        s->lon0 = fix->lon;
+        s->alt0 = fix->altitude;
+        s->meters_per_lon = METERS_PER_LAT * cos(fix->lat * M_PI / 180.0e7);
+    }
+    s->positions++;
+
+    x[0] = (double)lon_difference(fix->lon, s->lon0) * s->meters_per_lon;
+    x[1] = (double)((int64_t)fix->lat - (int64_t)s->lat0) * METERS_PER_LAT;
+    x[2] = (double)((int64_t)fix->altitude - (int64_t)s->alt0) / 1.0e3;
+    for (i = 0; i < 3; i++) {
+        delta[i] = x[i] - s->mean[i];
+        s->mean[i] += delta[i] / (double)s->positions;
+    }
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 3; j++) {
+            s->m2[i][j] += delta[i] * (x[j] - s->mean[j]);
+        }
+    }
+
+    offset2 = (x[0] - s->mean[0]) * (x[0] - s->mean[0]) +
+        (x[1] - s->mean[1]) * (x[1] - s->mean[1]);
+    p2_add(&(s->cep50), sqrt(offset2));
+    p2_add(&(s->cep95), sqrt(offset2));
+    group_add(&(s->by_type[fix->fix_type]), fix->h_acc / 1.0e3, offset2);
+    group_add(&(s->by_sv[(fix->num_sv < STATS_MAX_SV) ? fix->num_sv : STATS_MAX_SV]),
+            fix->h_acc / 1.0e3, offset2);
+}
+
+static void print_group(FILE* out, const char* name, int value, const Stats_Group* g)
+{
+    if (g->count == 0) {
+        return;
+    }
+    fprintf(out, "Stats: %s %d: %llu fixes", name, value, (unsigned long long)g->count);
+    if (g->h_acc_sum > 0 || g->offset2_sum > 0) {
+        fprintf(out, ", h_acc %.3f m, offset rms %.3f m",
+                g->h_acc_sum / (double)g->count, sqrt(g->offset2_sum / (double)g->count));
+    }
+    fprintf(out, "\n");
+}
+
+/* The summary, as lines starting with "Stats:" */
+void stats_print(const Fix_Stats* s, FILE* out)
+{
+    double variance[3] = { 0.0, 0.0, 0.0 };
+    double covariance_en = 0.0;
+    double mean_lon;
+    int i;
+
+    fprintf(out, "Stats: %llu fixes, %llu with a position\n",
+            (unsigned long long)s->fixes, (unsigned long long)s->positions);
+    if (s->positions == 0) {
+        return;
+    }
+    if (s->positions > 1) {
+        for (i = 0; i < 3; i++) {
+            variance[i] = s->m2[i][i] / (double)(s->positions - 1);
+        }
+        covariance_en = s->m2[0][1] / (double)(s->positions - 1);
+    }
+    mean_lon = (s->lon0 + s->mean[0] / s->meters_per_lon) / 1.0e7;
+    if (mean_lon > 180.0) {
+        mean_lon -= 360.0;
+    } else if (mean_lon < -180.0) {
+        mean_lon += 360.0;
+    }
+    fprintf(out, "Stats: mean lat %.8f lon %.8f alt %.3f m\n",
+            (s->lat0 + s->mean[1] / METERS_PER_LAT) / 1.0e7, mean_lon,
+            s->alt0 / 1.0e3 + s->mean[2]);
+    fprintf(out, "Stats: std east %.3f north %.3f up %.3f m, covariance east north %.4f m^2\n",
+            sqrt(variance[0]), sqrt(variance[1]), sqrt(variance[2]), covariance_en);
+    fprintf(out, "Stats: CEP50 %.3f m, CEP95 %.3f m, 2DRMS %.3f m\n",
+            p2_value(&(s->cep50)), p2_value(&(s->cep95)),
+            2.0 * sqrt(variance[0] + variance[1]));
+    for (i = 0; i <= FIX_TYPE_TIME; i++) {
+        print_group(out, "fix type", i, &(s->by_type[i]));
+    }
+    for (i = 0; i <= STATS_MAX_SV; i++) {
+        print_group(out, "sv", i, &(s->by_sv[i]));
+    }
+}
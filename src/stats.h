@@ -0,0 +1,62 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "fix.h"
+
+/* Accuracy statistics of the fixes of a run, kept up to date with
+ * every fix in constant memory.
+ *
+ * Positions, of fixes flagged FIX_OK, are turned into east, north and
+ * up offsets in meters from the first fix, on a flat earth, which is
+ * fine for a receiver that does not move far. Mean and covariance are kept with Welford's
+ * method. 2DRMS follows from the covariance. CEP50 and CEP95 are
+ * estimated with the P-square algorithm on the horizontal distance of
+ * each fix to the mean at that time, so the first fixes of a run count
+ * against a mean that is still settling.
+ *
+ * Besides that the number of fixes, the mean reported horizontal
+ * accuracy and the RMS horizontal distance to the mean are kept per
+ * fix type and per number of satellites used.
+ */
+
+#define STATS_MAX_SV (40)   /* More are counted as this many */
+
+/* Estimate of one quantile, P-square algorithm (Jain and Chlamtac) */
+typedef struct P2_Quantile {
+    double p;
+    int count;
+    double height[5];
+    double position[5];
+    double desired[5];
+    double increment[5];
+} P2_Quantile;
+
+typedef struct Stats_Group {
+    uint64_t count;
+    double h_acc_sum;       /* m */
+    double offset2_sum;     /* m^2 */
+} Stats_Group;
+
+typedef struct Fix_Stats {
+    uint64_t fixes;
+    uint64_t positions;     /* FIX_OK fixes with a 2D or 3D position */
+    int32_t lat0;           /* Reference, the first position */
+    int32_t lon0;
+    int32_t alt0;
+    double meters_per_lon;  /* Per 1e-7 degree at lat0 */
+    double mean[3];         /* East, north, up */
+    double m2[3][3];        /* Sums of products of deviations */
+    P2_Quantile cep50;
+    P2_Quantile cep95;
+    Stats_Group by_type[FIX_TYPE_TIME + 1];
+    Stats_Group by_sv[STATS_MAX_SV + 1];
+} Fix_Stats;
+
+void stats_init(Fix_Stats* s);
+void stats_add(Fix_Stats* s, const GNSS_Fix* fix);
+void stats_print(const Fix_Stats* s, FILE* out);
+
+#endif /* STATS_H */
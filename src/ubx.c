@@ -0,0 +1,175 @@
+#include <stdio.h>
+
+#include "ubx.h"
+#include "util.h"
+
+static inline uint8_t get_u1(const uint8_t* p)
+{
+    return p[0];
+}
+
+static inline void put_u1(uint8_t* p, uint8_t v)
+{
+    p[0] = v;
+}
+
+static void dump_unsigned(FILE* f, const char* field, uint32_t v)
+{
+    fprintf(f, " %s %u", field, v);
+}
+
+static void dump_signed(FILE* f, const char* field, int32_t v)
+{
+    fprintf(f, " %s %d", field, v);
+}
+
+static void dump_hex(FILE* f, const char* field, uint32_t v)
+{
+    fprintf(f, " %s 0x%x", field, v);
+}
+
+static void dump_reserved(FILE* f, const char* field, uint32_t v)
+{
+    (void)f;
+    (void)field;
+    (void)v;
+}
+
+/* Per type: how to get, put and dump it */
+#define GET_u1 get_u1
+#define GET_u2 get_u16
+#define GET_u4 get_u32
+#define GET_i1 (int8_t)get_u1
+#define GET_i2 (int16_t)get_u16
+#define GET_i4 (int32_t)get_u32
+#define GET_x1 get_u1
+#define GET_x2 get_u16
+#define GET_x4 get_u32
+#define GET_r1 get_u1
+#define GET_r2 get_u16
+#define GET_r4 get_u32
+
+#define PUT_u1(p, v) put_u1(p, v)
+#define PUT_u2(p, v) put_u16(p, v)
+#define PUT_u4(p, v) put_u32(p, v)
+#define PUT_i1(p, v) put_u1(p, (uint8_t)(v))
+#define PUT_i2(p, v) put_u16(p, (uint16_t)(v))
+#define PUT_i4(p, v) put_u32(p, (uint32_t)(v))
+#define PUT_x1(p, v) put_u1(p, v)
+#define PUT_x2(p, v) put_u16(p, v)
+#define PUT_x4(p, v) put_u32(p, v)
+#define PUT_r1(p, v) put_u1(p, v)
+#define PUT_r2(p, v) put_u16(p, v)
+#define PUT_r4(p, v) put_u32(p, v)
+
+#define DUMP_u1 dump_unsigned
+#define DUMP_u2 dump_unsigned
+#define DUMP_u4 dump_unsigned
+#define DUMP_i1 dump_signed
+#define DUMP_i2 dump_signed
+#define DUMP_i4 dump_signed
+#define DUMP_x1 dump_hex
+#define DUMP_x2 dump_hex
+#define DUMP_x4 dump_hex
+#define DUMP_r1 dump_reserved
+#define DUMP_r2 dump_reserved
+#define DUMP_r4 dump_reserved
+
+#define DECODE_FIELD(type, field) \
+    m->field = GET_##type(body); \
+    body += UBX_SIZE_##type;
+#define ENCODE_FIELD(type, field) \
+    PUT_##type(p, m->field); \
+    p += UBX_SIZE_##type;
+#define DUMP_FIELD(type, field) \
+    DUMP_##type(f, #field, m->field);
+
+#define DEFINE(name) \
+    int ubx_decode_##name(const uint8_t* body, uint16_t length, UBX_##name* m) \
+    { \
+        if (length < UBX_##name##_LENGTH) { \
+            return 0; \
+        } \
+        UBX_##name##_FIELDS(DECODE_FIELD) \
+        return 1; \
+    } \
+    uint16_t ubx_encode_##name(const UBX_##name* m, uint8_t* body) \
+    { \
+        uint8_t* p = body; \
+        UBX_##name##_FIELDS(ENCODE_FIELD) \
+        return (uint16_t)(p - body); \
+    } \
+    void ubx_dump_##name(FILE* f, const UBX_##name* m) \
+    { \
+        UBX_##name##_FIELDS(DUMP_FIELD) \
+    }
+
+#define DEFINE_MESSAGE(name, class, id) \
+    DEFINE(name) \
+    static int dump_##name(FILE* f, const uint8_t* body, uint16_t length) \
+    { \
+        UBX_##name m; \
+        if (!ubx_decode_##name(body, length, &m)) { \
+            return 0; \
+        } \
+        ubx_dump_##name(f, &m); \
+        return 1; \
+    }
+
+UBX_MESSAGES(DEFINE_MESSAGE)
+UBX_PARTS(DEFINE)
+
+#define MESSAGE_INFO(name, class, id) \
+    { #name, UBX_CLASS_##class, id, UBX_##name##_LENGTH, dump_##name },
+#define CLASS_SLOT(class, value) [value] = UBX_SLOT_##class,
+#define DISPATCH(name, class, id) [UBX_SLOT_##class][id] = UBX_MSG_##name + 1,
+
+const Ubx_Message_Info ubx_messages[NUMBER_OF_UBX_MESSAGES] = {
+    UBX_MESSAGES(MESSAGE_INFO)
+};
+
+const uint8_t ubx_class_slot[256] = {
+    UBX_CLASSES(CLASS_SLOT)
+};
+
+const uint8_t ubx_dispatch[NUMBER_OF_UBX_SLOTS][256] = {
+    UBX_MESSAGES(DISPATCH)
+};
+
+_Static_assert(NUMBER_OF_UBX_MESSAGES < 255, "ubx_dispatch holds the index in a byte");
+_Static_assert(UBX_NAV_PVT_LENGTH == 84, "NAV-PVT");
+_Static_assert(UBX_NAV_DOP_LENGTH == 18, "NAV-DOP");
+_Static_assert(UBX_NAV_SAT_SV_LENGTH == 12, "NAV-SAT");
+_Static_assert(UBX_CFG_PRT_LENGTH == 20, "CFG-PRT");
+_Static_assert(UBX_CFG_NAVX5_LENGTH == 40, "CFG-NAVX5");
+_Static_assert(UBX_CFG_NAV5_LENGTH == 36, "CFG-NAV5");
+
+void ubx_checksum(const uint8_t* data, uint16_t n, uint8_t* ck_a, uint8_t* ck_b)
+{
+    uint16_t i;
+    uint8_t a = 0;
+    uint8_t b = 0;
+    for (i = 0; i < n; i++) {
+        a = a + data[i];
+        b = b + a;
+    }
+    *ck_a = a;
+    *ck_b = b;
+}
+
+int ubx_dump(FILE* f, uint8_t class, uint8_t id, const uint8_t* body, uint16_t length)
+{
+    const char* c;
+    int k = ubx_lookup(class, id);
+
+    if (k < 0) {
+        return 0;
+    }
+    /* CFG_PRT is CFG-PRT */
+    for (c = ubx_messages[k].name; *c != 0; c++) {
+        fputc(*c == '_' ? '-' : *c, f);
+    }
+    ubx_messages[k].dump(f, body, length);
+    fputc('\n', f);
+    return 1;
+}
@@ -0,0 +1,230 @@
+#ifndef UBX_H
+#define UBX_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* The UBX messages mon knows, described once.
+ *
+ * UBX_CLASSES lists the classes, UBX_MESSAGES the messages, with their
+ * class and id, and UBX_PARTS the bodies that share class and id with
+ * a message (polls) or repeat at the end of one. The fields of NAME are
+ * in UBX_NAME_FIELDS. From these lists come, for every NAME:
+ *
+ *   UBX_NAME            struct with the fields, in host types
+ *   UBX_NAME_LENGTH     bytes the fields take on the wire
+ *   UBX_NAME_CLASS/_ID  messages only
+ *   ubx_decode_NAME()   from the wire, returns 0 if the body is too short
+ *   ubx_encode_NAME()   to the wire, returns the length
+ *   ubx_dump_NAME()     the fields as text, the reserved ones left out
+ *
+ * The wire is little endian and the body has no alignment, the decoders
+ * and encoders go byte by byte and do not depend on the host. A message
+ * is found by class and id with ubx_lookup(): two table lookups, however
+ * many messages there are.
+ *
+ * A field is F(type, name), type one of
+ *
+ *   u1 u2 u4   unsigned
+ *   i1 i2 i4   signed
+ *   x1 x2 x4   bit fields, dumped in hex
+ *   r1 r2 r4   reserved
+ *
+ * Messages that later receivers extend list the fields of the first
+ * version only, a longer body decodes the same.
+ */
+
+#define UBX_CLASSES(C) \
+    C(NAV, 0x01) \
+    C(RXM, 0x02) \
+    C(INF, 0x04) \
+    C(ACK, 0x05) \
+    C(CFG, 0x06) \
+    C(MON, 0x0A) \
+    C(TIM, 0x0D)
+
+#define UBX_MESSAGES(X) \
+    X(NAV_DOP,   NAV, 0x04) \
+    X(NAV_PVT,   NAV, 0x07) \
+    X(NAV_SAT,   NAV, 0x35) \
+    X(ACK_NAK,   ACK, 0x00) \
+    X(ACK_ACK,   ACK, 0x01) \
+    X(CFG_PRT,   CFG, 0x00) \
+    X(CFG_MSG,   CFG, 0x01) \
+    X(CFG_DAT,   CFG, 0x06) \
+    X(CFG_RATE,  CFG, 0x08) \
+    X(CFG_CFG,   CFG, 0x09) \
+    X(CFG_NAVX5, CFG, 0x23) \
+    X(CFG_NAV5,  CFG, 0x24) \
+    X(CFG_GNSS,  CFG, 0x3E)
+
+#define UBX_PARTS(P) \
+    P(NAV_SAT_SV) \
+    P(CFG_PRT_POLL) \
+    P(CFG_GNSS_BLOCK)
+
+#define UBX_NAV_DOP_FIELDS(F) \
+    F(u4, iTOW) F(u2, gDOP) F(u2, pDOP) F(u2, tDOP) F(u2, vDOP) F(u2, hDOP) \
+    F(u2, nDOP) F(u2, eDOP)
+
+/* The u-blox 7 version, later receivers append more */
+#define UBX_NAV_PVT_FIELDS(F) \
+    F(u4, iTOW) F(u2, year) F(u1, month) F(u1, day) F(u1, hour) F(u1, min) \
+    F(u1, sec) F(x1, valid) F(u4, tAcc) F(i4, nano) F(u1, fixType) F(x1, flags) \
+    F(r1, reserved1) F(u1, numSV) F(i4, lon) F(i4, lat) F(i4, height) F(i4, hMSL) \
+    F(u4, hAcc) F(u4, vAcc) F(i4, velN) F(i4, velE) F(i4, velD) F(i4, gSpeed) \
+    F(i4, headMot) F(u4, sAcc) F(u4, headAcc) F(u2, pDOP) F(r2, reserved2) \
+    F(r4, reserved3)
+
+/* Followed by numSvs x NAV_SAT_SV */
+#define UBX_NAV_SAT_FIELDS(F) \
+    F(u4, iTOW) F(u1, version) F(u1, numSvs) F(r2, reserved1)
+
+#define UBX_NAV_SAT_SV_FIELDS(F) \
+    F(u1, gnssId) F(u1, svId) F(u1, cno) F(i1, elev) F(i2, azim) F(i2, prRes) \
+    F(x4, flags)
+
+#define UBX_ACK_NAK_FIELDS(F) \
+    F(x1, clsID) F(x1, msgID)
+
+#define UBX_ACK_ACK_FIELDS(F) \
+    F(x1, clsID) F(x1, msgID)
+
+#define UBX_CFG_PRT_FIELDS(F) \
+    F(u1, portID) F(r1, reserved0) F(x2, txReady) F(x4, mode) F(u4, baudRate) \
+    F(x2, inProtoMask) F(x2, outProtoMask) F(x2, flags) F(r2, reserved5)
+
+#define UBX_CFG_PRT_POLL_FIELDS(F) \
+    F(u1, portID)
+
+/* On the receivers with only msgClass, msgID and the rate on the port
+ * it is sent on; the answer to a poll has the rates on all six ports */
+#define UBX_CFG_MSG_FIELDS(F) \
+    F(x1, msgClass) F(x1, msgID) F(u1, rate)
+
+/* Only the datum number, the rest are floating point */
+#define UBX_CFG_DAT_FIELDS(F) \
+    F(u2, datumNum)
+
+#define UBX_CFG_RATE_FIELDS(F) \
+    F(u2, measRate) F(u2, navRate) F(u2, timeRef)
+
+#define UBX_CFG_CFG_FIELDS(F) \
+    F(x4, clearMask) F(x4, saveMask) F(x4, loadMask) F(x1, deviceMask)
+
+#define UBX_CFG_NAVX5_FIELDS(F) \
+    F(u2, version) F(x2, mask1) F(x4, mask2) F(r2, reserved1) F(u1, minSVs) \
+    F(u1, maxSVs) F(u1, minCNO) F(r1, reserved2) F(u1, iniFix3D) F(r2, reserved3) \
+    F(u1, ackAiding) F(u2, wknRollover) F(u1, sigAttenCompMode) F(r1, reserved4) \
+    F(r2, reserved5) F(r2, reserved6) F(u1, usePPP) F(u1, aopCfg) F(r2, reserved7) \
+    F(u2, aopOrbMaxErr) F(r4, reserved8) F(r2, reserved9) F(r1, reserved10) \
+    F(u1, useAdr)
+
+#define UBX_CFG_NAV5_FIELDS(F) \
+    F(x2, mask) F(u1, dynModel) F(u1, fixMode) F(i4, fixedAlt) F(u4, fixedAltVar) \
+    F(i1, minElev) F(u1, drLimit) F(u2, pDop) F(u2, tDop) F(u2, pAcc) F(u2, tAcc) \
+    F(u1, staticHoldThresh) F(u1, dgnssTimeout) F(u1, cnoThreshNumSVs) \
+    F(u1, cnoThresh) F(r2, reserved1) F(u2, staticHoldMaxDist) F(u1, utcStandard) \
+    F(r1, reserved2) F(r4, reserved3)
+
+/* Followed by numConfigBlocks x CFG_GNSS_BLOCK */
+#define UBX_CFG_GNSS_FIELDS(F) \
+    F(u1, msgVer) F(u1, numTrkChHw) F(u1, numTrkChUse) F(u1, numConfigBlocks)
+
+#define UBX_CFG_GNSS_BLOCK_FIELDS(F) \
+    F(u1, gnssId) F(u1, resTrkCh) F(u1, maxTrkCh) F(r1, reserved1) F(x4, flags)
+
+/* --------------------------------------------------------------------*/
+
+#define UBX_TYPE_u1 uint8_t
+#define UBX_TYPE_u2 uint16_t
+#define UBX_TYPE_u4 uint32_t
+#define UBX_TYPE_i1 int8_t
+#define UBX_TYPE_i2 int16_t
+#define UBX_TYPE_i4 int32_t
+#define UBX_TYPE_x1 uint8_t
+#define UBX_TYPE_x2 uint16_t
+#define UBX_TYPE_x4 uint32_t
+#define UBX_TYPE_r1 uint8_t
+#define UBX_TYPE_r2 uint16_t
+#define UBX_TYPE_r4 uint32_t
+
+#define UBX_SIZE_u1 1
+#define UBX_SIZE_u2 2
+#define UBX_SIZE_u4 4
+#define UBX_SIZE_i1 1
+#define UBX_SIZE_i2 2
+#define UBX_SIZE_i4 4
+#define UBX_SIZE_x1 1
+#define UBX_SIZE_x2 2
+#define UBX_SIZE_x4 4
+#define UBX_SIZE_r1 1
+#define UBX_SIZE_r2 2
+#define UBX_SIZE_r4 4
+
+#define UBX_STRUCT_FIELD(type, field) UBX_TYPE_##type field;
+#define UBX_FIELD_SIZE(type, field) + UBX_SIZE_##type
+
+#define UBX_DECLARE(name) \
+    typedef struct UBX_##name { \
+        UBX_##name##_FIELDS(UBX_STRUCT_FIELD) \
+    } UBX_##name; \
+    enum { UBX_##name##_LENGTH = 0 UBX_##name##_FIELDS(UBX_FIELD_SIZE) }; \
+    int ubx_decode_##name(const uint8_t* body, uint16_t length, UBX_##name* m); \
+    uint16_t ubx_encode_##name(const UBX_##name* m, uint8_t* body); \
+    void ubx_dump_##name(FILE* f, const UBX_##name* m);
+
+#define UBX_DECLARE_MESSAGE(name, class, id) \
+    UBX_DECLARE(name) \
+    enum { UBX_##name##_CLASS = UBX_CLASS_##class, UBX_##name##_ID = id };
+#define UBX_CLASS_VALUE(class, value) UBX_CLASS_##class = value,
+#define UBX_CLASS_SLOT(class, value) UBX_SLOT_##class,
+#define UBX_MESSAGE_INDEX(name, class, id) UBX_MSG_##name,
+
+enum { UBX_CLASSES(UBX_CLASS_VALUE) };
+
+/* Row of a class in ubx_dispatch, 0 for the classes not listed */
+enum Ubx_Slot {
+    UBX_SLOT_NONE,
+    UBX_CLASSES(UBX_CLASS_SLOT)
+    NUMBER_OF_UBX_SLOTS
+};
+
+/* Index in ubx_messages */
+enum Ubx_Message_Index {
+    UBX_MESSAGES(UBX_MESSAGE_INDEX)
+    NUMBER_OF_UBX_MESSAGES
+};
+
+UBX_MESSAGES(UBX_DECLARE_MESSAGE)
+UBX_PARTS(UBX_DECLARE)
+
+typedef struct Ubx_Message_Info {
+    const char* name;       /* As in the u-blox manuals, CFG-PRT */
+    uint8_t class;
+    uint8_t id;
+    uint16_t length;        /* UBX_NAME_LENGTH */
+    /* Decode and dump, returns 0 if the body is too short */
+    int (*dump)(FILE* f, const uint8_t* body, uint16_t length);
+} Ubx_Message_Info;
+
+extern const Ubx_Message_Info ubx_messages[NUMBER_OF_UBX_MESSAGES];
+extern const uint8_t ubx_class_slot[256];
+/* Index in ubx_messages + 1, 0 for the messages not listed */
+extern const uint8_t ubx_dispatch[NUMBER_OF_UBX_SLOTS][256];
+
+/* Index in ubx_messages of class and id, -1 if it is not listed */
+static inline int ubx_lookup(uint8_t class, uint8_t id)
+{
+    return (int)ubx_dispatch[ubx_class_slot[class]][id] - 1;
+}
+
+/* The 8-bit Fletcher checksum of the n bytes from class to the end of
+ * the body */
+void ubx_checksum(const uint8_t* data, uint16_t n, uint8_t* ck_a, uint8_t* ck_b);
+
+/* Print name and fields of a message on one line. Returns 0 if it is
+ * not listed. */
+int ubx_dump(FILE* f, uint8_t class, uint8_t id, const uint8_t* body, uint16_t length);
+
+#endif /* UBX_H */
@@ -0,0 +1,75 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Small helpers shared by mon and its tools.
+ *
+ * The files mon writes, and UBX on the wire, are little endian with no
+ * alignment, so numbers are put and got byte by byte, the same on any
+ * host.
+ */
+
+static inline void put_u16(uint8_t* p, uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put_u32(uint8_t* p, uint32_t v)
+{
+    put_u16(p, (uint16_t)v);
+    put_u16(&(p[2]), (uint16_t)(v >> 16));
+}
+
+static inline void put_u64(uint8_t* p, uint64_t v)
+{
+    put_u32(p, (uint32_t)v);
+    put_u32(&(p[4]), (uint32_t)(v >> 32));
+}
+
+static inline uint16_t get_u16(const uint8_t* p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get_u32(const uint8_t* p)
+{
+    return (uint32_t)get_u16(p) | ((uint32_t)get_u16(&(p[2])) << 16);
+}
+
+static inline uint64_t get_u64(const uint8_t* p)
+{
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(&(p[4])) << 32);
+}
+
+/* CLOCK_MONOTONIC in ns, the time base of the receive times */
+static inline uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Write all n bytes to a blocking fd. Returns 0, or -1 on an error. */
+static inline int write_all(int fd, const uint8_t* data, size_t n)
+{
+    while (n > 0) {
+        ssize_t k = write(fd, data, n);
+        if (k < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += k;
+        n -= (size_t)k;
+    }
+    return 0;
+}
+
+#endif /* UTIL_H */